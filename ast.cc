@@ -8,23 +8,6 @@
 #include "evaluator.h"
 
 
-static MemPoolImp<BinaryOp>         binaryOpPool;
-static MemPoolImp<ConditionalOp>    conditionalOpPool;
-static MemPoolImp<FuncCall>         funcCallPool;
-static MemPoolImp<Declaration>   initializationPool;
-static MemPoolImp<Object>           objectPool;
-static MemPoolImp<Identifier>       identifierPool;
-static MemPoolImp<Enumerator>       enumeratorPool;
-static MemPoolImp<Constant>         constantPool;
-static MemPoolImp<TempVar>          tempVarPool;
-static MemPoolImp<UnaryOp>          unaryOpPool;
-static MemPoolImp<EmptyStmt>        emptyStmtPool;
-static MemPoolImp<IfStmt>           ifStmtPool;
-static MemPoolImp<JumpStmt>         jumpStmtPool;
-static MemPoolImp<ReturnStmt>       returnStmtPool;
-static MemPoolImp<LabelStmt>        labelStmtPool;
-static MemPoolImp<CompoundStmt>     compoundStmtPool;
-static MemPoolImp<FuncDef>          funcDefPool;
 
 
 
@@ -38,8 +21,7 @@ void Declaration::Accept(Visitor* v)
 }
 
 void EmptyStmt::Accept(Visitor* v) {
-  //assert(false);
-  //v->VisitEmptyStmt(this);
+  v->VisitEmptyStmt(this);
 }
 
 void LabelStmt::Accept(Visitor* v) {
@@ -54,6 +36,10 @@ void JumpStmt::Accept(Visitor* v) {
   v->VisitJumpStmt(this);
 }
 
+void SwitchStmt::Accept(Visitor* v) {
+  v->VisitSwitchStmt(this);
+}
+
 void ReturnStmt::Accept(Visitor* v) {
   v->VisitReturnStmt(this);
 }
@@ -159,8 +145,7 @@ BinaryOp* BinaryOp::New(const Token* tok, int op, Expr* lhs, Expr* rhs)
     assert(0);
   }
 
-  auto ret = new (binaryOpPool.Alloc()) BinaryOp(tok, op, lhs, rhs);
-  ret->pool_ = &binaryOpPool;
+  auto ret = new (Arena::Alloc<BinaryOp>()) BinaryOp(tok, op, lhs, rhs);
   
   ret->TypeChecking();
   return ret;    
@@ -404,8 +389,7 @@ void BinaryOp::AssignOpTypeChecking()
 
 UnaryOp* UnaryOp::New(int op, Expr* operand, ::Type* type)
 {
-  auto ret = new (unaryOpPool.Alloc()) UnaryOp(op, operand, type);
-  ret->pool_ = &unaryOpPool;
+  auto ret = new (Arena::Alloc<UnaryOp>()) UnaryOp(op, operand, type);
   
   ret->TypeChecking();
   return ret;
@@ -534,9 +518,8 @@ void UnaryOp::CastOpTypeChecking()
 ConditionalOp* ConditionalOp::New(const Token* tok,
     Expr* cond, Expr* exprTrue, Expr* exprFalse)
 {
-  auto ret = new (conditionalOpPool.Alloc())
+  auto ret = new (Arena::Alloc<ConditionalOp>())
       ConditionalOp(cond, exprTrue, exprFalse);
-  ret->pool_ = &conditionalOpPool;
 
   ret->TypeChecking();
   return ret;
@@ -582,8 +565,7 @@ void ConditionalOp::TypeChecking()
 
 FuncCall* FuncCall::New(Expr* designator, const ArgList& args)
 {
-  auto ret = new (funcCallPool.Alloc()) FuncCall(designator, args);
-  ret->pool_ = &funcCallPool;
+  auto ret = new (Arena::Alloc<FuncCall>()) FuncCall(designator, args);
 
   ret->TypeChecking();
   return ret;
@@ -636,24 +618,21 @@ void FuncCall::TypeChecking()
 Identifier* Identifier::New(const Token* tok,
     ::Type* type, enum Linkage linkage)
 {
-  auto ret = new (identifierPool.Alloc()) Identifier(tok, type, linkage);
-  ret->pool_ = &identifierPool;
+  auto ret = new (Arena::Alloc<Identifier>()) Identifier(tok, type, linkage);
   return ret;
 }
 
 
 Enumerator* Enumerator::New(const Token* tok, int val)
 {
-  auto ret = new (enumeratorPool.Alloc()) Enumerator(tok, val);
-  ret->pool_ = &enumeratorPool;
+  auto ret = new (Arena::Alloc<Enumerator>()) Enumerator(tok, val);
   return ret;
 }
 
 
 Declaration* Declaration::New(Object* obj)
 {
-  auto ret = new (initializationPool.Alloc()) Declaration(obj);
-  ret->pool_ = &initializationPool;
+  auto ret = new (Arena::Alloc<Declaration>()) Declaration(obj);
   return ret;
 }
 
@@ -677,9 +656,8 @@ Object* Object::New(const Token* tok, ::Type* type,
     int storage, enum Linkage linkage,
     unsigned char bitFieldBegin, unsigned char bitFieldWidth)
 {
-  auto ret = new (objectPool.Alloc())
+  auto ret = new (Arena::Alloc<Object>())
       Object(tok, type, storage, linkage, bitFieldBegin, bitFieldWidth);
-  ret->pool_ = &objectPool;
 
   static long id = 0;
   if (ret->IsStatic() || ret->Anonymous())
@@ -691,9 +669,8 @@ Object* Object::NewAnony(const Token* tok, ::Type* type,
     int storage, enum Linkage linkage,
     unsigned char bitFieldBegin, unsigned char bitFieldWidth)
 {
-  auto ret = new (objectPool.Alloc())
+  auto ret = new (Arena::Alloc<Object>())
       Object(tok, type, storage, linkage, bitFieldBegin, bitFieldWidth);
-  ret->pool_ = &objectPool;
   ret->anonymous_ = true;
 
   static long id = 0;
@@ -705,7 +682,7 @@ Object* Object::NewAnony(const Token* tok, ::Type* type,
 /*
 Object* Object::Copy(const Object& other)
 {
-  auto ret = new (ObjectPool.Alloc()) Object();
+  auto ret = new (Arena::Alloc<Object>()) Object();
   *ret = other;
   return ret;
 }
@@ -718,16 +695,14 @@ Object* Object::Copy(const Object& other)
 Constant* Constant::New(const Token* tok, int tag, long val)
 {
   auto type = ArithmType::New(tag);
-  auto ret = new (constantPool.Alloc()) Constant(tok, type, val);
-  ret->pool_ = &constantPool;
+  auto ret = new (Arena::Alloc<Constant>()) Constant(tok, type, val);
   return ret;
 }
 
 Constant* Constant::New(const Token* tok, int tag, double val)
 {
   auto type = ArithmType::New(tag);
-  auto ret = new (constantPool.Alloc()) Constant(tok, type, val);
-  ret->pool_ = &constantPool;
+  auto ret = new (Arena::Alloc<Constant>()) Constant(tok, type, val);
   return ret;
 }
 
@@ -736,8 +711,7 @@ Constant* Constant::New(const Token* tok, int tag, const std::string* val)
   auto derived = ArithmType::New(tag);
   auto type = ArrayType::New(val->size() / derived->Width(), derived);
 
-  auto ret = new (constantPool.Alloc()) Constant(tok, type, val);
-  ret->pool_ = &constantPool;
+  auto ret = new (Arena::Alloc<Constant>()) Constant(tok, type, val);
 
   static long id = 0;
   ret->id_ = ++id;
@@ -763,8 +737,7 @@ std::string Constant::SValRepr() const
 
 TempVar* TempVar::New(::Type* type)
 {
-  auto ret = new (tempVarPool.Alloc()) TempVar(type);
-  ret->pool_ = &tempVarPool;
+  auto ret = new (Arena::Alloc<TempVar>()) TempVar(type);
   return ret;
 }
 
@@ -775,8 +748,7 @@ TempVar* TempVar::New(::Type* type)
 
 EmptyStmt* EmptyStmt::New()
 {
-  auto ret = new (emptyStmtPool.Alloc()) EmptyStmt();
-  ret->pool_ = &emptyStmtPool;
+  auto ret = new (Arena::Alloc<EmptyStmt>()) EmptyStmt();
   return ret;
 }
 
@@ -784,48 +756,55 @@ EmptyStmt* EmptyStmt::New()
 //else stmt Ĭ���� null
 IfStmt* IfStmt::New(Expr* cond, Stmt* then, Stmt* els)
 {
-  auto ret = new (ifStmtPool.Alloc()) IfStmt(cond, then, els);
-  ret->pool_ = &ifStmtPool;
+  auto ret = new (Arena::Alloc<IfStmt>()) IfStmt(cond, then, els);
   return ret;
 }
 
 
 CompoundStmt* CompoundStmt::New(std::list<Stmt*>& stmts, ::Scope* scope)
 {
-  auto ret = new (compoundStmtPool.Alloc()) CompoundStmt(stmts, scope);
-  ret->pool_ = &compoundStmtPool;
+  auto ret = new (Arena::Alloc<CompoundStmt>()) CompoundStmt(stmts, scope);
   return ret;
 }
 
 
 JumpStmt* JumpStmt::New(LabelStmt* label)
 {
-  auto ret = new (jumpStmtPool.Alloc()) JumpStmt(label);
-  ret->pool_ = &jumpStmtPool;
+  auto ret = new (Arena::Alloc<JumpStmt>()) JumpStmt(label);
+  return ret;
+}
+
+
+SwitchStmt* SwitchStmt::New(TempVar* cond, const CaseList& cases,
+    LabelStmt* deflt, LabelStmt* end)
+{
+  auto ret = new (Arena::Alloc<SwitchStmt>())
+      SwitchStmt(cond, cases, deflt, end);
   return ret;
 }
 
 
 ReturnStmt* ReturnStmt::New(Expr* expr)
 {
-  auto ret = new (returnStmtPool.Alloc()) ReturnStmt(expr);
-  ret->pool_ = &returnStmtPool;
+  auto ret = new (Arena::Alloc<ReturnStmt>()) ReturnStmt(expr);
   return ret;
 }
 
 
+int LabelStmt::lastTag_ = 0;
+thread_local int LabelStmt::curSpace_ = 0;
+thread_local int LabelStmt::spaceTag_ = 0;
+
 LabelStmt* LabelStmt::New()
 {
-  auto ret = new (labelStmtPool.Alloc()) LabelStmt();
-  ret->pool_ = &labelStmtPool;
+  auto ret = new (Arena::Alloc<LabelStmt>()) LabelStmt();
   return ret;
 }
 
 
 FuncDef* FuncDef::New(Identifier* ident, LabelStmt* retLabel)
 {
-  auto ret = new (funcDefPool.Alloc()) FuncDef(ident, retLabel);
-  ret->pool_ = &funcDefPool;
+  auto ret = new (Arena::Alloc<FuncDef>()) FuncDef(ident, retLabel);
 
   return ret;
 }
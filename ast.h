@@ -9,6 +9,7 @@
 #include <list>
 #include <memory>
 #include <string>
+#include <vector>
 
 
 class Visitor;
@@ -41,6 +42,7 @@ class Enumerator;
 class Stmt;
 class IfStmt;
 class JumpStmt;
+class SwitchStmt;
 class LabelStmt;
 class EmptyStmt;
 class CompoundStmt;
@@ -58,11 +60,10 @@ public:
   virtual ~ASTNode() {}
   
   virtual void Accept(Visitor* v) = 0;
+  virtual FuncDef* ToFuncDef() { return nullptr; }
 
 protected:
   ASTNode() {}
-
-  MemPool* pool_ {nullptr};
 };
 
 typedef ASTNode ExtDecl;
@@ -84,6 +85,7 @@ class EmptyStmt : public Stmt
 {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
+  friend class Serializer;
   friend class Generator;
 
 public:
@@ -103,6 +105,7 @@ class LabelStmt : public Stmt
 {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
+  friend class Serializer;
   friend class Generator;
 public:
   static LabelStmt* New();
@@ -112,18 +115,39 @@ public:
   virtual void Accept(Visitor* v);
   
   std::string Label() const {
-    return ".L" + std::to_string(tag_);
+    if (space_ == 0)
+      return ".L" + std::to_string(tag_);
+    return ".L" + std::to_string(space_) + "_" + std::to_string(tag_);
+  }
+
+  // Labels created by a code generation thread are numbered per
+  // function (the label space), thus the output does not depend on
+  // the scheduling of the threads. Space 0 is the global numbering.
+  // The tags of the space begin after 'tag'.
+  static void EnterSpace(int space, int tag=0) {
+    curSpace_ = space;
+    spaceTag_ = tag;
+  }
+  static int Space() { return curSpace_; }
+  static std::string SpaceLabel(const std::string& prefix) {
+    return prefix + std::to_string(curSpace_)
+         + "_" + std::to_string(++spaceTag_);
   }
 
 protected:
-  LabelStmt(): tag_(GenTag()) {}
+  LabelStmt(): space_(curSpace_), tag_(GenTag()) {}
 
 private:
   static int GenTag() {
-    static int tag = 0;
-    return ++tag;
+    return curSpace_ ? ++spaceTag_: ++lastTag_;
   }
-  
+
+  // The last tag of the global numbering
+  static int lastTag_;
+  static thread_local int curSpace_;
+  static thread_local int spaceTag_;
+
+  int space_;
   int tag_; // 使用整型的tag值，而不直接用字符串
 };
 
@@ -132,7 +156,10 @@ class IfStmt : public Stmt
 {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
+  friend class Serializer;
   friend class Generator;
+  friend class ConstantFolder;
+  friend class RegAllocator;
 public:
   static IfStmt* New(Expr* cond, Stmt* then, Stmt* els=nullptr);
 
@@ -155,6 +182,7 @@ class JumpStmt : public Stmt
 {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
+  friend class Serializer;
   friend class Generator;
 
 public:
@@ -176,11 +204,55 @@ private:
 };
 
 
+/*
+ * The dispatch of 'switch' to its case labels, the controlling
+ * expression is already assigned to the temporary 'cond_'
+ */
+class SwitchStmt: public Stmt
+{
+  template<typename T> friend class Evaluator;
+  friend class AddrEvaluator;
+  friend class Serializer;
+  friend class Generator;
+
+public:
+  // 'case lo_ ... hi_:', a single value if 'lo_' equals 'hi_'
+  struct Case {
+    long lo_;
+    long hi_;
+    LabelStmt* label_;
+  };
+  typedef std::vector<Case> CaseList;
+
+  static SwitchStmt* New(TempVar* cond, const CaseList& cases,
+      LabelStmt* deflt, LabelStmt* end);
+
+  virtual ~SwitchStmt() {}
+
+  virtual void Accept(Visitor* v);
+
+protected:
+  SwitchStmt(TempVar* cond, const CaseList& cases,
+      LabelStmt* deflt, LabelStmt* end)
+      : cond_(cond), cases_(cases), default_(deflt), end_(end) {}
+
+private:
+  TempVar* cond_;
+  CaseList cases_;
+  // nullptr if there is no 'default'
+  LabelStmt* default_;
+  LabelStmt* end_;
+};
+
+
 class ReturnStmt: public Stmt
 {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
+  friend class Serializer;
   friend class Generator;
+  friend class ConstantFolder;
+  friend class RegAllocator;
 
 public:
   static ReturnStmt* New(Expr* expr);
@@ -203,6 +275,7 @@ class CompoundStmt : public Stmt
 {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
+  friend class Serializer;
   friend class Generator;
 
 public:
@@ -255,6 +328,7 @@ class Declaration: public Stmt
 {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
+  friend class Serializer;
   friend class Generator;
   
   typedef std::set<Initializer> InitList;
@@ -308,6 +382,7 @@ class Expr : public Stmt
 {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
+  friend class Serializer;
   friend class Generator;
   friend class LValGenerator;
 
@@ -358,8 +433,12 @@ class BinaryOp : public Expr
 {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
+  friend class Serializer;
   friend class Generator;
+  friend class ConstantFolder;
+  friend class RegAllocator;
   friend class LValGenerator;
+  friend class BranchGenerator;
   friend class Declaration;
 
 public:
@@ -427,8 +506,12 @@ class UnaryOp : public Expr
 {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
+  friend class Serializer;
   friend class Generator;
+  friend class ConstantFolder;
+  friend class RegAllocator;
   friend class LValGenerator;
+  friend class BranchGenerator;
 
 public:
   static UnaryOp* New(int op, Expr* operand, ::Type* type=nullptr);
@@ -468,7 +551,10 @@ class ConditionalOp : public Expr
 {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
+  friend class Serializer;
   friend class Generator;
+  friend class ConstantFolder;
+  friend class RegAllocator;
 
 public:
   static ConditionalOp* New(const Token* tok,
@@ -503,7 +589,9 @@ class FuncCall : public Expr
 {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
+  friend class Serializer;
   friend class Generator;
+  friend class ConstantFolder;
 
 public:        
   typedef std::vector<Expr*> ArgList;
@@ -552,6 +640,7 @@ class Constant: public Expr
 {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
+  friend class Serializer;
   friend class Generator;
 
 public:
@@ -611,6 +700,7 @@ class TempVar : public Expr
 {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
+  friend class Serializer;
   friend class Generator;
 
 public:
@@ -650,6 +740,7 @@ class Identifier: public Expr
 {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
+  friend class Serializer;
   friend class Generator;
   friend class LValGenerator;
 
@@ -712,6 +803,7 @@ class Enumerator: public Identifier
 {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
+  friend class Serializer;
   friend class Generator;
 
 public:
@@ -742,6 +834,7 @@ class Object : public Identifier
 {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
+  friend class Serializer;
   friend class Generator;
   friend class LValGenerator;
 
@@ -797,6 +890,15 @@ public:
     offset_ = offset;
   }
 
+  // The register holding the object, nullptr if it is in memory
+  const char* Reg() const {
+    return reg_;
+  }
+
+  void SetReg(const char* reg) {
+    reg_ = reg;
+  }
+
   Declaration* Decl() {
     return decl_;
   }
@@ -874,6 +976,7 @@ private:
 
   bool anonymous_;
   long id_ {0};
+  const char* reg_ {nullptr};
 };
 
 
@@ -885,6 +988,7 @@ class FuncDef : public ExtDecl
 {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
+  friend class Serializer;
   friend class Generator;
 
 public:
@@ -899,6 +1003,8 @@ public:
     return ident_->Type()->ToFunc();
   }
 
+  virtual FuncDef* ToFuncDef() { return this; }
+
   CompoundStmt* Body() {
     return body_;
   }
@@ -932,6 +1038,7 @@ class TranslationUnit : public ASTNode
 {
   template<typename T> friend class Evaluator;
   friend class AddrEvaluator;
+  friend class Serializer;
   friend class Generator;
 
 public:
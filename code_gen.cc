@@ -2,26 +2,47 @@
 
 #include "evaluator.h"
 #include "parser.h"
+#include "pass.h"
+#include "reg_alloc.h"
+#include "serializer.h"
 #include "token.h"
 
+#include <cctype>
 #include <cstdarg>
+#include <climits>
+#include <cstdlib>
 
+#include <algorithm>
+#include <atomic>
 #include <queue>
 #include <set>
+#include <thread>
+
+#include <unistd.h>
 
 
 extern std::string inFileName;
 extern std::string outFileName;
 
 
-Parser* Generator::parser_ = nullptr;
-FILE* Generator::outFile_ = nullptr;
+TranslationUnit* Generator::unit_ = nullptr;
+int Generator::jobs_ = 1;
+std::string Generator::cacheDir_;
+std::string Generator::cacheKey_;
+thread_local FILE* Generator::outFile_ = nullptr;
 //std::string Generator::_cons;
-RODataList Generator::rodatas_;
-std::vector<Declaration*> Generator::staticDecls_;
-int Generator::offset_ = 0;
-int Generator::retAddrOffset_ = 0;
-FuncDef* Generator::curFunc_ = nullptr;
+thread_local RODataList Generator::rodatas_;
+thread_local std::vector<Declaration*> Generator::staticDecls_;
+thread_local int Generator::offset_ = 0;
+thread_local int Generator::pinned_ = 0;
+thread_local std::unordered_set<Object*> Generator::addrTaken_;
+thread_local int Generator::retAddrOffset_ = 0;
+thread_local FuncDef* Generator::curFunc_ = nullptr;
+thread_local std::vector<const char*> Generator::tempRegs_;
+thread_local std::vector<const char*> Generator::spills_;
+thread_local std::vector<const char*> Generator::usedRegs_;
+thread_local int Generator::saveOffset_ = 0;
+thread_local IRFunc* Generator::func_ = nullptr;
 
 
 /*
@@ -31,7 +52,7 @@ FuncDef* Generator::curFunc_ = nullptr;
  *  xmm9: source operand register;
  *  xmm10: tmp register for floating data swap;
  *  rax: accumulator;
- *  r12, r13: temp register for rdx and rcx
+ *  rbx, r12 - r15: objects and temporaries allocated by RegAllocator
  *  r11: source operand register;
  *  r10: base register when LValGenerator eval the address.
  *  rcx: tempvar register, like the tempvar of 'switch'
@@ -48,7 +69,11 @@ static std::vector<const char*> xregs {
   "xmm4", "xmm5", "xmm6", "xmm7"
 };
 
-static ParamClass Classify(Type* paramType, int offset=0)
+// Objects of the bytes at least are copied and zeroed by 'rep',
+// those of 16 bytes at least by the SSE registers
+static const int repWidth = 256;
+
+static ParamClass Classify(Type* paramType)
 {
   if (paramType->IsInteger() || paramType->ToPointer()
       || paramType->ToArray()) {
@@ -73,48 +98,123 @@ static ParamClass Classify(Type* paramType, int offset=0)
       return ParamClass::COMPLEX_X87;
   }
 
-  auto type = paramType->ToStruct();
-  assert(type);
+  // The struct/union passed by registers is classified by ClassifyStruct()
+  assert(paramType->ToStruct());
   return ParamClass::MEMORY;
-  // TODO(wgtdkp): Support agrregate type 
-  assert(false);
-  /*
-  auto type = paramType->ToStruct();
-  assert(type);
+}
 
-  if (type->Width() > 4 * 8)
-    return PC_MEMORY;
 
+static void MergeClass(std::vector<ParamClass>& classes,
+    int begin, int end, ParamClass cls)
+{
+  for (int i = begin / 8; i <= (end - 1) / 8; ++i) {
+    if (classes[i] == ParamClass::NO_CLASS || cls == ParamClass::INTEGER)
+      classes[i] = cls;
+  }
+}
+
+
+// Merge the classes of the fields of 'type' at 'offset' into 'classes',
+// returns false if the struct/union should be passed by memory
+static bool ClassifyFields(Type* type, int offset,
+    std::vector<ParamClass>& classes)
+{
+  if (type->ToStruct()) {
+    for (auto member: type->ToStruct()->Members()) {
+      auto memberType = member->Type();
+      if (member->Anonymous() && memberType->ToStruct()) {
+        // Members of anonymous struct/union are offseted
+        // by the enclosing struct/union already
+        if (!ClassifyFields(memberType, offset, classes))
+          return false;
+      } else if (member->BitFieldWidth()) {
+        auto begin = offset + member->Offset();
+        MergeClass(classes, begin, begin + (member->BitFieldEnd() + 7) / 8,
+                   ParamClass::INTEGER);
+      } else if (!ClassifyFields(memberType,
+                                 offset + member->Offset(), classes)) {
+        return false;
+      }
+    }
+    return true;
+  } else if (type->ToArray()) {
+    auto elemType = type->ToArray()->Derived();
+    for (int i = 0; i < type->ToArray()->Len(); ++i) {
+      if (!ClassifyFields(elemType, offset + i * elemType->Width(), classes))
+        return false;
+    }
+    return true;
+  }
+
+  auto arithmType = type->ToArithm();
+  if (arithmType && arithmType->Tag() == (T_LONG | T_DOUBLE))
+    return false;
+  // Unaligned fields are passed by memory
+  if (offset % type->Align())
+    return false;
+  MergeClass(classes, offset, offset + type->Width(),
+             type->IsFloat() ? ParamClass::SSE: ParamClass::INTEGER);
+  return true;
+}
+
+
+// The classes of the eightbytes of a struct/union passed by registers,
+// empty if it is passed by memory
+static std::vector<ParamClass> ClassifyStruct(Type* type)
+{
   std::vector<ParamClass> classes;
-  int cnt = (type->Width() + 7) / 8;
-  for (int i = 0; i < cnt; i++) {
-    auto  types = FieldsIn8Bytes(type, i);
-    assert(types.size() > 0);
-    
-    auto fieldClass = (types.size() == 1)
-        ? PC_NO_CLASS: FieldClass(types, 0);
-    classes.push_back(fieldClass);
-    
+  if (type->Width() == 0 || type->Width() > 16)
+    return classes;
+  classes.resize((type->Width() + 7) / 8, ParamClass::NO_CLASS);
+  if (!ClassifyFields(type, 0, classes))
+    classes.clear();
+  for (auto& cls: classes) {
+    if (cls == ParamClass::NO_CLASS)
+      cls = ParamClass::INTEGER;
   }
+  return classes;
+}
 
-  bool sawX87 = false;
-  for (int i = 0; i < classes.size(); i++) {
-    if (classes[i] == PC_MEMORY)
-      return PC_MEMORY;
-    if (classes[i] == PC_X87_UP && sawX87)
-      return PC_MEMORY;
-    if (classes[i] == PC_X87)
-      sawX87 = true;
+
+// Struct/union neither passed nor returned by registers
+static bool InMemory(Type* type)
+{
+  return type->ToStruct() && ClassifyStruct(type).empty();
+}
+
+
+// The registers of a struct/union passed by registers are joined by ','
+static LocationList SplitLocation(const std::string& loc)
+{
+  LocationList regs;
+  size_t begin = 0, end;
+  while ((end = loc.find(',', begin)) != std::string::npos) {
+    regs.push_back(loc.substr(begin, end - begin));
+    begin = end + 1;
+  }
+  regs.push_back(loc.substr(begin));
+  return regs;
+}
+
+
+// The registers holding the returned struct/union, in the order of eightbytes
+static LocationList ReturnRegs(Type* type)
+{
+  LocationList regs;
+  int cnt[2] = {0, 0};
+  for (auto cls: ClassifyStruct(type)) {
+    if (cls == ParamClass::SSE)
+      regs.push_back(cnt[1]++ ? "xmm1": "xmm0");
+    else
+      regs.push_back(cnt[0]++ ? "rdx": "rax");
   }
-  */
-  return ParamClass::NO_CLASS; // Make compiler happy
+  return regs;
 }
 
+// The integer constants are immediates instead
 std::string Generator::ConsLabel(Constant* cons)
 {
-  if (cons->Type()->IsInteger()) {
-    return "$" + std::to_string(cons->IVal());
-  } else if (cons->Type()->IsFloat()) {
+  if (cons->Type()->IsFloat()) {
     double valsd = cons->FVal();
     float  valss = valsd;
     // TODO(wgtdkp): Add rodata
@@ -179,6 +279,23 @@ static const char* GetReg(int width)
   }
 }
 
+// The name of the 'width' bytes part of the 8 bytes register 'reg'
+static std::string GetReg(const char* reg, int width)
+{
+  if (isdigit(reg[1]))
+    return reg + std::string(width == 1 ? "b": width == 2 ? "w":
+                             width == 4 ? "d": "");
+  // 'rbx', 'rsi' and 'rdi'
+  std::string low = reg + 1;
+  switch (width) {
+  case 1: return low[1] == 'x' ? low.substr(0, 1) + "l": low + "l";
+  case 2: return low;
+  case 4: return "e" + low;
+  default: return reg;
+  }
+}
+
+
 static const char* GetDes(int width, bool flt)
 {
   if (flt) {
@@ -237,9 +354,21 @@ int Generator::Pop(const std::string& reg)
 }
 
 
+// Integer temporaries are kept in the free callee-saved registers
 void Generator::Spill(bool flt)
 {
-  Push(flt ? "xmm0": "rax");
+  if (flt || tempRegs_.empty()) {
+    spills_.push_back(nullptr);
+    Push(flt ? "xmm0": "rax");
+    return;
+  }
+
+  auto reg = tempRegs_.back();
+  tempRegs_.pop_back();
+  if (std::find(usedRegs_.begin(), usedRegs_.end(), reg) == usedRegs_.end())
+    usedRegs_.push_back(reg);
+  spills_.push_back(reg);
+  Emit("movq #rax, #%s", reg);
 }
 
 
@@ -249,7 +378,15 @@ void Generator::Restore(bool flt)
   auto des = GetDes(8, flt);
   auto inst = GetInst("mov", 8, flt);
   Emit("%s #%s, #%s", inst.c_str(), des, src);
-  Pop(des);
+
+  auto reg = spills_.back();
+  spills_.pop_back();
+  if (reg == nullptr) {
+    Pop(des);
+  } else {
+    Emit("movq #%s, #rax", reg);
+    tempRegs_.push_back(reg);
+  }
 }
 
 
@@ -388,18 +525,34 @@ void Generator::GenCompZero(Type* type)
 }
 
 
-void Generator::GenAndOp(BinaryOp* andOp)
+// Compare '%rax' to the immediate, by '%r11' if it exceeds 32 bits
+void Generator::GenCmpImm(long val)
 {
-  VisitExpr(andOp->lhs_);
-  GenCompZero(andOp->lhs_->Type());
-
-  auto labelFalse = LabelStmt::New();
-  Emit("je %s", labelFalse->Label().c_str());
+  if (val == static_cast<int>(val)) {
+    Emit("cmpq $%ld, #rax", val);
+  } else {
+    Emit("movabsq $%ld, #r11", val);
+    Emit("cmpq #r11, #rax");
+  }
+}
 
-  VisitExpr(andOp->rhs_);
-  GenCompZero(andOp->rhs_->Type());
 
-  Emit("je %s", labelFalse->Label().c_str());
+void Generator::GenAndOp(BinaryOp* andOp)
+{
+  LabelStmt* labelFalse;
+  if (PassManager::Level() >= 1) {
+    labelFalse = LabelStmt::New();
+    BranchGenerator(labelFalse->Label(), false).GenExpr(andOp);
+  } else {
+    VisitExpr(andOp->lhs_);
+    GenCompZero(andOp->lhs_->Type());
+    labelFalse = LabelStmt::New();
+    Emit("je %s", labelFalse->Label().c_str());
+
+    VisitExpr(andOp->rhs_);
+    GenCompZero(andOp->rhs_->Type());
+    Emit("je %s", labelFalse->Label().c_str());
+  }
   
   Emit("movq $1, #rax");
   auto labelTrue = LabelStmt::New();
@@ -412,16 +565,20 @@ void Generator::GenAndOp(BinaryOp* andOp)
 
 void Generator::GenOrOp(BinaryOp* orOp)
 {
-  VisitExpr(orOp->lhs_);
-  GenCompZero(orOp->lhs_->Type());
-
-  auto labelTrue = LabelStmt::New();
-  Emit("jne %s", labelTrue->Label().c_str());
-
-  VisitExpr(orOp->rhs_);
-  GenCompZero(orOp->rhs_->Type());
-
-  Emit("jne %s", labelTrue->Label().c_str());
+  LabelStmt* labelTrue;
+  if (PassManager::Level() >= 1) {
+    labelTrue = LabelStmt::New();
+    BranchGenerator(labelTrue->Label(), true).GenExpr(orOp);
+  } else {
+    VisitExpr(orOp->lhs_);
+    GenCompZero(orOp->lhs_->Type());
+    labelTrue = LabelStmt::New();
+    Emit("jne %s", labelTrue->Label().c_str());
+
+    VisitExpr(orOp->rhs_);
+    GenCompZero(orOp->rhs_->Type());
+    Emit("jne %s", labelTrue->Label().c_str());
+  }
   
   Emit("xorq #rax, #rax"); // Set %rax to 0
   auto labelFalse = LabelStmt::New();
@@ -512,9 +669,36 @@ void Generator::EmitStoreBitField(const ObjectAddr& addr, Type* type)
 
 void Generator::CopyStruct(ObjectAddr desAddr, int width)
 {
+  if (width >= repWidth) {
+    // %rsi and %rdi may hold the objects of leaf function,
+    // %rax still has the address of the source after copy
+    Emit("leaq %s, #rcx", desAddr.Repr().c_str());
+    Emit("movq #rsi, #rdx");
+    Emit("movq #rax, #rsi");
+    Emit("movq #rdi, #rax");
+    Emit("movq #rcx, #rdi");
+    Emit("movl $%d, #ecx", width);
+    Emit("rep movsb");
+    Emit("movq #rax, #rdi");
+    Emit("leaq %d(#rsi), #rax", -width);
+    Emit("movq #rdx, #rsi");
+    return;
+  }
+
   int units[] = {8, 4, 2, 1};
   Emit("movq #rax, #rcx");
   ObjectAddr srcAddr = {"", "rcx", 0};
+  if (width >= 16) {
+    // The last 16 bytes may overlap those copied
+    auto begin = desAddr.offset_;
+    for (int offset = 0; offset < width; offset += 16) {
+      srcAddr.offset_ = std::min(offset, width - 16);
+      desAddr.offset_ = begin + srcAddr.offset_;
+      Emit("movups %s, #xmm9", srcAddr.Repr().c_str());
+      Emit("movups #xmm9, %s", desAddr.Repr().c_str());
+    }
+    return;
+  }
   for (auto unit: units) {
     while (width >= unit) {
       EmitLoad(srcAddr.Repr(), unit, false);
@@ -527,7 +711,51 @@ void Generator::CopyStruct(ObjectAddr desAddr, int width)
 }
 
 
-void Generator::GenCompOp(int width, bool flt, const char* set)
+// Load the eightbyte of 'width' bytes at 'addr' into 'reg', reading
+// no bytes past it; 'scratch' is clobbered
+void Generator::EmitLoadEightbyte(const std::string& reg,
+    ObjectAddr addr, int width, const char* scratch)
+{
+  if (reg[0] == 'x') {
+    Emit("%s %s, #%s", width == 4 ? "movss": "movsd",
+         addr.Repr().c_str(), reg.c_str());
+    return;
+  } else if (width == 8) {
+    Emit("movq %s, #%s", addr.Repr().c_str(), reg.c_str());
+    return;
+  }
+  int shift = 0;
+  for (int unit = 4; unit > 0; unit /= 2) {
+    if (width < unit)
+      continue;
+    auto des = shift ? GetReg(scratch, 4): GetReg(reg.c_str(), 4);
+    auto inst = unit == 4 ? "movl": unit == 2 ? "movzwl": "movzbl";
+    Emit("%s %s, #%s", inst, addr.Repr().c_str(), des.c_str());
+    if (shift) {
+      Emit("salq $%d, #%s", shift * 8, scratch);
+      Emit("orq #%s, #%s", scratch, reg.c_str());
+    }
+    addr.offset_ += unit;
+    shift += unit;
+    width -= unit;
+  }
+}
+
+
+// Store the eightbytes in 'regs' to 'addr', which has the room
+// for all of them
+void Generator::EmitStoreEightbytes(const LocationList& regs,
+    ObjectAddr addr)
+{
+  for (const auto& reg: regs) {
+    Emit("%s #%s, %s", reg[0] == 'x' ? "movsd": "movq",
+         reg.c_str(), addr.Repr().c_str());
+    addr.offset_ += 8;
+  }
+}
+
+
+void Generator::GenCmp(int width, bool flt)
 {
   std::string cmp;
   if (flt) {
@@ -537,6 +765,12 @@ void Generator::GenCompOp(int width, bool flt, const char* set)
   }
 
   Emit("%s #%s, #%s", cmp.c_str(), GetSrc(width, flt), GetDes(width, flt));
+}
+
+
+void Generator::GenCompOp(int width, bool flt, const char* set)
+{
+  GenCmp(width, flt);
   Emit("%s #al", set);
   Emit("movzbq #al, #rax");
 }
@@ -593,11 +827,11 @@ void Generator::GenPointerArithm(BinaryOp* binary)
 // Only objects Allocated on stack
 void Generator::VisitObject(Object* obj)
 {
-  auto addr = LValGenerator().GenExpr(obj).Repr();
+  auto addr = LValGenerator().GenExpr(obj);
 
   if (!obj->Type()->IsScalar()) {
     // Return the address of the object in rax
-    Emit("leaq %s, #rax", addr.c_str());
+    Emit("leaq %s, #rax", addr.Repr().c_str());
   } else {
     EmitLoad(addr, obj->Type());
   }
@@ -732,7 +966,7 @@ void Generator::GenIncDec(Expr* operand, bool postfix, const std::string& inst)
   auto width = operand->Type()->Width();
   auto flt = operand->Type()->IsFloat();
   
-  auto addr = LValGenerator().GenExpr(operand).Repr();
+  auto addr = LValGenerator().GenExpr(operand);
   EmitLoad(addr, operand->Type());
   if (postfix) Save(flt);
 
@@ -749,11 +983,17 @@ void Generator::GenIncDec(Expr* operand, bool postfix, const std::string& inst)
     else
       cons = Constant::New(operand->Tok(), T_DOUBLE, 1.0);
   }
-  auto consLabel = ConsLabel(cons);
-
-  auto addSub = GetInst(inst, operand->Type());    
-  Emit("%s %s, #%s", addSub.c_str(), consLabel.c_str(), GetDes(width, flt));
-  EmitStore(addr, operand->Type());
+  auto addSub = GetInst(inst, operand->Type());
+  if (flt) {
+    Emit("%s %s, #%s", addSub.c_str(), ConsLabel(cons).c_str(),
+         GetDes(width, flt));
+  } else {
+    Emit("%s $%ld, #%s", addSub.c_str(), cons->IVal(), GetDes(width, flt));
+  }
+  if (addr.reg_)
+    EmitStore(addr, operand->Type());
+  else
+    EmitStore(addr.Repr(), operand->Type());
   if (postfix) Emit(flt ? "movsd #xmm9, #xmm0": "movq #r11, #rax");
 }
 
@@ -782,6 +1022,13 @@ void Generator::VisitIdentifier(Identifier* ident)
 
 void Generator::VisitConstant(Constant* cons)
 {
+  if (cons->Type()->IsInteger()) {
+    auto width = cons->Type()->Width();
+    Emit("%s $%ld, #%s", GetInst("mov", width, false).c_str(),
+         cons->IVal(), GetDes(width, false));
+    return;
+  }
+
   auto label = ConsLabel(cons);
 
   if (!cons->Type()->IsScalar()) {
@@ -819,6 +1066,14 @@ void Generator::VisitDeclaration(Declaration* decl)
     if (!obj->HasInit())
       return;
 
+    if (obj->Reg()) {
+      assert(decl->Inits().size() == 1);
+      VisitExpr(decl->Inits().begin()->expr_);
+      ObjectAddr addr {"", "", 0};
+      addr.reg_ = obj->Reg();
+      return EmitStore(addr, obj->Type());
+    }
+
     int lastEnd = obj->Offset();
     for (const auto& init: decl->Inits()) {
       ObjectAddr addr = {"", "rbp", obj->Offset() + init.offset_};
@@ -915,24 +1170,25 @@ void Generator::GenStaticDecl(Declaration* decl)
 
 void Generator::VisitEmptyStmt(EmptyStmt* emptyStmt)
 {
-  assert(false);
 }
 
 
 void Generator::VisitIfStmt(IfStmt* ifStmt)
 {
-  VisitExpr(ifStmt->cond_);
-
-  // Compare to 0
-  auto elseLabel = LabelStmt::New()->Label();
-  auto endLabel = LabelStmt::New()->Label();
-
-  GenCompZero(ifStmt->cond_->Type());
-
-  if (ifStmt->else_) {
-    Emit("je %s", elseLabel.c_str());
+  std::string elseLabel, endLabel;
+  if (PassManager::Level() >= 1) {
+    elseLabel = LabelStmt::New()->Label();
+    endLabel = LabelStmt::New()->Label();
+    BranchGenerator(ifStmt->else_ ? elseLabel: endLabel, false)
+        .GenExpr(ifStmt->cond_);
   } else {
-    Emit("je %s", endLabel.c_str());
+    VisitExpr(ifStmt->cond_);
+
+    // Compare to 0
+    elseLabel = LabelStmt::New()->Label();
+    endLabel = LabelStmt::New()->Label();
+    GenCompZero(ifStmt->cond_->Type());
+    Emit("je %s", (ifStmt->else_ ? elseLabel: endLabel).c_str());
   }
 
   VisitStmt(ifStmt->then_);
@@ -953,6 +1209,184 @@ void Generator::VisitJumpStmt(JumpStmt* jumpStmt)
 }
 
 
+/*
+ * The cases are sorted in the promoted type of the condition.
+ * Dense cases are dispatched by a jump table, the others by a
+ * binary search; a case range is checked by one comparison.
+ */
+void Generator::VisitSwitchStmt(SwitchStmt* switchStmt)
+{
+  auto cond = switchStmt->cond_;
+  auto deflt = switchStmt->default_ ? switchStmt->default_: switchStmt->end_;
+
+  // The temporary is '%rcx', extend it to 8 bytes
+  auto type = cond->Type();
+  auto width = type->Width();
+  auto sign = !type->IsUnsigned();
+  switch (width) {
+  case 1: Emit("%s #cl, #rax", sign ? "movsbq": "movzbq"); break;
+  case 2: Emit("%s #cx, #rax", sign ? "movswq": "movzwq"); break;
+  case 4:
+    if (sign)
+      Emit("movslq #ecx, #rax");
+    else
+      Emit("movl #ecx, #eax");
+    break;
+  default: Emit("movq #rcx, #rax"); break;
+  }
+
+  // Only the values of unsigned long are compared unsigned
+  auto unsign = width == 8 && !sign;
+  auto less = [unsign](long lhs, long rhs) {
+    if (unsign)
+      return static_cast<unsigned long>(lhs) < static_cast<unsigned long>(rhs);
+    return lhs < rhs;
+  };
+  auto convert = [width, sign](long val) {
+    if (width < 4 || (width == 4 && sign))
+      return static_cast<long>(static_cast<int>(val));
+    if (width == 4)
+      return static_cast<long>(static_cast<unsigned>(val));
+    return val;
+  };
+
+  // A range wrapped by the conversion is split into its values
+  SwitchStmt::CaseList sorted;
+  for (const auto& c: switchStmt->cases_) {
+    auto lo = convert(c.lo_), hi = convert(c.hi_);
+    if (static_cast<unsigned long>(hi) - lo
+        == static_cast<unsigned long>(c.hi_) - c.lo_) {
+      sorted.push_back({lo, hi, c.label_});
+    } else {
+      for (auto val = c.lo_; val <= c.hi_; ++val)
+        sorted.push_back({convert(val), convert(val), c.label_});
+    }
+  }
+  std::stable_sort(sorted.begin(), sorted.end(),
+      [&less](const SwitchStmt::Case& lhs, const SwitchStmt::Case& rhs) {
+    return less(lhs.lo_, rhs.lo_);
+  });
+
+  // Drop the duplicated values, merge the adjacent cases of a label
+  SwitchStmt::CaseList cases;
+  for (auto c: sorted) {
+    if (cases.size()) {
+      auto& last = cases.back();
+      if (!less(last.hi_, c.lo_)) {
+        if (!less(last.hi_, c.hi_))
+          continue;
+        c.lo_ = static_cast<unsigned long>(last.hi_) + 1;
+      }
+      if (c.label_ == last.label_
+          && static_cast<unsigned long>(last.hi_) + 1
+          == static_cast<unsigned long>(c.lo_)) {
+        last.hi_ = c.hi_;
+        continue;
+      }
+    }
+    cases.push_back(c);
+  }
+
+  if (cases.empty()) {
+    Emit("jmp %s", deflt->Label().c_str());
+    return;
+  }
+
+  // A table is not much larger than the comparisons it replaces,
+  // a wide range costs one comparison but many entries
+  unsigned long span = static_cast<unsigned long>(cases.back().hi_)
+                     - cases.front().lo_;
+  if (cases.size() >= 4 && span < 3 * cases.size())
+    GenJumpTable(cases, deflt->Label());
+  else
+    GenCaseSearch(cases, 0, cases.size(), deflt->Label(), unsign);
+}
+
+
+// Bound check and jump by the table of offsets, the value is in '%rax'
+void Generator::GenJumpTable(const SwitchStmt::CaseList& cases,
+    const std::string& deflt)
+{
+  auto lo = cases.front().lo_;
+  unsigned long span = static_cast<unsigned long>(cases.back().hi_) - lo;
+  if (lo != static_cast<int>(lo)) {
+    Emit("movabsq $%ld, #r11", lo);
+    Emit("subq #r11, #rax");
+  } else if (lo != 0) {
+    Emit("subq $%ld, #rax", lo);
+  }
+  Emit("cmpq $%lu, #rax", span);
+  Emit("ja %s", deflt.c_str());
+
+  std::vector<std::string> targets(span + 1, deflt);
+  for (const auto& c: cases) {
+    auto end = static_cast<unsigned long>(c.hi_) - lo;
+    for (auto i = static_cast<unsigned long>(c.lo_) - lo; i <= end; ++i)
+      targets[i] = c.label_->Label();
+  }
+  rodatas_.push_back(ROData(targets));
+  auto table = rodatas_.back().label_;
+
+  Emit("leaq %s(#rip), #r11", table.c_str());
+  Emit("salq $2, #rax");
+  Emit("addq #r11, #rax");
+  Emit("movslq (#rax), #rax");
+  Emit("addq #r11, #rax");
+  Emit("jmp *#rax");
+
+  std::sort(targets.begin(), targets.end());
+  targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+  // Only the IR needs the targets to build the CFG
+  if (func_) {
+    for (const auto& target: targets)
+      func_->AddIndirectTarget(target);
+  }
+}
+
+
+// Binary search of the value in '%rax' in the cases [begin, end)
+void Generator::GenCaseSearch(const SwitchStmt::CaseList& cases,
+    size_t begin, size_t end, const std::string& deflt, bool unsign)
+{
+  if (end - begin > 3) {
+    auto mid = begin + (end - begin) / 2;
+    auto right = LabelStmt::New()->Label();
+    GenCmpImm(cases[mid].lo_);
+    Emit("%s %s", unsign ? "jae": "jge", right.c_str());
+    GenCaseSearch(cases, begin, mid, deflt, unsign);
+    EmitLabel(right);
+    GenCaseSearch(cases, mid, end, deflt, unsign);
+    return;
+  }
+
+  for (auto i = begin; i < end; ++i) {
+    const auto& c = cases[i];
+    auto label = c.label_->Label();
+    unsigned long diff = static_cast<unsigned long>(c.hi_) - c.lo_;
+    if (diff == 0) {
+      GenCmpImm(c.lo_);
+      Emit("je %s", label.c_str());
+    } else if (c.lo_ == 0 && diff <= INT_MAX) {
+      Emit("cmpq $%lu, #rax", diff);
+      Emit("jbe %s", label.c_str());
+    } else if (c.lo_ == static_cast<int>(c.lo_) && diff <= INT_MAX) {
+      Emit("movq #rax, #r11");
+      Emit("subq $%ld, #r11", c.lo_);
+      Emit("cmpq $%lu, #r11", diff);
+      Emit("jbe %s", label.c_str());
+    } else {
+      auto skip = LabelStmt::New()->Label();
+      GenCmpImm(c.lo_);
+      Emit("%s %s", unsign ? "jb": "jl", skip.c_str());
+      GenCmpImm(c.hi_);
+      Emit("%s %s", unsign ? "jbe": "jle", label.c_str());
+      EmitLabel(skip);
+    }
+  }
+  Emit("jmp %s", deflt.c_str());
+}
+
+
 void Generator::VisitLabelStmt(LabelStmt* labelStmt)
 {
   EmitLabel(labelStmt->Label());
@@ -964,12 +1398,21 @@ void Generator::VisitReturnStmt(ReturnStmt* returnStmt)
   auto expr = returnStmt->expr_;
   if (expr) {
     Visit(expr);
-    if (expr->Type()->ToStruct()) {
+    auto type = expr->Type();
+    if (type->ToStruct() && !InMemory(type)) {
+      // Returned in %rax, %rdx, %xmm0 and %xmm1
+      Emit("movq #rax, #r11");
+      auto regs = ReturnRegs(type);
+      for (int i = regs.size() - 1; i >= 0; --i) {
+        EmitLoadEightbyte(regs[i], {"", "r11", i * 8},
+                          std::min(8, type->Width() - i * 8), "rcx");
+      }
+    } else if (type->ToStruct()) {
       // %rax now has the address of the struct/union
       ObjectAddr addr = {"", "rbp", retAddrOffset_};
       Emit("movq %s, #r11", addr.Repr().c_str());
       addr = {"", "r11", 0};
-      CopyStruct(addr, expr->Type()->Width());
+      CopyStruct(addr, type->Width());
       Emit("movq #r11, #rax");
     }
   }
@@ -994,7 +1437,7 @@ void Generator::AllocObjects(Scope* scope, const FuncDef::ParamList& params)
   std::priority_queue<Object*, std::vector<Object*>, Comp> heap;
   for (auto iter = scope->begin(); iter != scope->end(); iter++) {
     auto obj = iter->second->ToObject();
-    if (!obj || obj->IsStatic())
+    if (!obj || obj->IsStatic() || obj->Reg())
       continue;
     if (paramSet.find(obj) != paramSet.end())
       continue;
@@ -1008,6 +1451,8 @@ void Generator::AllocObjects(Scope* scope, const FuncDef::ParamList& params)
     offset -= obj->Type()->Width();
     offset = Type::MakeAlign(offset, obj->Align());
     obj->SetOffset(offset);
+    if (obj->Type()->ToArray() || addrTaken_.count(obj))
+      pinned_ = std::min(pinned_, offset);
   }
 
   offset_ = offset;
@@ -1016,6 +1461,7 @@ void Generator::AllocObjects(Scope* scope, const FuncDef::ParamList& params)
 
 void Generator::VisitCompoundStmt(CompoundStmt* compStmt)
 {
+  auto begin = offset_;
   if (compStmt->scope_) {
     //compStmt
     AllocObjects(compStmt->scope_);
@@ -1024,6 +1470,11 @@ void Generator::VisitCompoundStmt(CompoundStmt* compStmt)
   for (auto stmt: compStmt->stmts_) {
     Visit(stmt);
   }
+
+  // The objects of the block are dead, the following blocks
+  // reuse their slots. Objects are all kept at '-O0'.
+  if (PassManager::Level() >= 1)
+    offset_ = std::min(begin, pinned_);
 }
 
 
@@ -1033,17 +1484,22 @@ void Generator::GetParamRegOffsets(int& gpOffset, int& fpOffset,
   TypeList types;
   for (auto param: funcType->Params())
     types.push_back(param->Type());
-  auto locations = GetParamLocations(types, funcType->Derived());
+  auto locations = GetParamLocations(types, InMemory(funcType->Derived()));
   gpOffset = 0;
   fpOffset = 48;
   overflow = 16;
-  for (const auto& loc: locations.locs_) {
-    if (loc[0] == 'x')
-      fpOffset += 16;
-    else if (loc[0] == 'm')
-      overflow += 8;
-    else
-      gpOffset += 8;
+  for (size_t i = 0; i < types.size(); ++i) {
+    const auto& loc = locations.locs_[i];
+    if (loc[0] == 'm') {
+      overflow += Type::MakeAlign(types[i]->Width(), 8);
+      continue;
+    }
+    for (const auto& reg: SplitLocation(loc)) {
+      if (reg[0] == 'x')
+        fpOffset += 16;
+      else
+        gpOffset += 8;
+    }
   }
 }
 
@@ -1095,12 +1551,45 @@ void Generator::GenBuiltin(FuncCall* funcCall)
     Emit("movl #eax, %s", fpOffsetAddr.c_str());
   } else if (type == Parser::vaArgType_) {
     static int cnt[2] = {0, 0};
-    auto overflowLabel = ".L_va_arg_overflow" + std::to_string(++cnt[0]);
-    auto endLabel = ".L_va_arg_end" + std::to_string(++cnt[1]);
+    std::string overflowLabel, endLabel;
+    if (LabelStmt::Space()) {
+      overflowLabel = LabelStmt::SpaceLabel(".L_va_arg_overflow");
+      endLabel = LabelStmt::SpaceLabel(".L_va_arg_end");
+    } else {
+      overflowLabel = ".L_va_arg_overflow" + std::to_string(++cnt[0]);
+      endLabel = ".L_va_arg_end" + std::to_string(++cnt[1]);
+    }
 
     auto argType = funcCall->args_[1]->Type()->ToPointer()->Derived();
-    auto cls = Classify(argType);
-    if (cls == ParamClass::INTEGER) {
+    auto classes = argType->ToStruct() ? ClassifyStruct(argType):
+                                         std::vector<ParamClass>();
+    auto cls = argType->ToStruct() ? ParamClass::MEMORY: Classify(argType);
+    if (classes.size()) {
+      // The eightbytes are copied out of the save area to the memory
+      // below the stack frame, like the struct/union returned by call
+      auto xcnt = std::count(classes.begin(), classes.end(), ParamClass::SSE);
+      auto cnt = classes.size() - xcnt;
+      auto offset = Type::MakeAlign(offset_ - Type::MakeAlign(
+          argType->Width(), 8), argType->Align());
+      Emit("movq %s, #r11", saveAreaAddr.c_str());
+      Emit("movl %s, #eax", gpOffsetAddr.c_str());
+      Emit("cmpl $%d, #eax", static_cast<int>(48 - cnt * 8));
+      Emit("ja %s", overflowLabel.c_str());
+      Emit("movl %s, #eax", fpOffsetAddr.c_str());
+      Emit("cmpl $%d, #eax", static_cast<int>(176 - xcnt * 16));
+      Emit("ja %s", overflowLabel.c_str());
+      for (size_t i = 0; i < classes.size(); ++i) {
+        bool sse = classes[i] == ParamClass::SSE;
+        const auto& offsetAddr = sse ? fpOffsetAddr: gpOffsetAddr;
+        Emit("movl %s, #eax", offsetAddr.c_str());
+        Emit("addq #r11, #rax");
+        Emit("movq (#rax), #rax");
+        Emit("movq #rax, %d(#rbp)", offset + static_cast<int>(i) * 8);
+        Emit("addl $%d, %s", sse ? 16: 8, offsetAddr.c_str());
+      }
+      Emit("leaq %d(#rbp), #rax", offset);
+      Emit("jmp %s", endLabel.c_str());
+    } else if (cls == ParamClass::INTEGER) {
       Emit("movq %s, #rax", saveAreaAddr.c_str());
       Emit("movq #rax, #r11");
       Emit("movl %s, #eax", gpOffsetAddr.c_str());
@@ -1150,26 +1639,35 @@ void Generator::VisitFuncCall(FuncCall* funcCall)
   auto base = offset_;
   // Alloc memory for return value if it is struct/union
   auto retType = funcCall->Type()->ToStruct();
+  bool retStruct = retType && InMemory(retType);
+  int retOffset = offset_;
   if (retType) {
-    auto offset = offset_;
-    offset -= retType->Width();
-    offset = Type::MakeAlign(offset, retType->Align());
-    Emit("leaq %d(#rbp), #rdi", offset);
+    // The eightbytes returned by registers are stored as a whole
+    auto width = retStruct ? retType->Width():
+                             Type::MakeAlign(retType->Width(), 8);
+    retOffset -= width;
+    retOffset = Type::MakeAlign(retOffset, retType->Align());
+    if (retStruct)
+      Emit("leaq %d(#rbp), #rdi", retOffset);
     
-    //Emit("subq $%d, #rsp", offset_ - offset);
-    offset_ = offset;
+    //Emit("subq $%d, #rsp", offset_ - retOffset);
+    offset_ = retOffset;
   }
 
   TypeList types;
   for (auto arg: funcCall->args_)
     types.push_back(arg->Type());
   
-  const auto& locations = GetParamLocations(types, retType);
+  const auto& locations = GetParamLocations(types, retStruct);
   // Align stack frame by 16 bytes
   const auto& locs = locations.locs_;
-  auto byMemCnt = locs.size() - locations.regCnt_ - locations.xregCnt_;
+  int byMemSize = 0;
+  for (size_t i = 0; i < locs.size(); ++i) {
+    if (locs[i][0] == 'm')
+      byMemSize += Type::MakeAlign(types[i]->Width(), 8);
+  }
 
-  offset_ = Type::MakeAlign(offset_ - byMemCnt * 8, 16) + byMemCnt * 8;  
+  offset_ = Type::MakeAlign(offset_ - byMemSize, 16) + byMemSize;
   for (int i = locs.size() - 1; i >=0; --i) {
     if (locs[i][0] == 'm') {
       Visit(funcCall->args_[i]);
@@ -1177,43 +1675,76 @@ void Generator::VisitFuncCall(FuncCall* funcCall)
     }
   }
 
+  // The registers of the args evaluated before a call are clobbered,
+  // those args are staged on the stack until all the args are evaluated
+  int firstCall = locs.size();
+  if (RegAllocator::HasCall(funcCall->Designator())) {
+    firstCall = -1;
+  } else {
+    for (size_t i = 0; i < locs.size(); ++i) {
+      if (locs[i][0] != 'm' && RegAllocator::HasCall(funcCall->args_[i])) {
+        firstCall = i;
+        break;
+      }
+    }
+  }
+
+  std::vector<std::string> staged;
+  bool xmm8 = false;
   for (int i = locs.size() - 1; i >= 0; i--) {
     if (locs[i][0] == 'm')
       continue;
     Visit(funcCall->args_[i]);
+    // %rdx and %rcx may be clobbered by the arguments evaluated later
+    bool stage = i > firstCall;
     
-    if (locs[i][0] == 'x') {
-      if (locs[i][3] == '0')
+    if (types[i]->ToStruct()) {
+      // %rax has the address of the struct/union
+      auto regs = SplitLocation(locs[i]);
+      for (int j = regs.size() - 1; j >= 0; --j) {
+        auto width = std::min(8, types[i]->Width() - j * 8);
+        auto reg = regs[j];
+        bool push = stage || reg == "rdx" || reg == "rcx";
+        if (!push && reg == "xmm0") {
+          reg = "xmm8";
+          xmm8 = true;
+        }
+        EmitLoadEightbyte(reg, {"", "rax", j * 8}, width, "r11");
+        if (push) {
+          Push(reg);
+          staged.push_back(reg);
+        }
+      }
+    } else if (locs[i][0] == 'x') {
+      if (stage) {
+        Push("xmm0");
+        staged.push_back(locs[i]);
+      } else if (locs[i][3] == '0') {
         Emit("movsd #xmm0, #xmm8");
-      else {
+        xmm8 = true;
+      } else {
         auto inst = GetInst("mov", types[i]);
         Emit("%s #xmm0, #%s", inst.c_str(), locs[i].c_str());
       }
     } else {
-      // Save %rdx %rcx in temp register
-      if (locs[i] == "rdx") {
-        Emit("movq #rax, #r12");
-      } else if (locs[i] == "rcx") {
-        Emit("movq #rax, #r13");
+      if (stage || locs[i] == "rdx" || locs[i] == "rcx") {
+        Push("rax");
+        staged.push_back(locs[i]);
       } else {
         Emit("movq #rax, #%s", locs[i].c_str());
       }
     }
   }
 
-  // If variadic, set %al to floating param number
-  if (funcType->Variadic()) {
-    Emit("movq $%d, %rax", locations.xregCnt_);
-  }
-
-  Emit("leaq %d(#rbp), #rsp", offset_);
   auto addr = LValGenerator().GenExpr(funcCall->Designator());
-  if (locations.xregCnt_ > 0)
+  for (auto iter = staged.rbegin(); iter != staged.rend(); ++iter)
+    Pop(*iter);
+  if (xmm8)
     Emit("movsd #xmm8, #xmm0");
-  if (locations.regCnt_ > 2)
-    Emit("movq #r12, #rdx");
-  if (locations.regCnt_ > 3)
-    Emit("movq #r13, #rcx");
+  // If variadic, set %al to floating param number
+  if (funcType->Variadic())
+    Emit("movq $%d, #rax", static_cast<int>(locations.xregCnt_));
+  Emit("leaq %d(#rbp), #rsp", offset_);
   if (addr.base_.size() == 0 && addr.offset_ == 0) {
     Emit("call %s", addr.label_.c_str());
   } else {
@@ -1221,6 +1752,11 @@ void Generator::VisitFuncCall(FuncCall* funcCall)
     Emit("call *#r10");
   }
 
+  if (retType && !retStruct) {
+    EmitStoreEightbytes(ReturnRegs(retType), {"", "rbp", retOffset});
+    Emit("leaq %d(#rbp), #rax", retOffset);
+  }
+
   // Reset stack frame
   offset_ = base;    
 }
@@ -1233,6 +1769,28 @@ ParamLocations Generator::GetParamLocations(const TypeList& types, bool retStruc
   locations.regCnt_ = retStruct;
   locations.xregCnt_ = 0;
   for (auto type: types) {
+    if (type->ToStruct()) {
+      // Passed by memory unless all the eightbytes get registers
+      auto classes = ClassifyStruct(type);
+      auto xcnt = std::count(classes.begin(), classes.end(), ParamClass::SSE);
+      auto cnt = classes.size() - xcnt;
+      if (classes.empty() || locations.regCnt_ + cnt > regs.size()
+          || locations.xregCnt_ + xcnt > xregs.size()) {
+        locations.locs_.push_back("mem");
+        continue;
+      }
+      std::string loc;
+      for (auto cls: classes) {
+        loc += loc.empty() ? "": ",";
+        if (cls == ParamClass::SSE)
+          loc += xregs[locations.xregCnt_++];
+        else
+          loc += regs[locations.regCnt_++];
+      }
+      locations.locs_.push_back(loc);
+      continue;
+    }
+
     auto cls = Classify(type);
 
     const char* reg = nullptr;
@@ -1263,14 +1821,17 @@ void Generator::VisitFuncDef(FuncDef* funcDef)
   Emit(".type %s, @function", name.c_str());
 
   EmitLabel(name);
+  // No pass runs on the IR at '-O0', the function is printed directly
+  IRFunc func;
+  if (PassManager::Level() >= 1)
+    func_ = &func;
   Emit("pushq #rbp");
   Emit("movq #rsp, #rbp");
 
-  offset_ = 0;
+  PassManager::Run(funcDef);
 
   auto& params = funcDef->Type()->Params();
-  // Arrange space to store params passed by registers
-  bool retStruct = funcDef->Type()->Derived()->ToStruct();
+  bool retStruct = InMemory(funcDef->Type()->Derived());
   TypeList types;
   for (auto param: params)
     types.push_back(param->Type());
@@ -1278,17 +1839,56 @@ void Generator::VisitFuncDef(FuncDef* funcDef)
   auto locations = GetParamLocations(types, retStruct);
   const auto& locs = locations.locs_;
 
+  usedRegs_.clear();
+  tempRegs_.clear();
+  addrTaken_.clear();
+  // Objects and temporaries are all on the stack at '-O0'
+  if (PassManager::Level() >= 1) {
+    PassTimer timer("regalloc");
+    RegAllocator allocator;
+    usedRegs_ = allocator.Alloc(funcDef, locs);
+    addrTaken_ = allocator.AddrTaken();
+    for (auto iter = RegAllocator::Regs().rbegin();
+        iter != RegAllocator::Regs().rend(); ++iter) {
+      if (std::find(usedRegs_.begin(), usedRegs_.end(), *iter)
+          == usedRegs_.end()) {
+        tempRegs_.push_back(*iter);
+      }
+    }
+    // Used first, they need not be saved
+    for (auto iter = allocator.LeafTemps().rbegin();
+        iter != allocator.LeafTemps().rend(); ++iter) {
+      tempRegs_.push_back(*iter);
+    }
+  }
+
+  offset_ = 0;
+  pinned_ = 0;
+
+  // Arrange space to store params passed by registers
   if (funcDef->Type()->Variadic()) {
     GenSaveArea(); // 'offset' is now the begin of save area
-    if (retStruct) {
-      retAddrOffset_ = offset_;
-      offset_ += 8;
-    }
     int regOffset = offset_;
     int xregOffset = offset_ + 48;
+    if (retStruct) {
+      retAddrOffset_ = regOffset;
+      regOffset += 8;
+    }
     int byMemOffset = 16;
     for (size_t i = 0; i < locs.size(); i++) {
-      if (locs[i][0] == 'm') {
+      if (types[i]->ToStruct() && locs[i][0] != 'm') {
+        // The eightbytes are not contiguous in the save area
+        auto regs = SplitLocation(locs[i]);
+        offset_ -= Type::MakeAlign(types[i]->Width(), 8);
+        params[i]->SetOffset(offset_);
+        EmitStoreEightbytes(regs, {"", "rbp", offset_});
+        for (const auto& reg: regs) {
+          if (reg[0] == 'x')
+            xregOffset += 16;
+          else
+            regOffset += 8;
+        }
+      } else if (locs[i][0] == 'm') {
         params[i]->SetOffset(byMemOffset);
         //byMemOffset += 8;
         // TODO(wgtdkp): width of incomplete array ?
@@ -1310,16 +1910,31 @@ void Generator::VisitFuncDef(FuncDef* funcDef)
     for (size_t i = 0; i < locs.size(); i++) {
       if (locs[i][0] == 'm') {
         params[i]->SetOffset(byMemOffset);
+        if (params[i]->Reg())
+          Emit("movq %d(#rbp), #%s", byMemOffset, params[i]->Reg());
         //byMemOffset += 8;
         // TODO(wgtdkp): width of incomplete array ?
         byMemOffset += params[i]->Type()->Width();
         byMemOffset = Type::MakeAlign(byMemOffset, 8);
         continue;
+      } else if (types[i]->ToStruct()) {
+        offset_ -= Type::MakeAlign(types[i]->Width(), 8);
+        params[i]->SetOffset(offset_);
+        EmitStoreEightbytes(SplitLocation(locs[i]), {"", "rbp", offset_});
+        continue;
       }
-      params[i]->SetOffset(Push(locs[i]));
+      // A param of leaf function may stay in its register
+      if (!params[i]->Reg())
+        params[i]->SetOffset(Push(locs[i]));
+      else if (locs[i] != params[i]->Reg())
+        Emit("movq #%s, #%s", locs[i].c_str(), params[i]->Reg());
     }
   }
 
+  if (PassManager::Level() >= 1)
+    offset_ -= RegAllocator::Regs().size() * 8;
+  saveOffset_ = offset_;
+
   AllocObjects(funcDef->Body()->Scope(), params);
 
   for (auto stmt: funcDef->body_->stmts_) {
@@ -1327,8 +1942,34 @@ void Generator::VisitFuncDef(FuncDef* funcDef)
   }
 
   EmitLabel(funcDef->retLabel_->Label());
+
+  // Saved in the order of RegAllocator::Regs()
+  std::vector<std::pair<const char*, int>> saves;
+  for (size_t i = 0; i < RegAllocator::Regs().size(); ++i) {
+    auto reg = RegAllocator::Regs()[i];
+    if (std::find(usedRegs_.begin(), usedRegs_.end(), reg) != usedRegs_.end())
+      saves.push_back({reg, saveOffset_ + static_cast<int>(i) * 8});
+  }
+  for (const auto& save: saves)
+    Emit("movq %d(#rbp), #%s", save.second, save.first);
   Emit("leaveq");
   Emit("retq");
+
+  if (!func_)
+    return;
+  // The callee-saved registers used are known after the body is
+  // generated, they are saved after 'pushq %rbp; movq %rsp, %rbp'
+  IRFunc prologue;
+  func_ = &prologue;
+  for (const auto& save: saves)
+    Emit("movq #%s, %d(#rbp)", save.first, save.second);
+  auto& entry = func.Entry()->insts_;
+  entry.splice(std::next(entry.begin(), 2), prologue.Entry()->insts_);
+  func_ = nullptr;
+
+  PassManager::Run(&func);
+  func.BuildCFG();
+  func.Print(outFile_);
 }
 
 
@@ -1358,30 +1999,156 @@ void Generator::VisitTranslationUnit(TranslationUnit* unit)
 {
   for (auto extDecl: unit->ExtDecls()) {
     Visit(extDecl);
+    GenPendings();
+  }
+}
 
-    // float and string literal
-    if (rodatas_.size())
-      Emit(".section .rodata");
-    for (auto rodata: rodatas_) {
-      if (rodata.align_ == 1) {// Literal
-        EmitLabel(rodata.label_);
-        Emit(".string \"%s\"", rodata.sval_.c_str());
-      } else if (rodata.align_ == 4) {
-        Emit(".align 4");
-        EmitLabel(rodata.label_);
-        Emit(".long %d", static_cast<int>(rodata.ival_));
-      } else {
-        Emit(".align 8");
-        EmitLabel(rodata.label_);
-        Emit(".quad %ld", rodata.ival_);
-      }
+
+// Emit literals and static objects collected by the external declaration
+void Generator::GenPendings()
+{
+  // float and string literal
+  if (rodatas_.size())
+    Emit(".section .rodata");
+  for (auto rodata: rodatas_) {
+    if (rodata.targets_.size()) {
+      Emit(".align 4");
+      EmitLabel(rodata.label_);
+      for (const auto& target: rodata.targets_)
+        Emit(".long %s-%s", target.c_str(), rodata.label_.c_str());
+    } else if (rodata.align_ == 1) {// Literal
+      EmitLabel(rodata.label_);
+      Emit(".string \"%s\"", rodata.sval_.c_str());
+    } else if (rodata.align_ == 4) {
+      Emit(".align 4");
+      EmitLabel(rodata.label_);
+      Emit(".long %d", static_cast<int>(rodata.ival_));
+    } else {
+      Emit(".align 8");
+      EmitLabel(rodata.label_);
+      Emit(".quad %ld", rodata.ival_);
     }
-    rodatas_.clear();
+  }
+  rodatas_.clear();
+
+  for (auto staticDecl: staticDecls_) {
+    GenStaticDecl(staticDecl);
+  }
+  staticDecls_.clear();
+}
+
+
+static bool ReadCache(const std::string& fileName, std::string& str)
+{
+  auto fp = fopen(fileName.c_str(), "rb");
+  if (fp == nullptr)
+    return false;
+  char buf[1 << 16];
+  size_t len;
+  str.clear();
+  while ((len = fread(buf, 1, sizeof(buf), fp)) > 0)
+    str.append(buf, len);
+  auto ok = !ferror(fp);
+  fclose(fp);
+  return ok;
+}
+
+
+// Written aside and renamed, concurrent compilations may read it
+static void WriteCache(const std::string& fileName, const std::string& str)
+{
+  auto tmpFileName = fileName + "." + std::to_string(getpid());
+  auto fp = fopen(tmpFileName.c_str(), "wb");
+  if (fp == nullptr)
+    return;
+  auto ok = fwrite(str.data(), 1, str.size(), fp) == str.size();
+  if (fclose(fp) == 0 && ok)
+    rename(tmpFileName.c_str(), fileName.c_str());
+  else
+    remove(tmpFileName.c_str());
+}
+
+
+/*
+ * Function definitions are generated by 'jobs_' threads,
+ * each into its own buffer. The buffers and the other
+ * external declarations are then written in order.
+ * With the cache, the label space of a function is decided by its
+ * key instead of its position, the labels of the parser are numbered
+ * in the space. Thus its code does not depend on the other functions,
+ * and is reused as long as the key is unchanged.
+ */
+void Generator::GenParallel(TranslationUnit* unit)
+{
+  std::vector<FuncDef*> funcDefs;
+  for (auto extDecl: unit->ExtDecls()) {
+    if (extDecl->ToFuncDef())
+      funcDefs.push_back(extDecl->ToFuncDef());
+  }
 
-    for (auto staticDecl: staticDecls_) {
-      GenStaticDecl(staticDecl);
+  // The label space of each function, the tags taken in it
+  // before the generation and the file caching its code
+  std::vector<int> spaces(funcDefs.size());
+  std::vector<int> tags(funcDefs.size());
+  std::vector<std::string> cacheFileNames(funcDefs.size());
+  std::unordered_set<int> usedSpaces;
+  for (size_t i = 0; i < funcDefs.size(); ++i) {
+    spaces[i] = i + 1;
+    if (cacheDir_.empty())
+      continue;
+    std::vector<LabelStmt*> labels;
+    auto key = cacheKey_ + Serializer::Key(funcDefs[i], labels);
+    int space = std::hash<std::string>()(key) % INT_MAX + 1;
+    while (!usedSpaces.insert(space).second)
+      space = space % INT_MAX + 1;
+    spaces[i] = space;
+    for (auto label: labels) {
+      label->space_ = space;
+      label->tag_ = ++tags[i];
+    }
+    key += " " + std::to_string(space);
+    char name[32];
+    snprintf(name, sizeof(name), "%016lx.f",
+        static_cast<unsigned long>(std::hash<std::string>()(key)));
+    cacheFileNames[i] = cacheDir_ + "/" + name;
+  }
+
+  std::vector<std::string> bufs(funcDefs.size());
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    Generator g;
+    for (size_t i; (i = next++) < funcDefs.size(); ) {
+      const auto& cacheFileName = cacheFileNames[i];
+      if (!cacheFileName.empty() && ReadCache(cacheFileName, bufs[i]))
+        continue;
+      char* buf;
+      size_t size;
+      outFile_ = open_memstream(&buf, &size);
+      LabelStmt::EnterSpace(spaces[i], tags[i]);
+      g.Visit(funcDefs[i]);
+      g.GenPendings();
+      fclose(outFile_);
+      bufs[i].assign(buf, size);
+      free(buf);
+      if (!cacheFileName.empty())
+        WriteCache(cacheFileName, bufs[i]);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < jobs_; i++)
+    threads.emplace_back(worker);
+  for (auto& thread: threads)
+    thread.join();
+
+  size_t i = 0;
+  for (auto extDecl: unit->ExtDecls()) {
+    if (extDecl->ToFuncDef()) {
+      fputs(bufs[i++].c_str(), outFile_);
+    } else {
+      Visit(extDecl);
+      GenPendings();
     }
-    staticDecls_.clear();
   }
 }
 
@@ -1389,7 +2156,20 @@ void Generator::VisitTranslationUnit(TranslationUnit* unit)
 void Generator::Gen()
 {
   Emit(".file \"%s\"", inFileName.c_str());
-  VisitTranslationUnit(parser_->Unit());
+  if (jobs_ > 1 || !cacheDir_.empty())
+    GenParallel(unit_);
+  else
+    VisitTranslationUnit(unit_);
+}
+
+
+void Generator::EmitLoad(const ObjectAddr& addr, Type* type)
+{
+  if (addr.reg_ == nullptr)
+    return EmitLoad(addr.Repr(), type);
+  auto width = type->Width();
+  Emit("%s #%s, #%s", GetLoad(width), GetReg(addr.reg_, width).c_str(),
+      GetDes(width == 4 ? 4: 8, false));
 }
 
 
@@ -1409,10 +2189,15 @@ void Generator::EmitLoad(const std::string& addr, int width, bool flt)
 
 void Generator::EmitStore(const ObjectAddr& addr, Type* type)
 {
-  if (addr.bitFieldWidth_ != 0)
+  if (addr.reg_ != nullptr) {
+    auto width = type->Width();
+    Emit("%s #%s, #%s", GetInst("mov", width, false).c_str(),
+        GetDes(width, false), GetReg(addr.reg_, width).c_str());
+  } else if (addr.bitFieldWidth_ != 0) {
     EmitStoreBitField(addr, type);
-  else
+  } else {
     EmitStore(addr.Repr(), type);
+  }
 }
 
 void Generator::EmitStore(const std::string& addr, Type* type)
@@ -1429,39 +2214,128 @@ void Generator::EmitStore(const std::string& addr, int width, bool flt)
 }
 
 
-void Generator::Emit(const char* format, ...)
+static std::string Format(const std::string& format, va_list args)
+{
+  char buf[256];
+  va_list copy;
+  va_copy(copy, args);
+  auto len = vsnprintf(buf, sizeof(buf), format.c_str(), copy);
+  va_end(copy);
+  std::string str(buf);
+  if (len >= static_cast<int>(sizeof(buf))) {
+    str.resize(len + 1);
+    vsnprintf(&str[0], len + 1, format.c_str(), args);
+    str.resize(len);
+  }
+  return str;
+}
+
+
+// The kind of operand is given by its format: '#' marks the register,
+// '$' the immediate, and the others are the memory address, or the label
+// of jump and call. '*' marks the target of indirect jump and call.
+static Operand NewOperand(const std::string& format,
+                          const std::string& str, bool target)
 {
-  fprintf(outFile_, "\t");
+  auto indirect = format[0] == '*';
+  auto begin = indirect ? 1: 0;
+  Operand operand;
+  if (format.compare(begin, 2, "%%") == 0)
+    operand = Operand::NewReg(str.substr(begin + 1));
+  else if (format[begin] == '$')
+    operand = Operand::NewImm(str.substr(begin + 1));
+  else if (target)
+    operand = Operand::NewLabel(str.substr(begin));
+  else
+    operand = Operand::NewMem(str.substr(begin));
+  operand.indirect_ = indirect;
+  return operand;
+}
 
+
+// Instructions of the function being generated are appended to its IR.
+// The format is the mnemonic and the operands separated by ', ',
+// with the registers marked by '#' instead of '%'.
+void Generator::Emit(const char* format, ...)
+{
   std::string str(format);
-  auto pos = str.find(' ');
-  if (pos != std::string::npos) {
-    str[pos] = '\t';
-    while ((pos = str.find('#', pos)) != std::string::npos)
-      str.replace(pos, 1, "%%");
-  }
-  
+  // The prefix 'rep' is a part of the mnemonic
+  auto pos = str.find(' ', str.compare(0, 4, "rep ") == 0 ? 4: 0);
+  for (auto i = str.find('#'); i != std::string::npos; i = str.find('#', i))
+    str.replace(i, 1, "%%");
+
   va_list args;
   va_start(args, format);
-  vfprintf(outFile_, str.c_str(), args);
+  if (!func_) {
+    if (pos != std::string::npos)
+      str[pos] = '\t';
+    fprintf(outFile_, "\t%s\n", Format(str, args).c_str());
+    va_end(args);
+    return;
+  }
+
+  // The operands are formatted at once, separated by '\x1f'
+  std::vector<std::string> formats;
+  auto fields = str.substr(0, pos);
+  while (pos != std::string::npos) {
+    auto begin = pos + (str[pos] == ' ' ? 1: 2);
+    pos = str.find(", ", begin);
+    formats.push_back(str.substr(begin, pos - begin));
+    fields += '\x1f' + formats.back();
+  }
+  fields = Format(fields, args);
   va_end(args);
-  fprintf(outFile_, "\n");
+
+  pos = fields.find('\x1f');
+  Inst inst(fields.substr(0, pos));
+  auto target = inst.IsJump() || inst.IsCondJump() || inst.IsCall();
+  for (const auto& fmt: formats) {
+    auto begin = pos + 1;
+    pos = fields.find('\x1f', begin);
+    inst.Add(NewOperand(fmt, fields.substr(begin, pos - begin), target));
+  }
+  func_->Append(inst);
 }
 
 
 void Generator::EmitLabel(const std::string& label)
 {
-  fprintf(outFile_, "%s:\n", label.c_str());
+  if (func_)
+    func_->AppendLabel(label);
+  else
+    fprintf(outFile_, "%s:\n", label.c_str());
 }
 
 
 void Generator::EmitZero(ObjectAddr addr, int width)
 {
+  if (width >= repWidth) {
+    // The bytes left are zeroed below
+    Emit("leaq %s, #rcx", addr.Repr().c_str());
+    Emit("movq #rdi, #rdx");
+    Emit("movq #rcx, #rdi");
+    Emit("xorl #eax, #eax");
+    Emit("movl $%d, #ecx", width / 8);
+    Emit("rep stosq");
+    Emit("movq #rdx, #rdi");
+    addr.offset_ += width / 8 * 8;
+    width %= 8;
+  } else if (width >= 16) {
+    // The last 16 bytes may overlap those zeroed
+    Emit("pxor #xmm9, #xmm9");
+    auto begin = addr.offset_;
+    for (int offset = 0; offset < width; offset += 16) {
+      addr.offset_ = begin + std::min(offset, width - 16);
+      Emit("movups #xmm9, %s", addr.Repr().c_str());
+    }
+    return;
+  }
+
   int units[] = {8, 4, 2, 1};
   for (auto unit: units) {
     while (width >= unit) {
-      Emit("movq $0, #rax");
-      EmitStore(addr.Repr(), unit, false);
+      auto suffix = unit == 8 ? 'q': unit == 4 ? 'l': unit == 2 ? 'w': 'b';
+      Emit("mov%c $0, %s", suffix, addr.Repr().c_str());
       addr.offset_ += unit;
       width -= unit;
     }
@@ -1469,6 +2343,85 @@ void Generator::EmitZero(ObjectAddr addr, int width)
 }
 
 
+// The jump taken if the relational operator 'op' is 'jumpIf'
+static const char* GetJump(int op, bool flt, bool sign, bool jumpIf)
+{
+  auto less = flt || !sign ? "jb": "jl";
+  auto lessEqual = flt || !sign ? "jbe": "jle";
+  auto greater = flt || !sign ? "ja": "jg";
+  auto greaterEqual = flt || !sign ? "jae": "jge";
+  switch (op) {
+  case '<': return jumpIf ? less: greaterEqual;
+  case '>': return jumpIf ? greater: lessEqual;
+  case Token::LE: return jumpIf ? lessEqual: greater;
+  case Token::GE: return jumpIf ? greaterEqual: less;
+  case Token::EQ: return jumpIf ? "je": "jne";
+  case Token::NE: return jumpIf ? "jne": "je";
+  default: return nullptr;
+  }
+}
+
+
+void BranchGenerator::VisitBinaryOp(BinaryOp* binary)
+{
+  auto op = binary->op_;
+  if (op == Token::LOGICAL_AND || op == Token::LOGICAL_OR) {
+    // Jumps to 'label_' on the lhs deciding the result
+    if (jumpIf_ == (op == Token::LOGICAL_OR)) {
+      BranchGenerator(label_, jumpIf_).GenExpr(binary->lhs_);
+      BranchGenerator(label_, jumpIf_).GenExpr(binary->rhs_);
+    } else {
+      auto skip = LabelStmt::New()->Label();
+      BranchGenerator(skip, !jumpIf_).GenExpr(binary->lhs_);
+      BranchGenerator(label_, jumpIf_).GenExpr(binary->rhs_);
+      EmitLabel(skip);
+    }
+    return;
+  }
+
+  // Pointers are compared as values, the same as Generator
+  auto type = binary->lhs_->Type();
+  auto jump = GetJump(op, type->IsFloat(), !type->IsUnsigned(), jumpIf_);
+  if (!jump || !type->ToArithm())
+    return GenValue(binary);
+
+  auto width = type->Width();
+  auto flt = type->IsFloat();
+  Generator().VisitExpr(binary->lhs_);
+  Spill(flt);
+  Generator().VisitExpr(binary->rhs_);
+  Restore(flt);
+  GenCmp(width, flt);
+  Emit("%s %s", jump, label_.c_str());
+}
+
+
+void BranchGenerator::VisitUnaryOp(UnaryOp* unary)
+{
+  if (unary->op_ == '!')
+    BranchGenerator(label_, !jumpIf_).GenExpr(unary->operand_);
+  else
+    GenValue(unary);
+}
+
+
+void BranchGenerator::VisitConstant(Constant* cons)
+{
+  if (!cons->Type()->IsInteger())
+    return GenValue(cons);
+  if ((cons->IVal() != 0) == jumpIf_)
+    Emit("jmp %s", label_.c_str());
+}
+
+
+void BranchGenerator::GenValue(Expr* expr)
+{
+  Generator().VisitExpr(expr);
+  GenCompZero(expr->Type());
+  Emit("%s %s", jumpIf_ ? "jne": "je", label_.c_str());
+}
+
+
 void LValGenerator::VisitBinaryOp(BinaryOp* binary)
 {
   assert(binary->op_ == '.');
@@ -1503,6 +2456,9 @@ void LValGenerator::VisitObject(Object* obj)
 
   if (obj->IsStatic()) {
     addr_ = {obj->Label(), "rip", 0};
+  } else if (obj->Reg()) {
+    addr_ = {"", "", 0};
+    addr_.reg_ = obj->Reg();
   } else {
     addr_ = {"", "rbp", obj->Offset()};
   }
@@ -1519,22 +2475,18 @@ void LValGenerator::VisitIdentifier(Identifier* ident)
 }
 
 
+// The temporary variable is in %rcx
 void LValGenerator::VisitTempVar(TempVar* tempVar)
 {
-  std::string label;
-  switch (tempVar->Type()->Width()) {
-  case 1: label = "%cl"; break;
-  case 2: label = "%cx"; break;
-  case 4: label = "%ecx"; break;
-  case 8: label = "%rcx"; break;
-  default: assert(false);
-  }
-  addr_ = {label, "", 0};
+  assert(tempVar->Type()->IsScalar());
+  addr_ = {"", "", 0};
+  addr_.reg_ = "rcx";
 }
 
 
 std::string ObjectAddr::Repr() const
 {
+  assert(reg_ == nullptr);
   auto ret = base_.size() ? "(%" + base_ + ")": "";
   if (label_.size() == 0) {
     if (offset_ == 0)
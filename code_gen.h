@@ -2,10 +2,12 @@
 #define _WGTCC_CODE_GEN_H_
 
 #include "ast.h"
+#include "ir.h"
 #include "visitor.h"
 
+#include <unordered_set>
+
 
-class Parser;
 class Addr;
 class ROData;
 class Evaluator<Addr>;
@@ -38,11 +40,17 @@ struct ParamLocations {
 struct ROData
 {
   ROData(long ival, int align): ival_(ival), align_(align) {
-    label_ = ".LC" + std::to_string(GenTag());
+    label_ = GenLabel();
   }
 
   explicit ROData(const std::string& sval): sval_(sval), align_(1) {
-    label_ = ".LC" + std::to_string(GenTag());
+    label_ = GenLabel();
+  }
+
+  // Jump table of the offsets of the targets to the table
+  explicit ROData(const std::vector<std::string>& targets)
+      : targets_(targets), align_(4) {
+    label_ = GenLabel();
   }
 
   //ROData(const ROData& other) = delete;
@@ -53,14 +61,17 @@ struct ROData
 
   std::string sval_;
   long ival_;
+  std::vector<std::string> targets_;
 
   int align_;
   std::string label_;
 
 private:
-  static long GenTag() {
+  static std::string GenLabel() {
+    if (LabelStmt::Space())
+      return LabelStmt::SpaceLabel(".LC");
     static long tag = 0;
-    return tag++;
+    return ".LC" + std::to_string(tag++);
   }
 };
 
@@ -77,6 +88,8 @@ struct ObjectAddr
   int offset_;
   unsigned char bitFieldBegin_ {0};
   unsigned char bitFieldWidth_ {0};
+  // The object is in the register, it has no address
+  const char* reg_ {nullptr};
 };
 
 
@@ -123,6 +136,7 @@ public:
   virtual void VisitEmptyStmt(EmptyStmt* emptyStmt);
   virtual void VisitIfStmt(IfStmt* ifStmt);
   virtual void VisitJumpStmt(JumpStmt* jumpStmt);
+  virtual void VisitSwitchStmt(SwitchStmt* switchStmt);
   virtual void VisitReturnStmt(ReturnStmt* returnStmt);
   virtual void VisitLabelStmt(LabelStmt* labelStmt);
   virtual void VisitCompoundStmt(CompoundStmt* compoundStmt);
@@ -131,11 +145,21 @@ public:
   virtual void VisitTranslationUnit(TranslationUnit* unit);
 
 
-  static void SetInOut(Parser* parser, FILE* outFile) {
-    parser_ = parser;
+  static void SetInOut(TranslationUnit* unit, FILE* outFile) {
+    unit_ = unit;
     outFile_ = outFile;
   }
 
+  // Number of threads generating function definitions
+  static void SetJobs(int jobs) { jobs_ = jobs; }
+
+  // Reuse the code of unchanged functions in 'dir',
+  // 'key' tells the options and the build of the compiler
+  static void SetCache(const std::string& dir, const std::string& key) {
+    cacheDir_ = dir;
+    cacheKey_ = key;
+  }
+
   void Gen();
   
 protected:
@@ -154,8 +178,16 @@ protected:
   void GenPointerArithm(BinaryOp* binary);
   void GenDivOp(bool flt, bool sign, int width, int op);
   void GenMulOp(int width, bool flt, bool sign);
+  void GenCmp(int width, bool flt);
   void GenCompOp(int width, bool flt, const char* set);
   void GenCompZero(Type* type);
+  void GenCmpImm(long val);
+
+  // Switch
+  void GenJumpTable(const SwitchStmt::CaseList& cases,
+      const std::string& deflt);
+  void GenCaseSearch(const SwitchStmt::CaseList& cases, size_t begin,
+      size_t end, const std::string& deflt, bool unsign);
 
   // Unary
   void GenIncDec(Expr* operand, bool postfix, const std::string& inst);
@@ -166,6 +198,8 @@ protected:
       int offset);
 
   void GenStaticDecl(Declaration* decl);
+  void GenPendings();
+  void GenParallel(TranslationUnit* unit);
   
   void GenSaveArea();
   void GenBuiltin(FuncCall* funcCall);
@@ -184,6 +218,7 @@ protected:
   void Emit(const char* format, ...);
   void EmitLabel(const std::string& label);
   void EmitZero(ObjectAddr addr, int width);
+  void EmitLoad(const ObjectAddr& addr, Type* type);
   void EmitLoad(const std::string& addr, Type* type);
   void EmitLoad(const std::string& addr, int width, bool flt);
   void EmitStore(const ObjectAddr& addr, Type* type);
@@ -191,6 +226,9 @@ protected:
   void EmitStore(const std::string& addr, int width, bool flt);
   void EmitLoadBitField(const std::string& addr, Object* bitField);
   void EmitStoreBitField(const ObjectAddr& addr, Type* type);
+  void EmitLoadEightbyte(const std::string& reg, ObjectAddr addr,
+                         int width, const char* scratch);
+  void EmitStoreEightbytes(const LocationList& regs, ObjectAddr addr);
 
   int Push(const Type* type);
   int Push(const std::string& reg);
@@ -205,19 +243,38 @@ protected:
   void Exchange(bool flt);
 
 protected:
-  static Parser* parser_;
-  static FILE* outFile_;
+  static TranslationUnit* unit_;
+  static int jobs_;
+  static std::string cacheDir_;
+  static std::string cacheKey_;
+
+  // The states of the function being generated are per thread
+  static thread_local FILE* outFile_;
 
   //static std::string _cons;
-  static RODataList rodatas_;
-  static int offset_;
+  static thread_local RODataList rodatas_;
+  static thread_local int offset_;
+  // The lowest slot of the objects whose address may escape,
+  // the slots above it are not reused by the following blocks
+  static thread_local int pinned_;
+  static thread_local std::unordered_set<Object*> addrTaken_;
 
   // The address that store the register %rdi,
   //     when the return value is a struct/union
-  static int retAddrOffset_;
-  static FuncDef* curFunc_;
+  static thread_local int retAddrOffset_;
+  static thread_local FuncDef* curFunc_;
+
+  static thread_local std::vector<Declaration*> staticDecls_;
 
-  static std::vector<Declaration*> staticDecls_;
+  // Callee-saved registers free for temporaries,
+  // the registers used by the function and where they are saved
+  static thread_local std::vector<const char*> tempRegs_;
+  static thread_local std::vector<const char*> spills_;
+  static thread_local std::vector<const char*> usedRegs_;
+  static thread_local int saveOffset_;
+
+  // The IR of the function being generated
+  static thread_local IRFunc* func_;
 };
 
 
@@ -258,4 +315,50 @@ private:
   ObjectAddr addr_ {"", "", 0};
 };
 
+
+/*
+ * Generate the condition as jumps instead of its value: relational
+ * operators are a compare and a conditional jump, '&&', '||' and '!'
+ * only jump. Other expressions are evaluated and compared to 0.
+ */
+class BranchGenerator: public Generator
+{
+public:
+  // Jump to 'label' if the condition is 'jumpIf', or fall through
+  BranchGenerator(const std::string& label, bool jumpIf)
+      : label_(label), jumpIf_(jumpIf) {}
+
+  //Expression
+  virtual void VisitBinaryOp(BinaryOp* binaryOp);
+  virtual void VisitUnaryOp(UnaryOp* unaryOp);
+  virtual void VisitConditionalOp(ConditionalOp* condOp) {
+    GenValue(condOp);
+  }
+  virtual void VisitFuncCall(FuncCall* funcCall) {
+    GenValue(funcCall);
+  }
+  virtual void VisitObject(Object* obj) {
+    GenValue(obj);
+  }
+  virtual void VisitEnumerator(Enumerator* enumer) {
+    GenValue(enumer);
+  }
+  virtual void VisitIdentifier(Identifier* ident) {
+    GenValue(ident);
+  }
+  virtual void VisitConstant(Constant* cons);
+  virtual void VisitTempVar(TempVar* tempVar) {
+    GenValue(tempVar);
+  }
+
+  void GenExpr(Expr* cond) {
+    cond->Accept(this);
+  }
+private:
+  void GenValue(Expr* expr);
+
+  std::string label_;
+  bool jumpIf_;
+};
+
 #endif
@@ -3,6 +3,7 @@
 #include "evaluator.h"
 #include "parser.h"
 
+#include <climits>
 #include <ctime>
 #include <fcntl.h>
 #include <unistd.h>
@@ -28,6 +29,8 @@ static const DirectiveMap directiveMap = {
   {"undef", Token::PP_UNDEF},
   {"line", Token::PP_LINE},
   {"error", Token::PP_ERROR},
+  // Non-standard GNU extension
+  {"warning", Token::PP_WARNING},
   {"pragma", Token::PP_PRAGMA}
 };
 
@@ -51,7 +54,15 @@ void Preprocessor::Expand(TokenSequence& os, TokenSequence is, bool inCond)
     } else if (!inCond && !NeedExpand()) {
       // Discards 
       is.Next();
-    } else if (tok->hs_ && tok->hs_->find(name) != tok->hs_->end()) {
+    } else if (inCond && name == "defined"
+        && tok->tag_ == Token::IDENTIFIER) {
+      // The operand of 'defined' is not expanded
+      os.InsertBack(is.Next());
+      if (is.Test('('))
+        os.InsertBack(is.Next());
+      if (is.Test(Token::IDENTIFIER))
+        os.InsertBack(is.Next());
+    } else if (tok->hs_ && tok->hs_->Contains(name)) {
       os.InsertBack(is.Next());
     } else if ((macro = FindMacro(name))) {
       is.Next();
@@ -61,32 +72,23 @@ void Preprocessor::Expand(TokenSequence& os, TokenSequence is, bool inCond)
       } else if (name == "__LINE__") {
         HandleTheLineMacro(os, tok);
       } else if (macro->ObjLike()) {
-        // Make a copy, as subst will change repSeq
-        auto repSeq = macro->RepSeq(tok->loc_.fileName_, tok->loc_.line_);
-
         TokenList tokList;
         TokenSequence repSeqSubsted(&tokList);
-        ParamMap paramMap;
-        // TODO(wgtdkp): hideset is not right
-        // Make a copy of hideset
+        ArgList args;
         // HS U {name}
-        auto hs = tok->hs_ ? *tok->hs_: HideSet();
-        hs.insert(name);
-        Subst(repSeqSubsted, repSeq, tok->ws_, hs, paramMap);
+        auto hs = HideSet::Add(tok->hs_, name);
+        Subst(repSeqSubsted, tok, macro, hs, args);
         is.InsertFront(repSeqSubsted);
       } else if (is.Try('(')) {
-        ParamMap paramMap;
-        auto rpar = ParseActualParam(is, macro, paramMap);
-        auto repSeq = macro->RepSeq(tok->loc_.fileName_, tok->loc_.line_);
-        //const_cast<Token*>(repSeq.Peek())->ws_ = tok->ws_;
+        ArgList args;
+        auto rpar = ParseActualParam(is, macro, args);
         TokenList tokList;
         TokenSequence repSeqSubsted(&tokList);
 
         // (HS ^ HS') U {name}
-        // Use HS' U {name} directly                
-        auto hs = rpar->hs_ ? *rpar->hs_: HideSet();
-        hs.insert(name);
-        Subst(repSeqSubsted, repSeq, tok->ws_, hs, paramMap);
+        auto hs = HideSet::Intersect(tok->hs_, rpar->hs_);
+        hs = HideSet::Add(hs, name);
+        Subst(repSeqSubsted, tok, macro, hs, args);
         is.InsertFront(repSeqSubsted);
       } else {
         os.InsertBack(tok);
@@ -99,63 +101,69 @@ void Preprocessor::Expand(TokenSequence& os, TokenSequence is, bool inCond)
 }
 
 
-static bool FindActualParam(TokenSequence& ap,
-                            ParamMap& params, const std::string& fp)
+// Copy a token of the replacement list to the place of macro invocation
+static Token* RepToken(const Token* tok, const SourceLocation& loc)
 {
-  auto res = params.find(fp);
-  if (res == params.end()) {
-    return false;
-  }
-  ap.Copy(res->second);
-  return true;
+  auto ret = Token::New(*tok);
+  ret->loc_.fileName_ = loc.fileName_;
+  ret->loc_.line_ = loc.line_;
+  return ret;
 }
 
 
-void Preprocessor::Subst(TokenSequence& os, TokenSequence is,
-                         bool leadingWS, const HideSet& hs, ParamMap& params)
+void Preprocessor::Subst(TokenSequence& os, const Token* macroTok,
+                         Macro* macro, const HideSet* hs, ArgList& args)
 {
   TokenSequence ap;
-
-  while (!is.Empty()) {
-    if (is.Test('#') && FindActualParam(ap, params, is.Peek2()->str_)) {
-      is.Next(); is.Next();
+  // The left operand of '##' is an empty param,
+  // then the '##' has no effect
+  bool noPaste = false;
+
+  for (const auto& item: macro->Body()) {
+    auto paste = !noPaste;
+    noPaste = false;
+
+    switch (item.kind_) {
+    case MacroItem::TOKEN:
+      os.InsertBack(RepToken(item.tok_, macroTok->loc_));
+      break;
+    case MacroItem::STRINGIZE: {
+      ap = args[item.param_];
       auto tok = Token::New(*ap.Peek());
       tok->tag_ = Token::LITERAL;
       tok->str_ = Stringize(ap);
       os.InsertBack(tok);
-    } else if (is.Test(Token::DSHARP)
-        && FindActualParam(ap, params, is.Peek2()->str_)) {
-      is.Next(); is.Next();
-      if (!ap.Empty())
+    } break;
+    case MacroItem::PASTE_PARAM:
+      ap.Copy(args[item.param_]);
+      if (!paste)
+        os.InsertBack(ap);
+      else if (!ap.Empty())
         Glue(os, ap);
-    } else if (is.Test(Token::DSHARP)) {
-      is.Next();
-      auto tok = is.Next();
-      Glue(os, tok);
-    } else if (is.Peek2()->tag_ == Token::DSHARP 
-        && FindActualParam(ap, params, is.Peek()->str_)) {
-      is.Next();
-
-      if (ap.Empty()) {
-        is.Next();
-        if (FindActualParam(ap, params, is.Peek()->str_)) {
-          is.Next();
-          os.InsertBack(ap);
-        }
-      } else {
+      break;
+    case MacroItem::PASTE_TOKEN:
+      if (!paste)
+        os.InsertBack(RepToken(item.tok_, macroTok->loc_));
+      else
+        Glue(os, item.tok_);
+      break;
+    case MacroItem::PARAM_RAW:
+      ap.Copy(args[item.param_]);
+      if (ap.Empty())
+        noPaste = true;
+      else
         os.InsertBack(ap);
-      }
-    } else if (FindActualParam(ap, params, is.Peek()->str_)) {
-      auto tok = is.Next();
-      const_cast<Token*>(ap.Peek())->ws_ = tok->ws_;
+      break;
+    case MacroItem::PARAM:
+      ap.Copy(args[item.param_]);
+      const_cast<Token*>(ap.Peek())->ws_ = item.tok_->ws_;
       Expand(os, ap);
-    } else {
-      os.InsertBack(is.Peek());
-      is.Next();
+      break;
+    default: assert(false);
     }
   }
 
-  os.FinalizeSubst(leadingWS, hs);
+  os.FinalizeSubst(macroTok->ws_, hs);
 }
 
 
@@ -263,13 +271,31 @@ void Preprocessor::Process(TokenSequence& os)
   // the file to the header of the token sequence
   auto wgtccHeaderFile = SearchFile("wgtcc.h", true, false);
   IncludeFile(is, wgtccHeaderFile);
+  if (directivesOnly_) {
+    ProcessDirectives(is);
+    return;
+  }
   Expand(os, is);
   Finalize(os);
 }
 
 
+void Preprocessor::ProcessDirectives(TokenSequence is)
+{
+  TokenSequence os;
+  int directive;
+  while (!is.Empty()) {
+    UpdateFirstTokenLine(is);
+    if ((directive = GetDirective(is)) != Token::INVALID)
+      ParseDirective(os, is, directive);
+    else
+      is.Next();
+  }
+}
+
+
 const Token* Preprocessor::ParseActualParam(TokenSequence& is,
-    Macro* macro, ParamMap& paramMap)
+    Macro* macro, ArgList& args)
 {
   const Token* ret;
   if (macro->Params().size() == 0 && !macro->Variadic()) {
@@ -279,10 +305,9 @@ const Token* Preprocessor::ParseActualParam(TokenSequence& is,
     return ret;
   }
 
-  //TokenSequence ts(is);
-  //TokenSequence ap(is);
-  auto fp = macro->Params().begin();
-  //ap.begin_ = is.begin_;
+  auto paramCnt = macro->Params().size();
+  size_t fp = 0;
+  args.resize(macro->ArgCnt());
   TokenSequence ap;
 
   int cnt = 1;
@@ -295,20 +320,16 @@ const Token* Preprocessor::ParseActualParam(TokenSequence& is,
       --cnt;
     
     if ((is.Test(',') && cnt == 1) || cnt == 0) {
-      //ap.end_ = is.begin_;
-
-      if (fp == macro->Params().end()) {
+      if (fp == paramCnt) {
         if (!macro->Variadic())
           Error(is.Peek(), "too many arguments");
         if (cnt == 0)
-          paramMap.insert(std::make_pair("__VA_ARGS__", ap));
+          args[paramCnt] = ap;
         else
           ap.InsertBack(is.Peek());
       } else {
-        paramMap.insert(std::make_pair(*fp, ap));
-        //ap.begin_ = ++ap.end_;
+        args[fp++] = ap;
         ap = TokenSequence();
-        ++fp;
       }
     } else {
       ap.InsertBack(is.Peek());
@@ -316,52 +337,12 @@ const Token* Preprocessor::ParseActualParam(TokenSequence& is,
     ret = is.Next();
   }
 
-  if (fp != macro->Params().end())
+  if (fp != paramCnt)
     Error(is.Peek(), "too few params");
   return ret;
 }
 
 
-void Preprocessor::ReplaceDefOp(TokenSequence& is)
-{
-  TokenSequence os;
-  while (!is.Empty()) {
-    auto tok = is.Next();
-    if (tok->tag_ == Token::IDENTIFIER && tok->str_ == "defined") {
-      auto hasPar = false;
-      if (is.Try('(')) hasPar = true;
-      tok = is.Expect(Token::IDENTIFIER);
-      auto cons = Token::New(*tok);
-      if (hasPar) is.Expect(')');
-      cons->tag_ = Token::I_CONSTANT;
-      cons->str_ = FindMacro(tok->str_) ? "1": "0";
-      os.InsertBack(cons);
-    } else {
-      os.InsertBack(tok);
-    } 
-  }
-  is = os;
-}
-
-
-void Preprocessor::ReplaceIdent(TokenSequence& is)
-{
-  TokenSequence os;
-  while (!is.Empty()) {
-    auto tok = is.Next();
-    if (tok->tag_ == Token::IDENTIFIER) {
-      auto cons = Token::New(*tok);
-      cons->tag_ = Token::I_CONSTANT;
-      cons->str_ = "0";
-      os.InsertBack(cons);
-    } else {
-      os.InsertBack(tok);
-    }
-  }
-  is = os;
-}
-
-
 int Preprocessor::GetDirective(TokenSequence& is)
 {
   if (!is.Test('#') || !is.IsBeginOfLine())
@@ -421,6 +402,10 @@ void Preprocessor::ParseDirective(TokenSequence& os, TokenSequence& is, int dire
     if (NeedExpand())
       ParseError(ls);
     break;
+  case Token::PP_WARNING:
+    if (NeedExpand())
+      ParseWarning(ls);
+    break;
   case Token::PP_PRAGMA:
     if (NeedExpand())
       ParsePragma(ls);
@@ -449,6 +434,15 @@ void Preprocessor::ParseError(TokenSequence ls)
 }
 
 
+void Preprocessor::ParseWarning(TokenSequence ls)
+{
+  ls.Next();
+
+  const auto& msg = Stringize(ls);
+  Warning(ls.Peek(), "%s", msg.c_str());
+}
+
+
 void Preprocessor::ParseLine(TokenSequence ls)
 {
   auto directive = ls.Next(); // Skip directive 'line'
@@ -494,13 +488,8 @@ void Preprocessor::ParseIf(TokenSequence ls)
   }
 
   TokenSequence ts;
-  ReplaceDefOp(ls);
   Expand(ts, ls, true);
-  ReplaceIdent(ts);
-
-  Parser parser(ts);
-  auto expr = parser.ParseExpr();
-  int cond = Evaluator<long>().Eval(expr);
+  int cond = CondEvaluator(this, ts).Eval();
   ppCondStack_.push({Token::PP_IF, NeedExpand(), cond});
 }
 
@@ -559,13 +548,8 @@ void Preprocessor::ParseElif(TokenSequence ls)
   }
 
   TokenSequence ts;
-  ReplaceDefOp(ls);
   Expand(ts, ls, true);
-  ReplaceIdent(ts);
-
-  Parser parser(ts);
-  auto expr = parser.ParseExpr();
-  int cond = Evaluator<long>().Eval(expr);
+  int cond = CondEvaluator(this, ts).Eval();
 
   cond = cond && !top.cond_;
   ppCondStack_.push({Token::PP_ELIF, true, cond});
@@ -729,6 +713,9 @@ bool Preprocessor::ParseIdentList(ParamList& params, TokenSequence& is)
 
 void Preprocessor::IncludeFile(TokenSequence& is, const std::string* fileName)
 {
+  if (depSet_.insert(*fileName).second)
+    deps_.push_back(*fileName);
+
   TokenSequence ts {is.tokList_, is.begin_, is.begin_};
   Scanner scanner(ReadFile(*fileName), fileName);
   scanner.Tokenize(ts);
@@ -784,6 +771,34 @@ std::string* Preprocessor::SearchFile(
 }
 
 
+// Escape the characters that are special to make
+static void WriteDepName(FILE* fp, const std::string& name)
+{
+  for (auto c: name) {
+    if (c == ' ' || c == '#')
+      fputc('\\', fp);
+    else if (c == '$')
+      fputc('$', fp);
+    fputc(c, fp);
+  }
+}
+
+
+/*
+ * Write the included files as a make rule of 'target'
+ */
+void Preprocessor::WriteDeps(FILE* fp, const std::string& target) const
+{
+  WriteDepName(fp, target);
+  fputc(':', fp);
+  for (const auto& dep: deps_) {
+    fputs(" \\\n ", fp);
+    WriteDepName(fp, dep);
+  }
+  fputc('\n', fp);
+}
+
+
 void Preprocessor::AddMacro(const std::string& name,
     std::string* text, bool preDef)
 {
@@ -855,21 +870,47 @@ void Preprocessor::UpdateFirstTokenLine(TokenSequence ts)
 }
 
 
-TokenSequence Macro::RepSeq(const std::string* fileName, unsigned line)
+int Macro::ParamIndex(const Token* tok) const
 {
-  // Update line
-  TokenList tl;
-  TokenSequence ret(&tl);
-  ret.Copy(repSeq_);
-  auto ts = ret;
-  while (!ts.Empty()) {
-    auto loc = ts.Peek()->loc_;
-    loc.fileName_ = fileName;
-    loc.line_ = line;
-    ts.UpdateHeadLocation(loc);
-    ts.Next();
+  if (!funcLike_ || tok->tag_ != Token::IDENTIFIER)
+    return -1;
+  int idx = 0;
+  for (const auto& param: params_) {
+    if (param == tok->str_)
+      return idx;
+    ++idx;
+  }
+  if (variadic_ && tok->str_ == "__VA_ARGS__")
+    return idx;
+  return -1;
+}
+
+
+void Macro::Compile(TokenSequence is)
+{
+  while (!is.Empty()) {
+    auto tok = is.Next();
+    int param;
+    if (tok->tag_ == '#' && (param = ParamIndex(is.Peek())) >= 0) {
+      is.Next();
+      body_.push_back({MacroItem::STRINGIZE, param, tok});
+    } else if (tok->tag_ == Token::DSHARP) {
+      if (body_.empty() || is.Empty())
+        Error(tok, "'##' cannot appear at either end of macro expansion");
+      auto rhs = is.Next();
+      param = ParamIndex(rhs);
+      if (param >= 0)
+        body_.push_back({MacroItem::PASTE_PARAM, param, rhs});
+      else
+        body_.push_back({MacroItem::PASTE_TOKEN, -1, rhs});
+    } else if ((param = ParamIndex(tok)) >= 0) {
+      auto kind = is.Test(Token::DSHARP) ?
+          MacroItem::PARAM_RAW: MacroItem::PARAM;
+      body_.push_back({kind, param, tok});
+    } else {
+      body_.push_back({MacroItem::TOKEN, -1, tok});
+    }
   }
-  return ret;
 }
 
 
@@ -877,3 +918,215 @@ void Preprocessor::AddSearchPath(const std::string& path)
 {
   searchPathList_.push_back(path);
 }
+
+
+bool CondEvaluator::Eval()
+{
+  auto ret = EvalCondExpr(true);
+  if (!is_.Empty())
+    Error(is_.Peek(), "unexpected token in constant expression");
+  return ret.val_ != 0;
+}
+
+
+CondEvaluator::Value CondEvaluator::EvalCondExpr(bool eval)
+{
+  auto cond = EvalBinaryExpr(1, eval);
+  if (!is_.Try('?'))
+    return cond;
+
+  auto exprTrue = EvalCondExpr(eval && cond.val_);
+  is_.Expect(':');
+  auto exprFalse = EvalCondExpr(eval && !cond.val_);
+  auto ret = cond.val_ ? exprTrue: exprFalse;
+  ret.unsigned_ = exprTrue.unsigned_ || exprFalse.unsigned_;
+  return ret;
+}
+
+
+static int Precedence(int tag)
+{
+  switch (tag) {
+  case '*': case '/': case '%': return 10;
+  case '+': case '-': return 9;
+  case Token::LEFT: case Token::RIGHT: return 8;
+  case '<': case '>': case Token::LE: case Token::GE: return 7;
+  case Token::EQ: case Token::NE: return 6;
+  case '&': return 5;
+  case '^': return 4;
+  case '|': return 3;
+  case Token::LOGICAL_AND: return 2;
+  case Token::LOGICAL_OR: return 1;
+  default: return 0;
+  }
+}
+
+
+CondEvaluator::Value CondEvaluator::EvalBinaryExpr(int minPrec, bool eval)
+{
+  auto lhs = EvalUnaryExpr(eval);
+  int prec;
+  while ((prec = Precedence(is_.Peek()->tag_)) >= minPrec && !is_.Empty()) {
+    auto op = is_.Next();
+    if (op->tag_ == Token::LOGICAL_AND) {
+      auto rhs = EvalBinaryExpr(prec + 1, eval && lhs.val_);
+      lhs = {lhs.val_ && rhs.val_, false};
+    } else if (op->tag_ == Token::LOGICAL_OR) {
+      auto rhs = EvalBinaryExpr(prec + 1, eval && !lhs.val_);
+      lhs = {lhs.val_ || rhs.val_, false};
+    } else {
+      auto rhs = EvalBinaryExpr(prec + 1, eval);
+      lhs = Apply(op, lhs, rhs, eval);
+    }
+  }
+  return lhs;
+}
+
+
+CondEvaluator::Value CondEvaluator::Apply(
+    const Token* op, Value lhs, Value rhs, bool eval)
+{
+  // The usual arithmetic conversions
+  bool isUnsigned = lhs.unsigned_ || rhs.unsigned_;
+  unsigned long l = lhs.val_;
+  unsigned long r = rhs.val_;
+
+  switch (op->tag_) {
+  case '*': return {static_cast<long>(l * r), isUnsigned};
+  case '+': return {static_cast<long>(l + r), isUnsigned};
+  case '-': return {static_cast<long>(l - r), isUnsigned};
+  case '/':
+  case '%':
+    if (r == 0) {
+      if (eval)
+        Error(op, "division by zero");
+      return {0, isUnsigned};
+    }
+    if (isUnsigned)
+      return {static_cast<long>(op->tag_ == '/' ? l / r: l % r), true};
+    if (rhs.val_ == -1) // Avoid overflow of LONG_MIN / -1
+      return {op->tag_ == '/' ? static_cast<long>(-l): 0, false};
+    return {op->tag_ == '/' ? lhs.val_ / rhs.val_: lhs.val_ % rhs.val_, false};
+  case Token::LEFT:
+  case Token::RIGHT:
+    // The result has the type of the left operand
+    if (r >= 64)
+      return {0, lhs.unsigned_};
+    if (op->tag_ == Token::LEFT)
+      return {static_cast<long>(l << r), lhs.unsigned_};
+    if (lhs.unsigned_)
+      return {static_cast<long>(l >> r), true};
+    return {lhs.val_ >> r, false};
+  case '<':
+    return {isUnsigned ? l < r: lhs.val_ < rhs.val_, false};
+  case '>':
+    return {isUnsigned ? l > r: lhs.val_ > rhs.val_, false};
+  case Token::LE:
+    return {isUnsigned ? l <= r: lhs.val_ <= rhs.val_, false};
+  case Token::GE:
+    return {isUnsigned ? l >= r: lhs.val_ >= rhs.val_, false};
+  case Token::EQ: return {l == r, false};
+  case Token::NE: return {l != r, false};
+  case '&': return {static_cast<long>(l & r), isUnsigned};
+  case '^': return {static_cast<long>(l ^ r), isUnsigned};
+  case '|': return {static_cast<long>(l | r), isUnsigned};
+  default: assert(false); return {0, false};
+  }
+}
+
+
+CondEvaluator::Value CondEvaluator::EvalUnaryExpr(bool eval)
+{
+  auto tok = is_.Peek();
+  Value ret;
+  switch (tok->tag_) {
+  case '+':
+    is_.Next();
+    return EvalUnaryExpr(eval);
+  case '-':
+    is_.Next();
+    ret = EvalUnaryExpr(eval);
+    ret.val_ = -static_cast<unsigned long>(ret.val_);
+    return ret;
+  case '~':
+    is_.Next();
+    ret = EvalUnaryExpr(eval);
+    ret.val_ = ~ret.val_;
+    return ret;
+  case '!':
+    is_.Next();
+    ret = EvalUnaryExpr(eval);
+    return {!ret.val_, false};
+  default:
+    return EvalPrimaryExpr(eval);
+  }
+}
+
+
+CondEvaluator::Value CondEvaluator::EvalPrimaryExpr(bool eval)
+{
+  if (is_.Empty())
+    Error(is_.Peek(), "expect expression");
+
+  auto tok = is_.Next();
+  switch (tok->tag_) {
+  case '(': {
+    auto ret = EvalCondExpr(eval);
+    is_.Expect(')');
+    return ret;
+  }
+  case Token::I_CONSTANT:
+    return EvalInteger(tok);
+  case Token::C_CONSTANT: {
+    int val;
+    auto enc = Scanner(tok).ScanCharacter(val);
+    if (enc == Encoding::NONE)
+      val = static_cast<char>(val);
+    else if (enc == Encoding::CHAR16)
+      val = static_cast<char16_t>(val);
+    return {val, false};
+  }
+  case Token::IDENTIFIER:
+    if (tok->str_ == "defined") {
+      auto hasPar = is_.Try('(');
+      auto ident = is_.Expect(Token::IDENTIFIER);
+      if (hasPar)
+        is_.Expect(')');
+      return {cpp_->FindMacro(ident->str_) != nullptr, false};
+    }
+    // Identifiers that are not macro names
+    return {0, false};
+  case Token::F_CONSTANT:
+    Error(tok, "floating constant in preprocessor expression");
+  default:
+    Error(tok, "expect constant expression");
+  }
+  return {0, false}; // Make compiler happy
+}
+
+
+CondEvaluator::Value CondEvaluator::EvalInteger(const Token* tok)
+{
+  const auto& str = tok->str_;
+  size_t end = 0;
+  unsigned long val = 0;
+  try {
+    val = stoull(str, &end, 0);
+  } catch (const std::out_of_range& oor) {
+    Error(tok, "integer out of range");
+  }
+
+  bool hasU = false;
+  int longCnt = 0;
+  for (; end < str.size(); ++end) {
+    auto c = str[end];
+    if ((c == 'u' || c == 'U') && !hasU) {
+      hasU = true;
+    } else if ((c == 'l' || c == 'L') && longCnt < 2) {
+      ++longCnt;
+    } else {
+      Error(tok, "invalid suffix");
+    }
+  }
+  return {static_cast<long>(val), hasU || val > LONG_MAX};
+}
@@ -10,6 +10,7 @@
 #include <set>
 #include <stack>
 #include <string>
+#include <vector>
 
 class Scanner;
 class Macro;
@@ -17,31 +18,55 @@ struct CondDirective;
 
 typedef std::map<std::string, Macro> MacroMap; 
 typedef std::list<std::string> ParamList;
-typedef std::map<std::string, TokenSequence> ParamMap;
+// Actual params, indexed by the position of the formal param.
+// The variadic params take the last slot.
+typedef std::vector<TokenSequence> ArgList;
 typedef std::stack<CondDirective> PPCondStack;
 typedef std::list<std::string> PathList;
 
 
+/*
+ * An item of the compiled replacement list.
+ * References to params are resolved to param indices and
+ * the operands of '#' and '##' are marked at '#define' time,
+ * so that expansion needs no name lookup.
+ */
+struct MacroItem
+{
+  enum {
+    TOKEN,        // Ordinary token
+    PARAM,        // Param, fully macro-expanded before substitution
+    PARAM_RAW,    // Param as the left operand of '##'
+    STRINGIZE,    // '#' param
+    PASTE_PARAM,  // '##' param
+    PASTE_TOKEN,  // '##' token
+  };
+
+  int kind_;
+  int param_;
+  const Token* tok_;
+};
+
+typedef std::vector<MacroItem> MacroBody;
+
+
 class Macro
 {
 public:
   Macro(const TokenSequence& repSeq, bool preDef=false)
-      : funcLike_(false), variadic_(false),
-        preDef_(preDef), repSeq_(repSeq) {}
+      : funcLike_(false), variadic_(false), preDef_(preDef) {
+    Compile(repSeq);
+  }
 
   Macro(bool variadic, ParamList& params,
         TokenSequence& repSeq, bool preDef=false)
       : funcLike_(true), variadic_(variadic), preDef_(preDef),
-        params_(params), repSeq_(repSeq) {}
+        params_(params) {
+    Compile(repSeq);
+  }
   
   ~Macro() {}
 
-  /*
-  std::string Name() {
-    return tok_->Str();
-  }
-  */
-
   bool FuncLike() {
     return funcLike_;
   }
@@ -62,15 +87,24 @@ public:
     return params_;
   }
 
-  TokenSequence RepSeq(const std::string* fileName, unsigned line);
+  // Number of actual param slots, including the variadic one
+  size_t ArgCnt() const {
+    return params_.size() + variadic_;
+  }
+
+  const MacroBody& Body() const {
+    return body_;
+  }
 
 private:
-  //Token* tok_;
+  void Compile(TokenSequence is);
+  int ParamIndex(const Token* tok) const;
+
   bool funcLike_;
   bool variadic_;
   bool preDef_;
   ParamList params_;
-  TokenSequence repSeq_;
+  MacroBody body_;
 };
 
 
@@ -86,7 +120,7 @@ class Preprocessor
 {
 public:
   Preprocessor(const std::string* fileName)
-      : curLine_(1), lineLine_(0), curCond_(true) {
+      : curLine_(1), lineLine_(0), curCond_(true), directivesOnly_(false) {
     // Add predefined
     Init();
   }
@@ -94,17 +128,16 @@ public:
   ~Preprocessor() {}
   void Finalize(TokenSequence os);
   void Process(TokenSequence& os);
+  void ProcessDirectives(TokenSequence is);
   void Expand(TokenSequence& os, TokenSequence is, bool inCond=false);
-  void Subst(TokenSequence& os, TokenSequence is,
-             bool leadingWS, const HideSet& hs, ParamMap& params);
+  void Subst(TokenSequence& os, const Token* macroTok,
+             Macro* macro, const HideSet* hs, ArgList& args);
   void Glue(TokenSequence& os, TokenSequence is);
   void Glue(TokenSequence& os, const Token* tok);
   std::string Stringize(TokenSequence is);
   void Stringize(std::string& str, TokenSequence is);
-  const Token* ParseActualParam(TokenSequence& is, Macro* macro, ParamMap& paramMap);
+  const Token* ParseActualParam(TokenSequence& is, Macro* macro, ArgList& args);
   int GetDirective(TokenSequence& is);
-  void ReplaceDefOp(TokenSequence& is);
-  void ReplaceIdent(TokenSequence& is);
   void ParseDirective(TokenSequence& os, TokenSequence& is, int directive);
   void ParseIf(TokenSequence ls);
   void ParseIfdef(TokenSequence ls);
@@ -117,6 +150,7 @@ public:
   void ParseUndef(TokenSequence ls);
   void ParseLine(TokenSequence ls);
   void ParseError(TokenSequence ls);
+  void ParseWarning(TokenSequence ls);
   void ParsePragma(TokenSequence ls);
   void IncludeFile(TokenSequence& is, const std::string* fileName);
   bool ParseIdentList(ParamList& params, TokenSequence& is);
@@ -160,6 +194,13 @@ public:
   void HandleTheFileMacro(TokenSequence& os, const Token* macro);
   void HandleTheLineMacro(TokenSequence& os, const Token* macro);
   void UpdateFirstTokenLine(TokenSequence ts);
+  void WriteDeps(FILE* fp, const std::string& target) const;
+
+  // Only interpret directives, the text lines are discarded.
+  // This is enough for dependency generation ('-M').
+  void SetDirectivesOnly(bool directivesOnly) {
+    directivesOnly_ = directivesOnly;
+  }
   //bool Hidden(const std::string& name) {
   //    return hs_.find(name) != hs_.end();
   //}
@@ -179,9 +220,51 @@ private:
   unsigned curLine_;
   unsigned lineLine_;
   bool curCond_;
+  bool directivesOnly_;
   
   MacroMap macroMap_;
   PathList searchPathList_;
+
+  // Every file read, in the order of first inclusion
+  PathList deps_;
+  std::set<std::string> depSet_;
+};
+
+
+/*
+ * Evaluator of the constant expression of '#if' and '#elif'.
+ * It evaluates the macro-expanded tokens of the directive in place,
+ * by precedence climbing, without building the AST.
+ * The operand of 'defined' is not expanded (see Preprocessor::Expand),
+ * and other identifiers are replaced by 0.
+ * All values are of type intmax_t or uintmax_t.
+ */
+class CondEvaluator
+{
+  struct Value {
+    long val_;
+    bool unsigned_;
+  };
+
+public:
+  CondEvaluator(Preprocessor* cpp, TokenSequence& is)
+      : cpp_(cpp), is_(is) {}
+
+  bool Eval();
+
+private:
+  Value EvalCondExpr(bool eval);
+  Value EvalBinaryExpr(int minPrec, bool eval);
+  Value EvalUnaryExpr(bool eval);
+  Value EvalPrimaryExpr(bool eval);
+  Value EvalInteger(const Token* tok);
+  Value Apply(const Token* op, Value lhs, Value rhs, bool eval);
+
+  // 'eval' is false for the operands that are not evaluated,
+  // e.g. the right operand of '0 && x'
+
+  Preprocessor* cpp_;
+  TokenSequence& is_;
 };
 
 #endif
@@ -20,6 +20,28 @@
 
 extern std::string program;
 
+static bool recoverable = false;
+static int errorLimit = 20;
+static int errorCount = 0;
+
+
+void SetRecoverable(bool enable)
+{
+  recoverable = enable;
+}
+
+
+void SetErrorLimit(int limit)
+{
+  errorLimit = limit;
+}
+
+
+int ErrorCount()
+{
+  return errorCount;
+}
+
 
 void Error(const char* format, ...)
 {
@@ -33,18 +55,19 @@ void Error(const char* format, ...)
   
   fprintf(stderr, "\n");
 
-  exit(0);
+  exit(1);
 }
 
 
-static void VError(const SourceLocation& loc, const char* format, va_list args)
+static void VDiag(const SourceLocation& loc, const char* kind,
+    const char* format, va_list args)
 {
   assert(loc.fileName_);
-  fprintf(stderr,
-          "%s:%d:%d: " ANSI_COLOR_RED "error: " ANSI_COLOR_RESET,
+  fprintf(stderr, "%s:%d:%d: %s: " ANSI_COLOR_RESET,
           loc.fileName_->c_str(),
           loc.line_,
-          loc.column_);
+          loc.column_,
+          kind);
   vfprintf(stderr, format, args);
   fprintf(stderr, "\n    ");
 
@@ -62,8 +85,21 @@ static void VError(const SourceLocation& loc, const char* format, va_list args)
   fprintf(stderr, "\n    ");
   for (unsigned i = 1; i + nspaces < loc.column_; i++)
     fputc(' ', stderr);
-  fprintf(stderr, ANSI_COLOR_GREEN "^\n");
-  exit(0);	
+  fprintf(stderr, ANSI_COLOR_GREEN "^\n" ANSI_COLOR_RESET);
+}
+
+
+static void VError(const SourceLocation& loc, const char* format, va_list args)
+{
+  VDiag(loc, ANSI_COLOR_RED "error", format, args);
+  ++errorCount;
+  if (errorLimit > 0 && errorCount >= errorLimit) {
+    fprintf(stderr, "%s: too many errors, stopping now\n", program.c_str());
+    exit(1);
+  }
+  if (!recoverable)
+    exit(1);
+  throw RecoverableError();
 }
 
 
@@ -92,3 +128,30 @@ void Error(const Expr* expr, const char* format, ...)
   VError(expr->Tok()->loc_, format, args);
   va_end(args);
 }
+
+
+void Warning(const SourceLocation& loc, const char* format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  VDiag(loc, ANSI_COLOR_MAGENTA "warning", format, args);
+  va_end(args);
+}
+
+
+void Warning(const Token* tok, const char* format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  VDiag(tok->loc_, ANSI_COLOR_MAGENTA "warning", format, args);
+  va_end(args);
+}
+
+
+void Warning(const Expr* expr, const char* format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  VDiag(expr->Tok()->loc_, ANSI_COLOR_MAGENTA "warning", format, args);
+  va_end(args);
+}
@@ -5,9 +5,27 @@ class SourceLocation;
 class Token;
 class Expr;
 
+/*
+ * Errors at a source location are reported and counted.
+ * While recovery is enabled (by the parser), RecoverableError
+ * is then thrown, to resume at the next statement or declaration.
+ * Otherwise, the same as the errors of no location,
+ * the compilation stops with exit code 1.
+ */
+struct RecoverableError {};
+
 void Error(const char* format, ...);
 void Error(const SourceLocation& loc, const char* format, ...);
 void Error(const Token* tok, const char* format, ...);
 void Error(const Expr* expr, const char* format, ...);
 
+void Warning(const SourceLocation& loc, const char* format, ...);
+void Warning(const Token* tok, const char* format, ...);
+void Warning(const Expr* expr, const char* format, ...);
+
+void SetRecoverable(bool recoverable);
+// Stop after 'limit' errors, 0 for no limit
+void SetErrorLimit(int limit);
+int ErrorCount();
+
 #endif
@@ -54,6 +54,7 @@ public:
   virtual void VisitDeclaration(Declaration* init) {}
   virtual void VisitIfStmt(IfStmt* ifStmt) {}
   virtual void VisitJumpStmt(JumpStmt* jumpStmt) {}
+  virtual void VisitSwitchStmt(SwitchStmt* switchStmt) {}
   virtual void VisitReturnStmt(ReturnStmt* returnStmt) {}
   virtual void VisitLabelStmt(LabelStmt* labelStmt) {}
   virtual void VisitEmptyStmt(EmptyStmt* emptyStmt) {}
@@ -121,6 +122,7 @@ public:
   virtual void VisitDeclaration(Declaration* init) {}
   virtual void VisitIfStmt(IfStmt* ifStmt) {}
   virtual void VisitJumpStmt(JumpStmt* jumpStmt) {}
+  virtual void VisitSwitchStmt(SwitchStmt* switchStmt) {}
   virtual void VisitReturnStmt(ReturnStmt* returnStmt) {}
   virtual void VisitLabelStmt(LabelStmt* labelStmt) {}
   virtual void VisitEmptyStmt(EmptyStmt* emptyStmt) {}
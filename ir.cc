@@ -0,0 +1,357 @@
+#include "ir.h"
+
+#include <cassert>
+#include <cctype>
+#include <cstring>
+
+#include <unordered_map>
+#include <unordered_set>
+
+
+Operand Operand::NewReg(const std::string& reg)
+{
+  Operand operand;
+  operand.kind_ = REG;
+  operand.reg_ = reg;
+  return operand;
+}
+
+
+Operand Operand::NewImm(const std::string& val)
+{
+  Operand operand;
+  operand.kind_ = IMM;
+  operand.disp_ = val;
+  return operand;
+}
+
+
+// The label not jumped to is the absolute address
+Operand Operand::NewMem(const std::string& addr)
+{
+  assert(addr[0] != '%' && addr[0] != '$');
+  Operand operand;
+  operand.kind_ = MEM;
+  auto paren = addr.find('(');
+  operand.disp_ = addr.substr(0, paren);
+  if (paren != std::string::npos) {
+    assert(addr[paren + 1] == '%' && addr.back() == ')');
+    operand.reg_ = addr.substr(paren + 2, addr.size() - paren - 3);
+  }
+  return operand;
+}
+
+
+Operand Operand::NewLabel(const std::string& label)
+{
+  Operand operand;
+  operand.kind_ = LABEL;
+  operand.disp_ = label;
+  return operand;
+}
+
+
+static const std::unordered_map<std::string,
+    std::pair<std::string, int>>& SubRegs()
+{
+  static const std::unordered_map<std::string,
+      std::pair<std::string, int>> subRegs {
+    {"al", {"rax", 1}}, {"ax", {"rax", 2}}, {"eax", {"rax", 4}},
+    {"bl", {"rbx", 1}}, {"bx", {"rbx", 2}}, {"ebx", {"rbx", 4}},
+    {"cl", {"rcx", 1}}, {"cx", {"rcx", 2}}, {"ecx", {"rcx", 4}},
+    {"dl", {"rdx", 1}}, {"dx", {"rdx", 2}}, {"edx", {"rdx", 4}},
+    {"sil", {"rsi", 1}}, {"si", {"rsi", 2}}, {"esi", {"rsi", 4}},
+    {"dil", {"rdi", 1}}, {"di", {"rdi", 2}}, {"edi", {"rdi", 4}},
+  };
+  return subRegs;
+}
+
+
+std::string Operand::Reg() const
+{
+  if (kind_ != REG)
+    return kind_ == MEM ? reg_: "";
+  auto iter = SubRegs().find(reg_);
+  if (iter != SubRegs().end())
+    return iter->second.first;
+  // The 'b', 'w', 'd' parts of r8 - r15
+  if (reg_[0] == 'r' && isdigit(reg_[1]) && !isdigit(reg_.back()))
+    return reg_.substr(0, reg_.size() - 1);
+  return reg_;
+}
+
+
+int Operand::Width() const
+{
+  assert(kind_ == REG);
+  auto iter = SubRegs().find(reg_);
+  if (iter != SubRegs().end())
+    return iter->second.second;
+  if (reg_[0] == 'x')
+    return 16;
+  if (reg_[0] == 'r' && isdigit(reg_[1])) {
+    switch (reg_.back()) {
+    case 'b': return 1;
+    case 'w': return 2;
+    case 'd': return 4;
+    }
+  }
+  return 8;
+}
+
+
+int Operand::RegIndex() const
+{
+  static const std::unordered_map<std::string, int> indices {
+    {"rax", 0}, {"rcx", 1}, {"rdx", 2}, {"rbx", 3},
+    {"rsp", 4}, {"rbp", 5}, {"rsi", 6}, {"rdi", 7},
+    {"r8", 8}, {"r9", 9}, {"r10", 10}, {"r11", 11},
+    {"r12", 12}, {"r13", 13}, {"r14", 14}, {"r15", 15},
+  };
+  auto reg = Reg();
+  if (reg.empty() || reg == "rip")
+    return -1;
+  if (reg[0] == 'x')
+    return 16 + std::stoi(reg.substr(3));
+  auto iter = indices.find(reg);
+  assert(iter != indices.end());
+  return iter->second;
+}
+
+
+std::string Operand::Repr() const
+{
+  std::string repr = indirect_ ? "*": "";
+  switch (kind_) {
+  case REG: return repr + "%" + reg_;
+  case IMM: return repr + "$" + disp_;
+  case MEM:
+    if (reg_.empty())
+      return repr + disp_;
+    return repr + disp_ + "(%" + reg_ + ")";
+  case LABEL: return repr + disp_;
+  }
+  return repr; // Make compiler happy
+}
+
+
+static RegSet Bit(int index)
+{
+  return index < 0 ? 0: RegSet(1) << index;
+}
+
+
+static RegSet Regs(std::initializer_list<int> indices)
+{
+  RegSet regs = 0;
+  for (auto index: indices)
+    regs |= Bit(index);
+  return regs;
+}
+
+
+enum {
+  RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+  R8, R9, R10, R11, R12, R13, R14, R15, XMM0,
+};
+
+static const RegSet XMM_REGS = RegSet(0xffff) << XMM0;
+
+
+std::string Inst::IntOp() const
+{
+  static const std::unordered_set<std::string> ops {
+    "add", "sub", "and", "or", "xor", "imul", "mul", "idiv", "div",
+    "sal", "sar", "shr", "shl", "neg", "not", "cmp", "test",
+  };
+  if (ops.count(op_))
+    return op_;
+  auto base = op_.substr(0, op_.size() - 1);
+  if (ops.count(base) && strchr("bwlq", op_.back()))
+    return base;
+  return "";
+}
+
+
+void Inst::DefUse(RegSet& defs, RegSet& uses) const
+{
+  defs = uses = 0;
+  for (const auto& operand: operands_) {
+    if (operand.kind_ == Operand::MEM)
+      uses |= Bit(operand.RegIndex());
+  }
+  auto n = operands_.size();
+  auto src = n ? Bit(operands_[0].RegIndex()): 0;
+  const Operand* des = n ? &operands_[n - 1]: nullptr;
+  auto desReg = des && des->kind_ == Operand::REG;
+  auto desBit = desReg ? Bit(des->RegIndex()): 0;
+  // Writing the low 1 or 2 bytes and the low part of xmm registers
+  // keeps the rest of the register
+  auto partial = desReg && (des->Width() < 4 || des->Width() == 16);
+
+  auto intOp = IntOp();
+  if (IsCall()) {
+    uses = src | Regs({RAX, RCX, RDX, RSI, RDI, R8, R9, RSP})
+         | (RegSet(0xff) << XMM0);
+    defs = Regs({RAX, RCX, RDX, RSI, RDI, R8, R9, R10, R11, REG_FLAGS})
+         | XMM_REGS;
+  } else if (IsRet()) {
+    uses = Regs({RAX, RDX, RBX, RSP, RBP, R12, R13, R14, R15, XMM0})
+         | Bit(XMM0 + 1);
+    defs = Bit(RSP);
+  } else if (IsJump()) {
+    uses |= src;
+  } else if (IsCondJump()) {
+    uses = Bit(REG_FLAGS);
+  } else if (IsRep()) {
+    // 'rep movsb' and 'rep stosq'
+    auto movs = op_ == "rep movsb";
+    uses = Regs({RCX, RDI}) | Bit(movs ? RSI: RAX);
+    defs = Regs({RCX, RDI}) | (movs ? Bit(RSI): 0);
+  } else if (op_ == "leaveq") {
+    uses = Bit(RBP);
+    defs = Regs({RSP, RBP});
+  } else if (op_ == "pushq") {
+    uses |= src | Bit(RSP);
+    defs = Bit(RSP);
+  } else if (op_ == "popq") {
+    uses |= Bit(RSP);
+    defs = desBit | Bit(RSP);
+  } else if (op_ == "cltq") {
+    uses = defs = Bit(RAX);
+  } else if (op_ == "cltd" || op_ == "cqto") {
+    uses = Bit(RAX);
+    defs = Bit(RDX);
+  } else if (op_.compare(0, 3, "set") == 0) {
+    uses |= Bit(REG_FLAGS) | desBit;
+    defs = desBit;
+  } else if (intOp == "mul" || (intOp == "imul" && n == 1)
+             || intOp == "div" || intOp == "idiv") {
+    // The dividend is 'rdx:rax'
+    uses |= src | Bit(RAX) | (intOp.back() == 'v' ? Bit(RDX): 0);
+    defs = Regs({RAX, RDX, REG_FLAGS});
+  } else if (intOp == "cmp" || intOp == "test"
+             || op_.compare(0, 5, "ucomi") == 0) {
+    uses |= src | desBit;
+    defs = Bit(REG_FLAGS);
+  } else if (intOp.size()) {
+    // 'not' is the only one keeps the flags
+    uses |= src | desBit;
+    defs = desBit | (intOp == "not" ? 0: Bit(REG_FLAGS));
+  } else if (op_ == "mov" || op_.compare(0, 3, "mov") == 0
+             || op_.compare(0, 3, "lea") == 0
+             || op_.compare(0, 3, "cvt") == 0) {
+    if (op_.compare(0, 3, "lea") != 0)
+      uses |= n == 2 && operands_[0].kind_ == Operand::REG ? src: 0;
+    uses |= partial ? desBit: 0;
+    defs = desBit;
+  } else if (op_ == "pxor" || (op_.size() > 2
+             && (op_.compare(op_.size() - 2, 2, "sd") == 0
+             || op_.compare(op_.size() - 2, 2, "ss") == 0))) {
+    // The arithmetic of floats
+    uses |= src | desBit;
+    defs = desBit;
+  } else {
+    uses = defs = ALL_REGS;
+  }
+}
+
+
+bool Inst::HasSideEffect() const
+{
+  RegSet defs, uses;
+  DefUse(defs, uses);
+  if (defs == ALL_REGS || defs & Regs({RSP, RBP}) || IsCall()
+      || IsTerminator())
+    return true;
+  // 'rep movsb' and 'rep stosq' write the memory at '%rdi'
+  if (IsRep())
+    return true;
+  auto intOp = IntOp();
+  if (intOp == "div" || intOp == "idiv")
+    return true;
+  // Loads are kept as the memory might be volatile
+  if (op_.compare(0, 3, "lea") == 0)
+    return false;
+  for (const auto& operand: operands_) {
+    if (operand.kind_ == Operand::MEM)
+      return true;
+  }
+  return false;
+}
+
+
+std::string Inst::Repr() const
+{
+  auto repr = op_;
+  for (size_t i = 0; i < operands_.size(); ++i)
+    repr += (i == 0 ? "\t": ", ") + operands_[i].Repr();
+  return repr;
+}
+
+
+void IRFunc::Append(const Inst& inst)
+{
+  const auto& insts = blocks_.back().insts_;
+  if (insts.size() && insts.back().IsTerminator())
+    blocks_.emplace_back("");
+  blocks_.back().insts_.push_back(inst);
+}
+
+
+void IRFunc::AppendLabel(const std::string& label)
+{
+  auto& last = blocks_.back();
+  if (last.label_.empty() && last.insts_.empty())
+    last.label_ = label;
+  else
+    blocks_.emplace_back(label);
+}
+
+
+void IRFunc::BuildCFG()
+{
+  std::unordered_map<std::string, BasicBlock*> labels;
+  for (auto& block: blocks_) {
+    block.succs_.clear();
+    block.preds_.clear();
+    if (block.label_.size())
+      labels[block.label_] = &block;
+  }
+
+  for (auto iter = blocks_.begin(); iter != blocks_.end(); ++iter) {
+    auto next = std::next(iter);
+    const Inst* last = iter->insts_.size() ? &iter->insts_.back(): nullptr;
+    if (last && last->IsJump() && last->operands_[0].indirect_) {
+      for (const auto& label: indirectTargets_) {
+        auto block = labels.find(label);
+        if (block != labels.end())
+          iter->succs_.push_back(block->second);
+      }
+    } else if (last && (last->IsJump() || last->IsCondJump())) {
+      const auto& target = last->operands_[0];
+      auto block = labels.find(target.disp_);
+      if (target.kind_ == Operand::LABEL && block != labels.end())
+        iter->succs_.push_back(block->second);
+    }
+    bool fallThrough = !last || !(last->IsJump() || last->IsRet());
+    if (fallThrough && next != blocks_.end())
+      iter->succs_.push_back(&*next);
+  }
+
+  for (auto& block: blocks_) {
+    for (auto succ: block.succs_)
+      succ->preds_.push_back(&block);
+  }
+}
+
+
+void IRFunc::Print(FILE* fp) const
+{
+  for (const auto& block: blocks_) {
+    if (block.label_.size())
+      fprintf(fp, "%s:\n", block.label_.c_str());
+    for (const auto& inst: block.insts_)
+      fprintf(fp, "\t%s\n", inst.Repr().c_str());
+  }
+}
@@ -0,0 +1,141 @@
+#ifndef _WGTCC_IR_H_
+#define _WGTCC_IR_H_
+
+#include <cstdint>
+#include <cstdio>
+
+#include <list>
+#include <string>
+#include <vector>
+
+
+// Bit set of the registers: the 16 GPRs in the order of encoding,
+// 'xmm0' - 'xmm15' and the flags
+typedef uint64_t RegSet;
+
+enum {
+  REG_FLAGS = 32,
+  REG_NUM,
+};
+
+const RegSet ALL_REGS = (RegSet(1) << REG_NUM) - 1;
+
+
+/*
+ * The IR of a function being generated: x86-64 instructions
+ * in basic blocks linked as the control flow graph.
+ * Code generator builds it instead of emitting text, thus the
+ * function could be analysed and rewritten before it is printed.
+ */
+struct Operand
+{
+  enum Kind {
+    REG,    // %rax
+    IMM,    // $1
+    MEM,    // -8(%rbp), .LC0(%rip), .LC0
+    LABEL,  // The target of jump and call
+  };
+
+  // 'reg' and 'val' are without '%' and '$'
+  static Operand NewReg(const std::string& reg);
+  static Operand NewImm(const std::string& val);
+  // 'addr' is the address in AT&T syntax, e.g. '-8(%rbp)'
+  static Operand NewMem(const std::string& addr);
+  static Operand NewLabel(const std::string& label);
+
+  // The 8 bytes register containing the register operand or
+  // the base register of the memory operand, empty if none
+  std::string Reg() const;
+  // The bytes of register operand, 16 for xmm registers
+  int Width() const;
+  // The index of Reg() in RegSet, -1 for none and '%rip'
+  int RegIndex() const;
+  bool IsReg(const std::string& reg) const {
+    return kind_ == REG && reg_ == reg;
+  }
+  std::string Repr() const;
+
+  Kind kind_;
+  // The register or the base register
+  std::string reg_;
+  // The immediate value, the displacement or the label
+  std::string disp_;
+  // '*' of indirect jump and call
+  bool indirect_ {false};
+};
+
+
+struct Inst
+{
+  Inst() {}
+  explicit Inst(const std::string& op): op_(op) {}
+
+  Inst& Add(const Operand& operand) {
+    operands_.push_back(operand);
+    return *this;
+  }
+
+  bool IsJump() const { return op_ == "jmp"; }
+  bool IsCondJump() const { return op_[0] == 'j' && op_ != "jmp"; }
+  bool IsCall() const { return op_ == "call"; }
+  bool IsRet() const { return op_ == "retq"; }
+  // The string instruction with the prefix 'rep', e.g. 'rep movsb'
+  bool IsRep() const { return op_.compare(0, 4, "rep ") == 0; }
+  // Ends the basic block
+  bool IsTerminator() const {
+    return IsJump() || IsCondJump() || IsRet();
+  }
+  // The integer operation without the size suffix, e.g. 'add' of
+  // 'addl', empty if it is not
+  std::string IntOp() const;
+  // The registers read and written, the flags included.
+  // Unknown instructions read and write all the registers.
+  void DefUse(RegSet& defs, RegSet& uses) const;
+  // Writes the memory, controls the flow or may trap
+  bool HasSideEffect() const;
+  std::string Repr() const;
+
+  // The mnemonic, the prefix included
+  std::string op_;
+  // In the order of AT&T syntax, the destination is the last
+  std::vector<Operand> operands_;
+};
+
+
+struct BasicBlock
+{
+  explicit BasicBlock(const std::string& label): label_(label) {}
+
+  // Empty if the block is only reached by falling through
+  std::string label_;
+  std::list<Inst> insts_;
+  std::vector<BasicBlock*> succs_;
+  std::vector<BasicBlock*> preds_;
+};
+
+
+class IRFunc
+{
+public:
+  IRFunc() { blocks_.emplace_back(""); }
+
+  void Append(const Inst& inst);
+  void AppendLabel(const std::string& label);
+  // The label may be jumped to by the indirect jumps of the function
+  void AddIndirectTarget(const std::string& label) {
+    indirectTargets_.push_back(label);
+  }
+
+  BasicBlock* Entry() { return &blocks_.front(); }
+  std::list<BasicBlock>& Blocks() { return blocks_; }
+
+  // Link the blocks by their terminators and falling through
+  void BuildCFG();
+  void Print(FILE* fp) const;
+
+private:
+  std::list<BasicBlock> blocks_;
+  std::vector<std::string> indirectTargets_;
+};
+
+#endif
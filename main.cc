@@ -3,14 +3,21 @@
 #include "error.h"
 #include "scanner.h"
 #include "parser.h"
+#include "pass.h"
+#include "serializer.h"
 
+#include <cctype>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 
+#include <algorithm>
+#include <functional>
 #include <iostream>
 #include <string>
 
 #include <fcntl.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 
@@ -24,18 +31,106 @@ void Usage()
   printf("Usage: wgtcc [options] file...\n"
        "Options: \n"
        "  --help    show this information\n"
+       "  --mem-report\n"
+       "            report the memory allocated by the front end\n"
        "  -D        define object like macro\n"
+       "  -E        preprocess only\n"
+       "  -fcache-dir=DIR\n"
+       "            reuse the AST and the assembly of unchanged\n"
+       "            translation units, and the code of unchanged functions\n"
+       "  -flazy-inline\n"
+       "            parse static inline functions of headers only if used\n"
+       "  -fmax-errors=N\n"
+       "            stop after N errors, 0 for no limit (default 20)\n"
+       "  -ftime-report\n"
+       "            report the time of each phase and pass\n"
        "  -I        add search path\n"
-       "  -o        specify output filename\n");
+       "  -j        number of threads generating functions\n"
+       "  -M        output the make rule of header dependencies only\n"
+       "  -MD       also write the make rule to the dependency file\n"
+       "  -MF       specify the dependency filename\n"
+       "  -o        specify output filename\n"
+       "  -O        optimization level 0, 1 or 2 (default 0)\n"
+       "  -P        inhibit line markers of '-E'\n");
   
   exit(0);
 }
 
 
+static bool CopyFile(const std::string& from, const std::string& to)
+{
+  auto src = fopen(from.c_str(), "rb");
+  if (src == nullptr)
+    return false;
+  auto des = fopen(to.c_str(), "wb");
+  if (des == nullptr) {
+    fclose(src);
+    return false;
+  }
+
+  char buf[1 << 16];
+  size_t len;
+  bool ok = true;
+  while ((len = fread(buf, 1, sizeof(buf), src)) > 0)
+    ok = ok && fwrite(buf, 1, len, des) == len;
+  fclose(src);
+  return fclose(des) == 0 && ok;
+}
+
+
+// The build of wgtcc is told by the size and modification time of its
+// binary, '__DATE__' of this file is stale if only the others are rebuilt
+static bool CompilerKey(std::string& key)
+{
+  struct stat st;
+  if (stat("/proc/self/exe", &st) != 0 && stat(program.c_str(), &st) != 0)
+    return false;
+  key += std::to_string(st.st_size) + " "
+      + std::to_string(st.st_mtim.tv_sec) + "."
+      + std::to_string(st.st_mtim.tv_nsec);
+  return true;
+}
+
+
+/*
+ * The cached files of a translation unit are named by the hash of
+ * its preprocessed tokens and 'key', the options affecting them and
+ * the build of wgtcc itself.
+ */
+static std::string CacheFileName(const std::string& dir,
+    const TokenSequence& ts, const std::string& key, const char* suffix)
+{
+  auto hash = ts.Hash(std::hash<std::string>()(key));
+  char name[32];
+  snprintf(name, sizeof(name), "%016lx%s",
+      static_cast<unsigned long>(hash), suffix);
+  return dir + "/" + name;
+}
+
+
+static TranslationUnit* Parse(const TokenSequence& ts)
+{
+  Parser parser(ts);
+  {
+    PassTimer timer("parse");
+    parser.Parse();
+  }
+  return parser.Unit();
+}
+
+
 int main(int argc, char* argv[])
 {
   bool printPreProcessed = false;
   bool printAssembly = false;
+  bool preprocessOnly = false;
+  bool lineMarkers = true;
+  bool depsOnly = false;
+  bool genDeps = false;
+  bool memReport = false;
+  bool timeReport = false;
+  std::string depFileName;
+  std::string cacheDir;
 
   if (argc < 2) {
     Usage();
@@ -73,13 +168,61 @@ int main(int argc, char* argv[])
       }
       cpp.AddMacro(macro, replace); 
     } break;
+    case 'j': {
+      auto jobs = argv[i][2] ? &argv[i][2]: (i + 1 < argc ? argv[++i]: "");
+      if (atoi(jobs) <= 0)
+        Error("invalid number of jobs '%s'", jobs);
+      Generator::SetJobs(atoi(jobs));
+    } break;
+    case 'O':
+      // '-O' is '-O1', levels above 2 are '-O2'
+      if (argv[i][2] == '\0')
+        PassManager::SetLevel(1);
+      else if (isdigit(argv[i][2]) && argv[i][3] == '\0')
+        PassManager::SetLevel(std::min(argv[i][2] - '0', 2));
+      else
+        Error("unrecognized command line option '%s'", argv[i]);
+      break;
+    case 'f':
+      if (strncmp(argv[i], "-fmax-errors=", 13) == 0)
+        SetErrorLimit(atoi(&argv[i][13]));
+      else if (strncmp(argv[i], "-fcache-dir=", 12) == 0)
+        cacheDir = &argv[i][12];
+      else if (strcmp(argv[i], "-ftime-report") == 0)
+        timeReport = true;
+      else if (strcmp(argv[i], "-flazy-inline") == 0)
+        Parser::SetLazyInline(true);
+      else
+        Error("unrecognized command line option '%s'", argv[i]);
+      break;
+    case 'E':
+      if (argv[i][2])
+        Error("unrecognized command line option '%s'", argv[i]);
+      preprocessOnly = true;
+      break;
+    case 'M':
+      switch (argv[i][2]) {
+      case '\0': depsOnly = true; break;
+      case 'D': genDeps = true; break;
+      case 'F':
+        if (i + 1 == argc)
+          Usage();
+        depFileName = argv[++i];
+        break;
+      default: Error("unrecognized command line option '%s'", argv[i]);
+      } break;
     case 'P':
       switch (argv[i][2]) {
+      case '\0': lineMarkers = false; break;
       case 'P': printPreProcessed = true; break;
       case 'A': printAssembly = true; break;
       default: Error("unrecognized command line option '%s'", argv[i]);
       } break;
     case '-': // --
+      if (strcmp(argv[i], "--mem-report") == 0) {
+        memReport = true;
+        break;
+      }
       switch (argv[i][2]) {
       case 'h': Usage(); break;
       default:
@@ -112,35 +255,131 @@ int main(int argc, char* argv[])
     outFileName = tmpOutFileName;
   cpp.AddSearchPath(dir);
 
+  if (depsOnly) {
+    // The target is the object file, the same as gcc
+    auto target = inFileName.substr(pos + 1);
+    target.back() = 'o';
+    cpp.SetDirectivesOnly(true);
+    TokenSequence ts;
+    cpp.Process(ts);
+
+    if (depFileName.empty())
+      depFileName = tmpOutFileName;
+    auto depFile = depFileName.empty() ? stdout: fopen(depFileName.c_str(), "w");
+    if (depFile == nullptr)
+      Error("%s: cannot open file", depFileName.c_str());
+    cpp.WriteDeps(depFile, target);
+    if (depFile != stdout)
+      fclose(depFile);
+    return 0;
+  }
+
   TokenSequence ts;
-  cpp.Process(ts);
+  {
+    PassTimer timer("preprocess");
+    cpp.Process(ts);
+  }
+
+  if (genDeps) {
+    auto target = outFileName;
+    target.back() = 'o';
+    if (depFileName.empty()) {
+      depFileName = outFileName;
+      depFileName.back() = 'd';
+    }
+    auto depFile = fopen(depFileName.c_str(), "w");
+    if (depFile == nullptr)
+      Error("%s: cannot open file", depFileName.c_str());
+    cpp.WriteDeps(depFile, target);
+    fclose(depFile);
+  }
+
+  if (preprocessOnly) {
+    auto outFile = tmpOutFileName.empty() ?
+        stdout: fopen(tmpOutFileName.c_str(), "w");
+    if (outFile == nullptr)
+      Error("%s: cannot open file", tmpOutFileName.c_str());
+    ts.Write(outFile, lineMarkers);
+    if (outFile != stdout)
+      fclose(outFile);
+    return 0;
+  }
 
   if (printPreProcessed) {
     std::cout << std::endl << "###### Preprocessed ######" << std::endl;
     ts.Print();
   }
 
-  // Parsing
-  Parser parser(ts);
-  parser.Parse();
+  // The AST is shared by the levels, the assembly and the code of
+  // functions are not. Nothing is cached if the build is unknown.
+  std::string astFileName;
+  std::string asmFileName;
+  std::string build;
+  if (!cacheDir.empty() && CompilerKey(build)) {
+    auto level = " -O" + std::to_string(PassManager::Level());
+    Generator::SetCache(cacheDir, build + level);
+    auto key = inFileName + " " + build;
+    if (Parser::LazyInline())
+      key += " -flazy-inline";
+    astFileName = CacheFileName(cacheDir, ts, key, ".ast");
+    asmFileName = CacheFileName(cacheDir, ts, key + level, ".s");
+  }
+
+  if (asmFileName.empty() || !CopyFile(asmFileName, outFileName)) {
+    TranslationUnit* unit = nullptr;
+    if (!astFileName.empty()) {
+      PassTimer timer("load");
+      unit = Serializer::Load(astFileName);
+    }
+    if (unit == nullptr) {
+      unit = Parse(ts);
+      if (ErrorCount())
+        return 1;
+      // Written aside and renamed, concurrent compilations may read it
+      if (!astFileName.empty()) {
+        PassTimer timer("save");
+        auto tmpFileName = astFileName + "." + std::to_string(getpid());
+        if (Serializer::Save(unit, tmpFileName))
+          rename(tmpFileName.c_str(), astFileName.c_str());
+        else
+          remove(tmpFileName.c_str());
+      }
+    }
   
-  // CodeGen
-  auto outFile = fopen(outFileName.c_str(), "w");
-  assert(outFile);
+    // CodeGen
+    auto outFile = fopen(outFileName.c_str(), "w");
+    assert(outFile);
+
+    Generator::SetInOut(unit, outFile);
+    Generator g;
+    {
+      PassTimer timer("codegen");
+      g.Gen();
+    }
 
-  Generator::SetInOut(&parser, outFile);
-  Generator g;
-  g.Gen();
+    //clock_t end = clock(); 
 
-  //clock_t end = clock(); 
+    fclose(outFile);
 
-  fclose(outFile);
+    if (!asmFileName.empty()) {
+      auto tmpFileName = asmFileName + "." + std::to_string(getpid());
+      if (CopyFile(outFileName, tmpFileName))
+        rename(tmpFileName.c_str(), asmFileName.c_str());
+    }
+  }
 
   if (printAssembly) {
     auto str = ReadFile(outFileName);
     std::cout << *str << std::endl;
   }
   
+  if (timeReport)
+    PassManager::ReportTime(stderr);
+  if (memReport)
+    Arena::Report(stderr);
+  // Done with the front end, not to hold the memory while assembling
+  Arena::Release();
+
   std::string sys = "gcc -std=c11 -Wall " + outFileName;
   auto ret = system(sys.c_str());
 
@@ -0,0 +1,116 @@
+#include "mem_pool.h"
+
+#include <cstdlib>
+
+#include <algorithm>
+
+#include <cxxabi.h>
+#include <sys/resource.h>
+
+
+std::vector<char*> Arena::chunks_;
+std::vector<Arena::Counter*> Arena::counters_;
+size_t Arena::reserved_ = 0;
+size_t Arena::peakReserved_ = 0;
+std::mutex Arena::mutex_;
+thread_local char* Arena::cur_ = nullptr;
+thread_local char* Arena::end_ = nullptr;
+
+
+void* Arena::AllocSlow(size_t size, size_t align)
+{
+  // Large objects get a chunk of their own,
+  // thus the rest of the current chunk is not wasted
+  bool large = size > chunkSize_ / 4;
+  auto len = large ? size + align: chunkSize_;
+  auto chunk = static_cast<char*>(malloc(len));
+  if (chunk == nullptr)
+    abort();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    chunks_.push_back(chunk);
+    reserved_ += len;
+    peakReserved_ = std::max(peakReserved_, reserved_);
+  }
+
+  auto p = reinterpret_cast<size_t>(chunk);
+  p = (p + align - 1) & ~(align - 1);
+  if (!large) {
+    cur_ = reinterpret_cast<char*>(p + size);
+    end_ = chunk + len;
+  }
+  return reinterpret_cast<void*>(p);
+}
+
+
+Arena::Counter* Arena::NewCounter(const std::type_info& type)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  counters_.push_back(new Counter(type));
+  return counters_.back();
+}
+
+
+void Arena::Release()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto chunk: chunks_)
+    free(chunk);
+  chunks_.clear();
+  reserved_ = 0;
+  cur_ = nullptr;
+  end_ = nullptr;
+
+  for (auto counter: counters_) {
+    counter->peakBytes_ = std::max(counter->peakBytes_,
+                                   counter->bytes_.load());
+    counter->objects_ = 0;
+    counter->bytes_ = 0;
+  }
+}
+
+
+Arena::Stat Arena::GetStat()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  Stat stat {chunks_.size(), reserved_, peakReserved_, {}};
+  for (auto counter: counters_) {
+    auto name = abi::__cxa_demangle(counter->type_.name(),
+                                    nullptr, nullptr, nullptr);
+    KindStat kind {name ? name: counter->type_.name(),
+                   counter->objects_.load(), counter->bytes_.load(),
+                   counter->peakBytes_};
+    kind.peakBytes_ = std::max(kind.peakBytes_, kind.bytes_);
+    stat.kinds_.push_back(kind);
+    free(name);
+  }
+  std::sort(stat.kinds_.begin(), stat.kinds_.end(),
+      [](const KindStat& lhs, const KindStat& rhs) {
+    return lhs.peakBytes_ > rhs.peakBytes_;
+  });
+  return stat;
+}
+
+
+void Arena::Report(FILE* fp)
+{
+  auto stat = GetStat();
+  size_t bytes = 0;
+  for (const auto& kind: stat.kinds_)
+    bytes += kind.bytes_;
+
+  fprintf(fp, "arena: %zu chunks, %zu KiB reserved, %zu KiB used, "
+          "peak %zu KiB reserved\n", stat.chunks_, stat.reserved_ >> 10,
+          bytes >> 10, stat.peakReserved_ >> 10);
+  fprintf(fp, "%-40s %10s %12s %12s\n", "kind", "objects", "bytes",
+          "peak bytes");
+  for (const auto& kind: stat.kinds_) {
+    fprintf(fp, "%-40s %10zu %12zu %12zu\n", kind.kind_.c_str(),
+            kind.objects_, kind.bytes_, kind.peakBytes_);
+  }
+
+  // Including the memory out of the arena
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0)
+    fprintf(fp, "max resident set: %ld KiB\n", usage.ru_maxrss);
+}
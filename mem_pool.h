@@ -1,118 +1,109 @@
 #ifndef _WGTCC_MEM_POOL_H_
 #define _WGTCC_MEM_POOL_H_
 
+#include <atomic>
 #include <cstddef>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <typeinfo>
 #include <vector>
 
 
-class MemPool
+/*
+ * The arena of a compilation: tokens, AST nodes, types and
+ * token list nodes are allocated by bumping a pointer in large
+ * chunks. Nothing is freed individually, all the chunks are
+ * released at once when the compilation is done.
+ * Each thread allocates from its own chunk.
+ * The objects and bytes allocated are counted per kind (type).
+ */
+class Arena
 {
 public:
-  MemPool(): allocated_(0) {}
-  
-  virtual ~MemPool() {}
-  
-  MemPool(const MemPool& other) = delete;
-  
-  MemPool& operator=(const MemPool& other) = delete;
-
-  virtual void* Alloc() = 0;
-  
-  virtual void Free(void* addr) = 0;
-  
-  virtual void Clear() = 0;
-
-protected:
-  size_t allocated_;
-};
+  struct KindStat {
+    std::string kind_;
+    size_t objects_;
+    size_t bytes_;
+    // The most bytes ever live, the arena may have been released
+    size_t peakBytes_;
+  };
 
+  struct Stat {
+    size_t chunks_;
+    size_t reserved_;
+    size_t peakReserved_;
+    std::vector<KindStat> kinds_;
+  };
 
-template <class T>
-class MemPoolImp: public MemPool
-{
-public:
-  MemPoolImp() : root_(nullptr) {}
-  
-  virtual ~MemPoolImp() {}
+  static void* Alloc(size_t size, size_t align=alignof(std::max_align_t)) {
+    auto p = reinterpret_cast<size_t>(cur_);
+    p = (p + align - 1) & ~(align - 1);
+    if (cur_ == nullptr || p + size > reinterpret_cast<size_t>(end_))
+      return AllocSlow(size, align);
+    cur_ = reinterpret_cast<char*>(p + size);
+    return reinterpret_cast<void*>(p);
+  }
+
+  template <class T>
+  static void* Alloc(size_t n=1) {
+    static auto counter = NewCounter(typeid(T));
+    counter->objects_.fetch_add(n, std::memory_order_relaxed);
+    counter->bytes_.fetch_add(n * sizeof(T), std::memory_order_relaxed);
+    return Alloc(n * sizeof(T), alignof(T));
+  }
 
-  MemPoolImp(const MemPool& other) = delete;
-  
-  MemPoolImp& operator=(MemPool& other) = delete;
+  // Objects in the arena must not be used afterwards
+  static void Release();
 
-  virtual void* Alloc();
-  
-  virtual void Free(void* addr);
-  
-  virtual void Clear();
+  static Stat GetStat();
+  static void Report(FILE* fp);
 
 private:
-  enum {
-    COUNT = (4 * 1024) / sizeof(T)
-  };
-  
-  union Chunk {
-    Chunk* _next;
-    char _mem[sizeof(T)];
-  };
-  
-  struct Block {
-    Block() {
-      for (size_t i = 0; i < COUNT - 1; i++)
-        chunks_[i]._next = &chunks_[i+1];
-      chunks_[COUNT-1]._next = nullptr;
-    }
-    Chunk chunks_[COUNT];
+  struct Counter {
+    explicit Counter(const std::type_info& type): type_(type) {}
+    const std::type_info& type_;
+    std::atomic<size_t> objects_ {0};
+    std::atomic<size_t> bytes_ {0};
+    size_t peakBytes_ {0};
   };
 
-  std::vector<Block*> blocks_;
-  Chunk* root_;
-};
+  static const size_t chunkSize_ = 1 << 20;
 
+  static void* AllocSlow(size_t size, size_t align);
+  static Counter* NewCounter(const std::type_info& type);
 
-template <class T>
-void* MemPoolImp<T>::Alloc()
-{
-  if (nullptr == root_) { //空间不够，需要分配空间
-    auto block = new Block();
-    root_ = block->chunks_;
-    //如果blocks实现为std::list, 那么push_back实际的overhead更大
-    //这也表明，即使我们不需要随机访问功能(那么std::vector的拷贝是一种overhead)，
-    //仍然倾向于使用std::vector，
-    //当然std::vector的指数级capacity增长会造成内存浪费。
-    blocks_.push_back(block);
-  }
-  
-  auto ret = root_;
-  root_ = root_->_next;
+  static std::vector<char*> chunks_;
+  static std::vector<Counter*> counters_;
+  static size_t reserved_;
+  static size_t peakReserved_;
+  static std::mutex mutex_;
 
-  ++allocated_;
-  return ret;
-}
+  static thread_local char* cur_;
+  static thread_local char* end_;
+};
 
 
+// For the containers of the front end
 template <class T>
-void MemPoolImp<T>::Free(void* addr)
+class ArenaAllocator
 {
-  if (nullptr == addr) 
-    return;
-
-  auto chunk = static_cast<Chunk*>(addr);
-  chunk->_next = root_;
-  root_ = chunk;
-
-  --allocated_;
-}
+public:
+  typedef T value_type;
 
+  ArenaAllocator() {}
+  template <class U>
+  ArenaAllocator(const ArenaAllocator<U>& other) {}
 
-template <class T>
-void MemPoolImp<T>::Clear()
-{
-  for (auto block: blocks_)
-    delete block;
+  T* allocate(size_t n) {
+    return static_cast<T*>(Arena::Alloc<T>(n));
+  }
+  void deallocate(T* p, size_t n) {}
 
-  blocks_.resize(0);
-  root_ = nullptr;
-  allocated_ = 0;
-}
+  template <class U>
+  bool operator==(const ArenaAllocator<U>& other) const { return true; }
+  template <class U>
+  bool operator!=(const ArenaAllocator<U>& other) const { return false; }
+};
 
 #endif
@@ -16,8 +16,11 @@
 
 using namespace std;
 
+extern std::string inFileName;
+
 FuncType* Parser::vaStartType_ {nullptr};
 FuncType* Parser::vaArgType_ {nullptr};
+bool Parser::lazyInline_ {false};
 
 FuncDef* Parser::EnterFunc(Identifier* ident) {
   //curParamScope_->SetParent(curScope_);
@@ -29,6 +32,7 @@ FuncDef* Parser::EnterFunc(Identifier* ident) {
 
 
 void Parser::ExitFunc() {
+  curFunc_ = nullptr;
   // Resolve 那些待定的jump；
   // 如果有jump无法resolve，也就是有未定义的label，报错；
   for (auto iter = unresolvedJumps_.begin();
@@ -45,14 +49,26 @@ void Parser::ExitFunc() {
   
   unresolvedJumps_.clear();	//清空未定的 jump 动作
   curLabels_.clear();	//清空 label map
+}
+
 
+// Drop the states of the function whose parsing is aborted by an error
+void Parser::AbortFunc()
+{
   curFunc_ = nullptr;
+  unresolvedJumps_.clear();
+  curLabels_.clear();
+  breakDest_ = nullptr;
+  continueDest_ = nullptr;
+  caseLabels_ = nullptr;
+  defaultLabel_ = nullptr;
 }
 
 
 void Parser::EnterBlock(FuncType* funcType)
 {
   curScope_ = new Scope(curScope_, S_BLOCK);      
+  curScope_->Enter();
   if (funcType) {
     // Merge elements in param scope into current block scope
     for (auto param: funcType->Params())
@@ -64,52 +80,182 @@ void Parser::EnterBlock(FuncType* funcType)
 void Parser::Parse()
 {
   DefineBuiltins();
+  SetRecoverable(true);
   ParseTranslationUnit();
+  SetRecoverable(false);
 }
 
 
-void Parser::ParseTranslationUnit()
+// The premature end is reported once, for all the unclosed blocks
+void Parser::CheckPrematureEnd()
 {
-  while (!ts_.Peek()->IsEOF()) {            
-    //curParamScope_ = nullptr;
-    if (ts_.Try(Token::STATIC_ASSERT)) {
-      ParseStaticAssert();
+  if (!ts_.Peek()->IsEOF())
+    return;
+  if (!prematureEnd_) {
+    prematureEnd_ = true;
+    Error(ts_.Peek(), "premature end of input");
+  }
+  throw RecoverableError();
+}
+
+
+void Parser::RestoreScope(Scope* scope)
+{
+  while (curScope_ != scope) {
+    curScope_->Leave();
+    curScope_ = curScope_->Parent();
+  }
+}
+
+
+/*
+ * Skip the tokens of an erroneous statement or declaration:
+ * until the ';' or the block closing it, or before the '}'
+ * closing the enclosing block. At file scope, a stray '}'
+ * is skipped too. 'depth' is the number of blocks already open,
+ * 'begin' is where the statement or declaration begins.
+ */
+void Parser::SkipToBoundary(TokenList::iterator begin,
+    bool fileScope, int depth)
+{
+  // The erroneous parsing may have consumed the ending ';' or '}'
+  if (depth == 0 && ts_.Mark() != begin
+      && (ts_.Prev()->tag_ == ';' || ts_.Prev()->tag_ == '}'))
+    return;
+  for (auto tok = ts_.Peek(); !tok->IsEOF(); tok = ts_.Peek()) {
+    if (tok->tag_ == '}') {
+      if (depth == 0 && !fileScope)
+        return;
+      ts_.Next();
+      if (depth == 0 || --depth == 0)
+        return;
       continue;
     }
-    int storageSpec, funcSpec, align;
-    auto type = ParseDeclSpec(&storageSpec, &funcSpec, &align);
-    auto tokTypePair = ParseDeclarator(type);
-    auto tok = tokTypePair.first;
-    type = tokTypePair.second;
+    ts_.Next();
+    if (tok->tag_ == '{')
+      ++depth;
+    else if (tok->tag_ == ';' && depth == 0)
+      return;
+  }
+}
 
-    if (tok == nullptr) {
-      ts_.Expect(';');
-      continue;
+
+void Parser::ParseTranslationUnit()
+{
+  auto fileScope = curScope_;
+  while (!ts_.Peek()->IsEOF()) {            
+    auto begin = ts_.Mark();
+    try {
+      ParseExtDecl();
+    } catch (const RecoverableError&) {
+      RestoreScope(fileScope);
+      // Skip the rest of the function body, if the error is in it
+      int depth = curFunc_ ? 1: 0;
+      AbortFunc();
+      SkipToBoundary(begin, true, depth);
     }
+  }
+
+  ParseLazyFuncDefs();
+  //externalSymbols_->Print();
+}
+
+
+void Parser::ParseExtDecl()
+{
+  //curParamScope_ = nullptr;
+  if (ts_.Try(Token::STATIC_ASSERT)) {
+    ParseStaticAssert();
+    return;
+  }
+  int storageSpec, funcSpec, align;
+  auto type = ParseDeclSpec(&storageSpec, &funcSpec, &align);
+  auto tokTypePair = ParseDeclarator(type);
+  auto tok = tokTypePair.first;
+  type = tokTypePair.second;
 
-    auto ident = ProcessDeclarator(tok, type, storageSpec, funcSpec, align);
-    type = ident->Type();
+  if (tok == nullptr) {
+    ts_.Expect(';');
+    return;
+  }
 
-    if (tok && type->ToFunc() && ts_.Try('{')) { // Function definition
-      unit_->Add(ParseFuncDef(ident));
-    } else { // Declaration
-      auto decl = ParseInitDeclarator(ident);
+  auto ident = ProcessDeclarator(tok, type, storageSpec, funcSpec, align);
+  type = ident->Type();
+
+  if (tok && type->ToFunc() && ts_.Try('{')) { // Function definition
+    // Bodies of 'static inline' functions from headers are parsed
+    // only when the function is referenced (see ParseLazyFuncDefs)
+    bool lazy = lazyInline_ && (storageSpec & S_STATIC)
+        && (funcSpec & F_INLINE) && tok->loc_.fileName_ != &inFileName
+        && !referredFuncs_.count(tok->str_);
+    auto funcDef = ParseFuncDef(ident, lazy);
+    if (funcDef) unit_->Add(funcDef);
+  } else { // Declaration
+    auto decl = ParseInitDeclarator(ident);
+    if (decl) unit_->Add(decl);
+
+    while (ts_.Try(',')) {
+      auto ident = ParseDirectDeclarator(type, storageSpec, funcSpec, align);
+      decl = ParseInitDeclarator(ident);
       if (decl) unit_->Add(decl);
+    }
+    ts_.Expect(';');
+  }
+}
 
-      while (ts_.Try(',')) {
-        auto ident = ParseDirectDeclarator(type, storageSpec, funcSpec, align);
-        decl = ParseInitDeclarator(ident);
-        if (decl) unit_->Add(decl);
-      }
-      ts_.Expect(';');
+
+void Parser::ParseLazyFuncDefs()
+{
+  auto fileScope = curScope_;
+  // Parsing a body may reference more lazy functions
+  while (!lazyFuncQueue_.empty()) {
+    auto lazyFunc = lazyFuncQueue_.back();
+    lazyFuncQueue_.pop_back();
+
+    curFunc_ = lazyFunc.funcDef_;
+    ts_.ResetTo(lazyFunc.body_);
+    // The body sees the file scope as it was where the body is
+    fileScope->HideAfter(lazyFunc.serial_);
+    auto funcType = curFunc_->Type()->ToFunc();
+    try {
+      curFunc_->SetBody(ParseCompoundStmt(funcType));
+      unit_->Add(curFunc_);
+      ExitFunc();
+    } catch (const RecoverableError&) {
+      RestoreScope(fileScope);
+      AbortFunc();
     }
   }
-  
-  //externalSymbols_->Print();
+  fileScope->ShowAll();
+}
+
+
+void Parser::ReferLazyFunc(const std::string& name)
+{
+  referredFuncs_.insert(name);
+  auto iter = lazyFuncs_.find(name);
+  if (iter == lazyFuncs_.end())
+    return;
+  lazyFuncQueue_.push_back(iter->second);
+  lazyFuncs_.erase(iter);
+}
+
+
+void Parser::SkipFuncBody()
+{
+  for (int depth = 1; depth > 0; ) {
+    auto tok = ts_.Next();
+    if (tok->IsEOF())
+      Error(tok, "premature end of input");
+    else if (tok->tag_ == '{')
+      ++depth;
+    else if (tok->tag_ == '}')
+      --depth;
+  }
 }
 
 
-FuncDef* Parser::ParseFuncDef(Identifier* ident)
+FuncDef* Parser::ParseFuncDef(Identifier* ident, bool lazy)
 {
   auto funcDef = EnterFunc(ident);
 
@@ -124,6 +270,14 @@ FuncDef* Parser::ParseFuncDef(Identifier* ident)
     if (param->Anonymous())
       Error(param, "param name omitted");
   }
+  if (lazy) {
+    // '__func__' in the skipped body still refers to this function
+    auto mark = ts_.Mark();
+    SkipFuncBody();
+    lazyFuncs_[funcDef->Name()] = {funcDef, mark, Scope::Serial()};
+    ExitFunc();
+    return nullptr;
+  }
   funcDef->SetBody(ParseCompoundStmt(funcType));
   ExitFunc();
   
@@ -166,7 +320,11 @@ Expr* Parser::ParsePrimaryExpr()
 
   if (tok->IsIdentifier()) {
     auto ident = curScope_->Find(tok);
-    if (ident) return ident;
+    if (ident) {
+      if (lazyInline_ && ident->Type()->ToFunc())
+        ReferLazyFunc(tok->str_);
+      return ident;
+    }
     if (IsBuiltin(tok->str_)) return GetBuiltin(tok);
     Error(tok, "undefined symbol '%s'", tok->str_.c_str());
   } else if (tok->IsConstant()) {
@@ -1334,63 +1492,65 @@ StructType* Parser::ParseStructUnionDecl(StructType* type)
   
   auto scopeBackup = curScope_;
   curScope_ = type->MemberMap(); // Internal symbol lookup rely on curScope_
+  curScope_->Enter();
 
   while (!ts_.Try('}')) {
-    if (ts_.Empty()) {
-      Error(ts_.Peek(), "premature end of input");
-    }
-    
-    if(ts_.Try(Token::STATIC_ASSERT)) {
-      ParseStaticAssert();
-      continue;
-    }
+    CheckPrematureEnd();
 
-    // 解析type specifier/qualifier, 不接受storage等
-    int align;
-    auto memberType = ParseDeclSpec(nullptr, nullptr, &align);
-    do {
-      auto tokTypePair = ParseDeclarator(memberType);
-      auto tok = tokTypePair.first;
-      memberType = tokTypePair.second;
-      
-      if (ts_.Try(':')) {
-        ParseBitField(type, tok, memberType);
-        // TODO(wgtdkp): continue; ?
+    auto begin = ts_.Mark();
+    try {
+      if(ts_.Try(Token::STATIC_ASSERT)) {
+        ParseStaticAssert();
         continue;
       }
 
-      if (tok == nullptr) {
-        auto suType = memberType->ToStruct();
-        if (suType && !suType->HasTag()) {
-          // FIXME: setting 'tok' to nullptr is not good
-          auto anony = Object::NewAnony(ts_.Peek(), suType);
-          type->MergeAnony(anony);
+      // 解析type specifier/qualifier, 不接受storage等
+      int align;
+      auto memberType = ParseDeclSpec(nullptr, nullptr, &align);
+      do {
+        auto tokTypePair = ParseDeclarator(memberType);
+        auto tok = tokTypePair.first;
+        memberType = tokTypePair.second;
+      
+        if (ts_.Try(':')) {
+          ParseBitField(type, tok, memberType);
+          // TODO(wgtdkp): continue; ?
           continue;
-        } else {
-          Error(ts_.Peek(), "declaration does not declare anything");
         }
-      }
 
-      const auto& name = tok->str_;                
-      if (type->GetMember(name)) {
-        Error(tok, "duplicate member '%s'", name.c_str());
-      } else if (!memberType->Complete()) {
-        Error(tok, "field '%s' has incomplete type", name.c_str());
-      } else if (memberType->ToFunc()) {
-        Error(tok, "field '%s' declared as a function", name.c_str());
-      }
+        if (tok == nullptr) {
+          auto suType = memberType->ToStruct();
+          if (suType && !suType->HasTag()) {
+            // FIXME: setting 'tok' to nullptr is not good
+            auto anony = Object::NewAnony(ts_.Peek(), suType);
+            type->MergeAnony(anony);
+            continue;
+          } else {
+            Error(ts_.Peek(), "declaration does not declare anything");
+          }
+        }
 
-      auto member = Object::New(tok, memberType);
-      if (align > 0)
-        member->SetAlign(align);
-      type->AddMember(member);
-    } while (ts_.Try(','));
-    ts_.Expect(';');
+        const auto& name = tok->str_;                
+        if (type->GetMember(name)) {
+          Error(tok, "duplicate member '%s'", name.c_str());
+        } else if (!memberType->Complete()) {
+          Error(tok, "field '%s' has incomplete type", name.c_str());
+        } else if (memberType->ToFunc()) {
+          Error(tok, "field '%s' declared as a function", name.c_str());
+        }
+
+        auto member = Object::New(tok, memberType);
+        if (align > 0)
+          member->SetAlign(align);
+        type->AddMember(member);
+      } while (ts_.Try(','));
+      ts_.Expect(';');
+    } catch (const RecoverableError&) {
+      RestoreScope(type->MemberMap());
+      SkipToBoundary(begin, false, 0);
+    }
   }
   
-  //struct/union定义结束，设置其为完整类型
-  type->Finalize();
-  type->SetComplete(true);
   // TODO(wgtdkp): we need to export tags defined inside struct
   const auto& tags = curScope_->AllTagsInCurScope();
   for (auto tag: tags) {
@@ -1398,8 +1558,12 @@ StructType* Parser::ParseStructUnionDecl(StructType* type)
       Error(tag, "redefinition of tag '%s'\n", tag->Name().c_str());
     scopeBackup->InsertTag(tag);
   }
+  curScope_->Leave();
   curScope_ = scopeBackup;
-  
+
+  //struct/union定义结束，设置其为完整类型
+  type->Finalize();
+  type->SetComplete(true);
   return type;
 }
 
@@ -1515,8 +1679,7 @@ Type* Parser::ParsePointer(Type* typePointedTo)
 {
   Type* retType = typePointedTo;
   while (ts_.Try('*')) {
-    retType = PointerType::New(typePointedTo);
-    retType->SetQual(ParseQual());
+    retType = PointerType::New(typePointedTo, ParseQual());
     typePointedTo = retType;
   }
 
@@ -1524,15 +1687,20 @@ Type* Parser::ParsePointer(Type* typePointedTo)
 }
 
 
+// Derived types may be shared, thus rebuild the type on the new base
 static Type* ModifyBase(Type* type, Type* base, Type* newBase)
 {
   if (type == base)
     return newBase;
   
-  auto ty = type->ToDerived();
-  ty->SetDerived(ModifyBase(ty->Derived(), base, newBase));
-  
-  return ty;
+  auto derived = ModifyBase(type->ToDerived()->Derived(), base, newBase);
+  if (type->ToPointer())
+    return PointerType::New(derived, type->Qual());
+  if (type->ToArray())
+    return ArrayType::New(type->ToArray()->Len(), derived);
+  auto funcType = type->ToFunc();
+  assert(funcType);
+  return FuncType::New(derived, 0, funcType->Variadic(), funcType->Params());
 }
 
 
@@ -2280,20 +2448,32 @@ CompoundStmt* Parser::ParseCompoundStmt(FuncType* funcType)
   EnterBlock(funcType);
 
   std::list<Stmt*> stmts;
+  auto scope = curScope_;
+  auto breakDest = breakDest_;
+  auto continueDest = continueDest_;
+  auto caseLabels = caseLabels_;
+  auto defaultLabel = defaultLabel_;
 
   while (!ts_.Try('}')) {
-    if (ts_.Peek()->IsEOF()) {
-      Error(ts_.Peek(), "premature end of input");
-    }
+    CheckPrematureEnd();
 
-    if (IsType(ts_.Peek())) {
-      stmts.push_back(ParseDecl());
-    } else {
-      stmts.push_back(ParseStmt());
+    auto begin = ts_.Mark();
+    try {
+      if (IsType(ts_.Peek())) {
+        stmts.push_back(ParseDecl());
+      } else {
+        stmts.push_back(ParseStmt());
+      }
+    } catch (const RecoverableError&) {
+      RestoreScope(scope);
+      breakDest_ = breakDest;
+      continueDest_ = continueDest;
+      caseLabels_ = caseLabels;
+      defaultLabel_ = defaultLabel;
+      SkipToBoundary(begin, false, 0);
     }
   }
 
-  auto scope = curScope_;
   ExitBlock();
 
   return CompoundStmt::New(stmts, scope);
@@ -2505,8 +2685,7 @@ CompoundStmt* Parser::ParseDoStmt()
  * switch
  *  jump stmt (skip case labels)
  *  case labels
- *  jump stmts
- *  default jump stmt
+ *  switch stmt (jump to the case labels or default)
  */
 CompoundStmt* Parser::ParseSwitchStmt()
 {
@@ -2535,15 +2714,7 @@ CompoundStmt* Parser::ParseSwitchStmt()
   stmts.push_back(JumpStmt::New(endLabel));
   stmts.push_back(testLabel);
 
-  for (auto iter = caseLabels.begin();
-      iter != caseLabels.end(); iter++) {
-    auto cond = BinaryOp::New(tok, Token::EQ, t, iter->first);
-    auto then = JumpStmt::New(iter->second);
-    auto ifStmt = IfStmt::New(cond, then, nullptr);
-    stmts.push_back(ifStmt);
-  }
-  if (defaultLabel_)
-    stmts.push_back(JumpStmt::New(defaultLabel_));
+  stmts.push_back(SwitchStmt::New(t, caseLabels, defaultLabel_, endLabel));
   EXIT_SWITCH_BODY();
 
   stmts.push_back(endLabel);
@@ -2566,11 +2737,10 @@ CompoundStmt* Parser::ParseCaseStmt()
   ts_.Expect(':');
   
   auto labelStmt = LabelStmt::New();
-  for (auto val = begin; val <= end; ++val) {
-    if (val > INT_MAX)
+  if (begin <= end) {
+    if (end > INT_MAX)
       Error(tok, "case range exceed range of int");
-    auto cons = Constant::New(tok, T_INT, val);
-    caseLabels_->push_back(std::make_pair(cons, labelStmt));
+    caseLabels_->push_back({begin, end, labelStmt});
   }
   
   std::list<Stmt*> stmts;
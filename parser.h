@@ -9,8 +9,12 @@
 #include "token.h"
 
 #include <cassert>
+#include <map>
 #include <memory>
 #include <stack>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 class Preprocessor;
 
@@ -20,11 +24,22 @@ class Parser
 {
   typedef std::vector<Constant*> LiteralList;
   typedef std::vector<Object*> StaticObjectList;
-  typedef std::vector<std::pair<Constant*, LabelStmt*>> CaseLabelList;
+  typedef SwitchStmt::CaseList CaseLabelList;
   typedef std::list<std::pair<const Token*, JumpStmt*>> LabelJumpList;
   typedef std::map<std::string, LabelStmt*> LabelMap;
+  // A function whose body is not parsed yet, the mark of the body
+  // and the serial of the last binding that is visible to the body
+  struct LazyFunc {
+    FuncDef* funcDef_;
+    TokenList::iterator body_;
+    unsigned long serial_;
+  };
+  typedef std::unordered_map<std::string, LazyFunc> LazyFuncMap;
+  typedef std::vector<LazyFunc> LazyFuncList;
   
   friend class Generator;
+  friend class RegAllocator;
+  friend class Serializer;
 public:
   explicit Parser(const TokenSequence& ts) 
     : unit_(TranslationUnit::New()),
@@ -33,8 +48,10 @@ public:
       errTok_(nullptr), curScope_(new Scope(nullptr, S_FILE)),
       /*curParamScope_(nullptr),*/ curFunc_(nullptr),
       breakDest_(nullptr), continueDest_(nullptr),
-      caseLabels_(nullptr), defaultLabel_(nullptr) {
+      caseLabels_(nullptr), defaultLabel_(nullptr),
+      prematureEnd_(false) {
         ts_.SetParser(this);
+        curScope_->Enter();
       }
 
   ~Parser() {}
@@ -49,7 +66,14 @@ public:
 
   void Parse();
   void ParseTranslationUnit();
-  FuncDef* ParseFuncDef(Identifier* ident);
+  void ParseExtDecl();
+  void CheckPrematureEnd();
+  void RestoreScope(Scope* scope);
+  void SkipToBoundary(TokenList::iterator begin, bool fileScope, int depth);
+  FuncDef* ParseFuncDef(Identifier* ident, bool lazy=false);
+  void ParseLazyFuncDefs();
+  void ReferLazyFunc(const std::string& name);
+  void SkipFuncBody();
   
   /*
    * Expressions
@@ -178,22 +202,26 @@ public:
   void EnterBlock(FuncType* funcType=nullptr);
   
   void ExitBlock() {
+    curScope_->Leave();
     curScope_ = curScope_->Parent();
   }
 
   void EnterProto() {
     curScope_ = new Scope(curScope_, S_PROTO);
+    curScope_->Enter();
     //if (curParamScope_ == nullptr)
     //  curParamScope_ = curScope_;
   }
 
   void ExitProto() {
+    curScope_->Leave();
     curScope_ = curScope_->Parent();
   }
 
   FuncDef* EnterFunc(Identifier* ident);
 
   void ExitFunc();
+  void AbortFunc();
 
   LabelStmt* FindLabel(const std::string& label) {
     auto ret = curLabels_.find(label);
@@ -219,6 +247,9 @@ public:
     return curFunc_;
   }
 
+  static void SetLazyInline(bool lazy) { lazyInline_ = lazy; }
+  static bool LazyInline() { return lazyInline_; }
+
 private:
   static bool IsBuiltin(const FuncType* type);
   static bool IsBuiltin(const std::string& name);
@@ -227,6 +258,8 @@ private:
 
   static FuncType* vaStartType_;
   static FuncType* vaArgType_;
+  // Parse bodies of 'static inline' functions from headers on demand
+  static bool lazyInline_;
 
   // The root of the AST
   TranslationUnit* unit_;
@@ -250,12 +283,21 @@ private:
   FuncDef* curFunc_;
   LabelMap curLabels_;
   LabelJumpList unresolvedJumps_;
+
+  // Unreferenced lazy functions, keyed by name
+  LazyFuncMap lazyFuncs_;
+  // Functions referenced so far, those defined later are not lazy
+  std::unordered_set<std::string> referredFuncs_;
+  // Referenced lazy functions, waiting to be parsed
+  LazyFuncList lazyFuncQueue_;
   
   
   LabelStmt* breakDest_;
   LabelStmt* continueDest_;
   CaseLabelList* caseLabels_;
   LabelStmt* defaultLabel_;
+
+  bool prematureEnd_;
 };
 
 #endif
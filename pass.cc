@@ -0,0 +1,1137 @@
+#include "pass.h"
+
+#include "ast.h"
+#include "ir.h"
+#include "token.h"
+#include "visitor.h"
+
+#include <cassert>
+#include <cctype>
+#include <climits>
+#include <cstdlib>
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+
+int PassManager::level_ = 0;
+
+
+/*
+ * Constant folding of the integer expressions. The arithmetic is
+ * done in the width and signedness of the expression's type, the
+ * same as the code generated for it. Division by zero and shifts
+ * out of range are left to the run time.
+ */
+class ConstantFolder: public Visitor
+{
+public:
+  void Fold(FuncDef* funcDef) {
+    funcDef->Body()->Accept(this);
+  }
+
+  virtual void VisitBinaryOp(BinaryOp* binary);
+  virtual void VisitUnaryOp(UnaryOp* unary);
+  virtual void VisitConditionalOp(ConditionalOp* condOp);
+  virtual void VisitFuncCall(FuncCall* funcCall);
+  virtual void VisitObject(Object* obj);
+  virtual void VisitEnumerator(Enumerator* enumer);
+  virtual void VisitIdentifier(Identifier* ident) {}
+  virtual void VisitConstant(Constant* cons);
+  virtual void VisitTempVar(TempVar* tempVar) {}
+
+  virtual void VisitDeclaration(Declaration* decl);
+  virtual void VisitEmptyStmt(EmptyStmt* emptyStmt) {}
+  virtual void VisitIfStmt(IfStmt* ifStmt);
+  virtual void VisitJumpStmt(JumpStmt* jumpStmt) {}
+  virtual void VisitSwitchStmt(SwitchStmt* switchStmt) {}
+  virtual void VisitReturnStmt(ReturnStmt* returnStmt);
+  virtual void VisitLabelStmt(LabelStmt* labelStmt) {}
+  virtual void VisitCompoundStmt(CompoundStmt* compStmt);
+
+  virtual void VisitFuncDef(FuncDef* funcDef) { assert(false); }
+  virtual void VisitTranslationUnit(TranslationUnit* unit) { assert(false); }
+
+private:
+  // Fold the expression, returns the constant replacing it if any
+  Expr* FoldExpr(Expr* expr);
+  void SetVal(Type* type, unsigned long val);
+
+  bool isConst_ {false};
+  // The constant is folded from the expression, not the leaf itself
+  bool folded_ {false};
+  unsigned long val_ {0};
+};
+
+
+static bool IsIntType(Type* type)
+{
+  return type->ToArithm() && type->IsInteger();
+}
+
+
+// Truncate 'val' to the width of 'type', extended by its signedness
+static unsigned long Normalize(Type* type, unsigned long val)
+{
+  if (type->IsBool())
+    return val != 0;
+  auto bits = type->Width() * 8;
+  if (bits >= 64)
+    return val;
+  val &= (1UL << bits) - 1;
+  if (!type->IsUnsigned() && (val >> (bits - 1)))
+    val |= ~0UL << bits;
+  return val;
+}
+
+
+void ConstantFolder::SetVal(Type* type, unsigned long val)
+{
+  isConst_ = IsIntType(type);
+  folded_ = true;
+  val_ = Normalize(type, val);
+}
+
+
+Expr* ConstantFolder::FoldExpr(Expr* expr)
+{
+  isConst_ = folded_ = false;
+  expr->Accept(this);
+  if (!isConst_ || !folded_)
+    return expr;
+  auto cons = Constant::New(expr->Tok(),
+      expr->Type()->ToArithm()->Tag(), static_cast<long>(val_));
+  isConst_ = true;
+  return cons;
+}
+
+
+void ConstantFolder::VisitBinaryOp(BinaryOp* binary)
+{
+  auto op = binary->op_;
+  binary->lhs_ = FoldExpr(binary->lhs_);
+  auto lhsConst = isConst_;
+  auto lhs = val_;
+  // The rhs of logical operators is not evaluated if the lhs decides
+  if (lhsConst && ((op == Token::LOGICAL_AND && !lhs)
+      || (op == Token::LOGICAL_OR && lhs))) {
+    return SetVal(binary->Type(), op == Token::LOGICAL_OR);
+  }
+  if (op != '.')
+    binary->rhs_ = FoldExpr(binary->rhs_);
+  auto rhs = val_;
+  if (!lhsConst || !isConst_ || !IsIntType(binary->lhs_->Type())
+      || !IsIntType(binary->rhs_->Type())) {
+    isConst_ = false;
+    return;
+  }
+
+  auto type = binary->lhs_->Type();
+  auto sign = !type->IsUnsigned();
+  auto bits = static_cast<unsigned long>(type->Width()) * 8;
+  unsigned long val;
+  switch (op) {
+  case '+': val = lhs + rhs; break;
+  case '-': val = lhs - rhs; break;
+  case '*': val = lhs * rhs; break;
+  case '&': val = lhs & rhs; break;
+  case '|': val = lhs | rhs; break;
+  case '^': val = lhs ^ rhs; break;
+  case '/': case '%':
+    if (rhs == 0 || (sign && static_cast<long>(rhs) == -1)) {
+      isConst_ = false;
+      return;
+    }
+    if (sign) {
+      auto l = static_cast<long>(lhs), r = static_cast<long>(rhs);
+      val = op == '/' ? l / r: l % r;
+    } else {
+      val = op == '/' ? lhs / rhs: lhs % rhs;
+    }
+    break;
+  case Token::LEFT: case Token::RIGHT:
+    if (rhs >= bits) {
+      isConst_ = false;
+      return;
+    }
+    if (op == Token::LEFT)
+      val = lhs << rhs;
+    else
+      val = sign ? static_cast<long>(lhs) >> rhs: lhs >> rhs;
+    break;
+  case '<': val = sign ? (long)lhs < (long)rhs: lhs < rhs; break;
+  case '>': val = sign ? (long)lhs > (long)rhs: lhs > rhs; break;
+  case Token::LE: val = sign ? (long)lhs <= (long)rhs: lhs <= rhs; break;
+  case Token::GE: val = sign ? (long)lhs >= (long)rhs: lhs >= rhs; break;
+  case Token::EQ: val = lhs == rhs; break;
+  case Token::NE: val = lhs != rhs; break;
+  case Token::LOGICAL_AND: val = lhs && rhs; break;
+  case Token::LOGICAL_OR: val = lhs || rhs; break;
+  default:
+    isConst_ = false;
+    return;
+  }
+  SetVal(binary->Type(), val);
+}
+
+
+void ConstantFolder::VisitUnaryOp(UnaryOp* unary)
+{
+  unary->operand_ = FoldExpr(unary->operand_);
+  if (!isConst_ || !IsIntType(unary->operand_->Type()))  {
+    isConst_ = false;
+    return;
+  }
+  switch (unary->op_) {
+  case Token::PLUS: return SetVal(unary->Type(), val_);
+  case Token::MINUS: return SetVal(unary->Type(), -val_);
+  case '~': return SetVal(unary->Type(), ~val_);
+  case '!': return SetVal(unary->Type(), !val_);
+  case Token::CAST: return SetVal(unary->Type(), val_);
+  default: isConst_ = false;
+  }
+}
+
+
+void ConstantFolder::VisitConditionalOp(ConditionalOp* condOp)
+{
+  condOp->cond_ = FoldExpr(condOp->cond_);
+  auto condConst = isConst_;
+  auto cond = val_;
+  condOp->exprTrue_ = FoldExpr(condOp->exprTrue_);
+  auto trueConst = isConst_;
+  auto trueVal = val_;
+  condOp->exprFalse_ = FoldExpr(condOp->exprFalse_);
+  if (!condConst || !IsIntType(condOp->cond_->Type())) {
+    isConst_ = false;
+  } else if (cond) {
+    isConst_ = trueConst;
+    val_ = trueVal;
+  }
+  if (isConst_)
+    SetVal(condOp->Type(), val_);
+}
+
+
+void ConstantFolder::VisitFuncCall(FuncCall* funcCall)
+{
+  funcCall->designator_->Accept(this);
+  for (auto& arg: funcCall->args_)
+    arg = FoldExpr(arg);
+  isConst_ = false;
+}
+
+
+void ConstantFolder::VisitObject(Object* obj)
+{
+  // The compound literal is initialized where it is used
+  if (obj->Anonymous() && obj->Decl())
+    VisitDeclaration(obj->Decl());
+  isConst_ = false;
+}
+
+
+void ConstantFolder::VisitEnumerator(Enumerator* enumer)
+{
+  isConst_ = true;
+  val_ = enumer->Val();
+}
+
+
+void ConstantFolder::VisitConstant(Constant* cons)
+{
+  isConst_ = IsIntType(cons->Type());
+  val_ = cons->IVal();
+}
+
+
+void ConstantFolder::VisitDeclaration(Declaration* decl)
+{
+  // 'expr_' is not the key of the set
+  for (auto& init: decl->Inits())
+    const_cast<Initializer&>(init).expr_ = FoldExpr(init.expr_);
+}
+
+
+void ConstantFolder::VisitIfStmt(IfStmt* ifStmt)
+{
+  ifStmt->cond_ = FoldExpr(ifStmt->cond_);
+  ifStmt->then_->Accept(this);
+  if (ifStmt->else_)
+    ifStmt->else_->Accept(this);
+}
+
+
+void ConstantFolder::VisitReturnStmt(ReturnStmt* returnStmt)
+{
+  if (returnStmt->expr_)
+    returnStmt->expr_ = FoldExpr(returnStmt->expr_);
+}
+
+
+void ConstantFolder::VisitCompoundStmt(CompoundStmt* compStmt)
+{
+  for (auto stmt: compStmt->Stmts())
+    stmt->Accept(this);
+}
+
+
+/*
+ * CFG simplification: jumps to blocks of only 'jmp' are threaded,
+ * 'jcc L; jmp M; L:' is inverted to 'jncc M; L:', jumps to the next
+ * block are removed and so are the blocks unreachable from the entry.
+ */
+static const char* InvertCond(const std::string& op)
+{
+  static const std::unordered_map<std::string, const char*> inverses {
+    {"je", "jne"}, {"jne", "je"}, {"jl", "jge"}, {"jge", "jl"},
+    {"jle", "jg"}, {"jg", "jle"}, {"jb", "jae"}, {"jae", "jb"},
+    {"jbe", "ja"}, {"ja", "jbe"}, {"js", "jns"}, {"jns", "js"},
+    {"jp", "jnp"}, {"jnp", "jp"},
+  };
+  auto iter = inverses.find(op);
+  return iter == inverses.end() ? nullptr: iter->second;
+}
+
+
+// The label jumped to by the last instruction of 'block', or nullptr
+static std::string* JumpTarget(BasicBlock& block)
+{
+  if (block.insts_.empty())
+    return nullptr;
+  auto& last = block.insts_.back();
+  if (!last.IsJump() && !last.IsCondJump())
+    return nullptr;
+  auto& target = last.operands_[0];
+  if (target.kind_ != Operand::LABEL || target.indirect_)
+    return nullptr;
+  return &target.disp_;
+}
+
+
+static bool ThreadJumps(IRFunc* func)
+{
+  std::unordered_map<std::string, BasicBlock*> labels;
+  for (auto& block: func->Blocks()) {
+    if (block.label_.size())
+      labels[block.label_] = &block;
+  }
+
+  bool changed = false;
+  for (auto& block: func->Blocks()) {
+    auto target = JumpTarget(block);
+    std::unordered_set<BasicBlock*> visited;
+    while (target) {
+      auto iter = labels.find(*target);
+      if (iter == labels.end())
+        break;
+      auto dest = iter->second;
+      if (dest->insts_.size() != 1 || !dest->insts_.front().IsJump())
+        break;
+      auto next = JumpTarget(*dest);
+      if (!next || !visited.insert(dest).second || *next == *target)
+        break;
+      *target = *next;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+
+static bool RemoveJumpsToNext(IRFunc* func)
+{
+  bool changed = false;
+  auto& blocks = func->Blocks();
+  for (auto iter = blocks.begin(); iter != blocks.end(); ++iter) {
+    auto next = std::next(iter);
+    auto target = JumpTarget(*iter);
+    if (!target || next == blocks.end())
+      continue;
+    auto& last = iter->insts_.back();
+    if (*target == next->label_) {
+      iter->insts_.pop_back();
+      changed = true;
+      continue;
+    }
+
+    // 'jcc L; jmp M; L:'
+    auto after = std::next(next);
+    auto inverse = InvertCond(last.op_);
+    if (!inverse || after == blocks.end() || *target != after->label_
+        || next->label_.size() || next->insts_.size() != 1
+        || !JumpTarget(*next) || !next->insts_.front().IsJump()) {
+      continue;
+    }
+    last.op_ = inverse;
+    *target = *JumpTarget(*next);
+    next->insts_.clear();
+    changed = true;
+  }
+  return changed;
+}
+
+
+static bool RemoveUnreachable(IRFunc* func)
+{
+  func->BuildCFG();
+  std::unordered_set<BasicBlock*> reached {func->Entry()};
+  std::vector<BasicBlock*> worklist {func->Entry()};
+  while (worklist.size()) {
+    auto block = worklist.back();
+    worklist.pop_back();
+    for (auto succ: block->succs_) {
+      if (reached.insert(succ).second)
+        worklist.push_back(succ);
+    }
+  }
+
+  bool changed = false;
+  auto& blocks = func->Blocks();
+  for (auto iter = blocks.begin(); iter != blocks.end(); ) {
+    // Empty blocks only fall through
+    auto empty = iter->insts_.empty() && iter->label_.empty();
+    if (reached.count(&*iter) && (!empty || iter == blocks.begin())) {
+      ++iter;
+    } else {
+      iter = blocks.erase(iter);
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+
+static bool SimplifyCFG(IRFunc* func)
+{
+  bool changed = false;
+  for (;;) {
+    bool again = ThreadJumps(func);
+    again = RemoveJumpsToNext(func) || again;
+    again = RemoveUnreachable(func) || again;
+    if (!again)
+      return changed;
+    changed = true;
+  }
+}
+
+
+/*
+ * Local constant propagation: the registers holding the known
+ * constants are replaced by immediates, loading the constant a
+ * register already holds is removed, and the conditional jumps
+ * and sets of known comparisons are resolved.
+ */
+static bool ParseImm(const Operand& operand, long& val)
+{
+  if (operand.kind_ != Operand::IMM || operand.disp_.empty())
+    return false;
+  char* end;
+  val = strtol(operand.disp_.c_str(), &end, 0);
+  return *end == '\0';
+}
+
+
+// The 4 or 8 bytes general purpose register operand
+static bool IsGPR(const Operand& operand)
+{
+  auto index = operand.RegIndex();
+  return operand.kind_ == Operand::REG && index >= 0 && index < 16
+      && (operand.Width() == 4 || operand.Width() == 8);
+}
+
+
+static bool EvalCond(const std::string& cc, unsigned long lhs,
+    unsigned long rhs, int width)
+{
+  auto bits = width * 8;
+  if (bits < 64) {
+    lhs &= (1UL << bits) - 1;
+    rhs &= (1UL << bits) - 1;
+  }
+  auto shift = 64 - bits;
+  auto slhs = static_cast<long>(lhs << shift) >> shift;
+  auto srhs = static_cast<long>(rhs << shift) >> shift;
+  if (cc == "e") return lhs == rhs;
+  if (cc == "ne") return lhs != rhs;
+  if (cc == "l") return slhs < srhs;
+  if (cc == "le") return slhs <= srhs;
+  if (cc == "g") return slhs > srhs;
+  if (cc == "ge") return slhs >= srhs;
+  if (cc == "b") return lhs < rhs;
+  if (cc == "be") return lhs <= rhs;
+  if (cc == "a") return lhs > rhs;
+  assert(cc == "ae");
+  return lhs >= rhs;
+}
+
+
+static bool PropagateConstants(IRFunc* func)
+{
+  static const std::unordered_set<std::string> conds {
+    "e", "ne", "l", "le", "g", "ge", "b", "be", "a", "ae",
+  };
+  static const std::unordered_set<std::string> ops {
+    "mov", "cmp", "add", "sub", "and", "or", "xor", "imul",
+  };
+
+  bool changed = false;
+  for (auto& block: func->Blocks()) {
+    unsigned long known[16];
+    RegSet knownRegs = 0;
+    bool flagsKnown = false;
+    unsigned long lhs = 0, rhs = 0;
+    int width = 0;
+
+    for (auto iter = block.insts_.begin(); iter != block.insts_.end(); ) {
+      auto& inst = *iter;
+      auto op = inst.op_ == "mov" || inst.op_ == "movl" || inst.op_ == "movq"
+              ? std::string("mov"): inst.IntOp();
+      auto& operands = inst.operands_;
+      // Storing the register, the size of plain 'mov' is implicit
+      auto store = op == "mov" && inst.op_ != "mov" && operands.size() == 2
+          && operands[1].kind_ == Operand::MEM;
+      if (ops.count(op) && operands.size() == 2
+          && (IsGPR(operands[1]) || store)) {
+        auto& src = operands[0];
+        auto& des = operands[1];
+        if (IsGPR(src) && (knownRegs & (RegSet(1) << src.RegIndex()))) {
+          auto val = known[src.RegIndex()];
+          if (src.Width() == 4)
+            val = static_cast<int>(val);
+          if (static_cast<long>(val) == static_cast<int>(val)) {
+            src = Operand::NewImm(std::to_string(static_cast<long>(val)));
+            changed = true;
+          }
+        }
+        if (store) {
+          ++iter;
+          continue;
+        }
+
+        long imm;
+        auto index = des.RegIndex();
+        auto desKnown = knownRegs & (RegSet(1) << index);
+        if (ParseImm(src, imm) && (op == "mov" || desKnown)) {
+          unsigned long val = imm, cur = known[index];
+          if (op == "cmp") {
+            flagsKnown = true;
+            lhs = cur, rhs = val, width = des.Width();
+            ++iter;
+            continue;
+          }
+          if (op == "add") val = cur + val;
+          else if (op == "sub") val = cur - val;
+          else if (op == "and") val = cur & val;
+          else if (op == "or") val = cur | val;
+          else if (op == "xor") val = cur ^ val;
+          else if (op == "imul") val = cur * val;
+          if (des.Width() == 4)
+            val &= 0xffffffffUL;
+          if (op == "mov" && desKnown && known[index] == val) {
+            iter = block.insts_.erase(iter);
+            changed = true;
+            continue;
+          }
+          known[index] = val;
+          knownRegs |= RegSet(1) << index;
+          if (op != "mov")
+            flagsKnown = false;
+          ++iter;
+          continue;
+        }
+      }
+
+      auto set = inst.op_.compare(0, 3, "set") == 0;
+      std::string cc;
+      if (inst.IsCondJump() || set)
+        cc = inst.op_.substr(set ? 3: 1);
+      if (flagsKnown && conds.count(cc) && !set) {
+        changed = true;
+        if (EvalCond(cc, lhs, rhs, width)) {
+          inst.op_ = "jmp";
+        } else {
+          iter = block.insts_.erase(iter);
+          continue;
+        }
+      } else if (flagsKnown && conds.count(cc)) {
+        changed = true;
+        inst.op_ = "movb";
+        auto val = EvalCond(cc, lhs, rhs, width) ? "1": "0";
+        operands.insert(operands.begin(), Operand::NewImm(val));
+      }
+
+      RegSet defs, uses;
+      inst.DefUse(defs, uses);
+      knownRegs &= ~defs;
+      if (defs & (RegSet(1) << REG_FLAGS))
+        flagsKnown = false;
+      ++iter;
+    }
+  }
+  return changed;
+}
+
+
+// The registers live out of each block
+static std::unordered_map<BasicBlock*, RegSet> LiveOuts(IRFunc* func)
+{
+  func->BuildCFG();
+  auto& blocks = func->Blocks();
+  std::unordered_map<BasicBlock*, RegSet> gens, kills, liveIns, liveOuts;
+  for (auto& block: blocks) {
+    RegSet gen = 0, kill = 0;
+    for (auto iter = block.insts_.rbegin();
+        iter != block.insts_.rend(); ++iter) {
+      RegSet defs, uses;
+      iter->DefUse(defs, uses);
+      gen = (gen & ~defs) | uses;
+      kill |= defs;
+    }
+    gens[&block] = gen;
+    kills[&block] = kill;
+    liveIns[&block] = 0;
+    // Leaving the function by neither returning nor jumping in it
+    auto exit = block.succs_.empty()
+        && (block.insts_.empty() || !block.insts_.back().IsRet());
+    liveOuts[&block] = exit ? ALL_REGS: 0;
+  }
+
+  for (bool again = true; again; ) {
+    again = false;
+    for (auto iter = blocks.rbegin(); iter != blocks.rend(); ++iter) {
+      auto block = &*iter;
+      auto liveOut = liveOuts[block];
+      for (auto succ: block->succs_)
+        liveOut |= liveIns[succ];
+      auto liveIn = gens[block] | (liveOut & ~kills[block]);
+      if (liveOut != liveOuts[block] || liveIn != liveIns[block]) {
+        liveOuts[block] = liveOut;
+        liveIns[block] = liveIn;
+        again = true;
+      }
+    }
+  }
+  return liveOuts;
+}
+
+
+/*
+ * Peephole optimization by a table of patterns. A pattern matches
+ * the instructions from 'i' with the registers live after each of
+ * them, and rewrites them in place.
+ */
+typedef std::vector<Inst> InstList;
+
+static const int RAX = 0;
+static const int R11 = 11;
+
+static RegSet Bit(int index)
+{
+  return RegSet(1) << index;
+}
+
+
+static bool IsReg(const Operand& operand, int index, int width)
+{
+  return operand.kind_ == Operand::REG && operand.RegIndex() == index
+      && operand.Width() == width;
+}
+
+
+// The 'width' bytes part of the general purpose register 'reg'
+static std::string SubReg(const std::string& reg, int width)
+{
+  if (width == 8)
+    return reg;
+  assert(width == 4);
+  return isdigit(reg[1]) ? reg + "d": "e" + reg.substr(1);
+}
+
+
+// 'setcc %al; movzbq %al, %rax; cmp $0, %eax; je L' to 'jncc L'
+static bool FuseSetBranch(InstList& insts, size_t i,
+    const std::vector<RegSet>& liveAfter)
+{
+  if (i + 3 >= insts.size())
+    return false;
+  const auto& set = insts[i];
+  const auto& ext = insts[i + 1];
+  const auto& cmp = insts[i + 2];
+  auto& jump = insts[i + 3];
+  if (set.op_.compare(0, 3, "set") != 0 || !IsReg(set.operands_[0], RAX, 1))
+    return false;
+  if ((ext.op_ != "movzbq" && ext.op_ != "movzbl")
+      || !IsReg(ext.operands_[0], RAX, 1)
+      || ext.operands_[1].RegIndex() != RAX)
+    return false;
+  long imm;
+  if (cmp.IntOp() != "cmp" || !ParseImm(cmp.operands_[0], imm) || imm != 0
+      || cmp.operands_[1].kind_ != Operand::REG
+      || cmp.operands_[1].RegIndex() != RAX
+      || cmp.operands_[1].Width() < 4)
+    return false;
+  if ((jump.op_ != "je" && jump.op_ != "jne") || liveAfter[i + 3] & Bit(RAX))
+    return false;
+
+  std::string cond = "j" + set.op_.substr(3);
+  auto inverse = InvertCond(cond);
+  if (!inverse)
+    return false;
+  jump.op_ = jump.op_ == "jne" ? cond: inverse;
+  insts.erase(insts.begin() + i, insts.begin() + i + 3);
+  return true;
+}
+
+
+// The forward scans of the patterns look at most so many instructions ahead
+static const size_t WINDOW = 16;
+
+
+// 'mov A, B' ... 'mov B, A' with A and B unchanged between
+static bool RemoveCopyBack(InstList& insts, size_t i,
+    const std::vector<RegSet>& liveAfter)
+{
+  const auto& mov = insts[i];
+  if (mov.op_ != "movq" || mov.operands_.size() != 2
+      || mov.operands_[0].kind_ != Operand::REG
+      || mov.operands_[1].kind_ != Operand::REG)
+    return false;
+  const auto& src = mov.operands_[0].reg_;
+  const auto& des = mov.operands_[1].reg_;
+  if (src == des) {
+    insts.erase(insts.begin() + i);
+    return true;
+  }
+
+  auto regs = Bit(mov.operands_[0].RegIndex())
+            | Bit(mov.operands_[1].RegIndex());
+  for (auto j = i + 1; j < insts.size() && j <= i + WINDOW; ++j) {
+    const auto& inst = insts[j];
+    if (inst.op_ == mov.op_ && inst.operands_.size() == 2
+        && inst.operands_[0].IsReg(des) && inst.operands_[1].IsReg(src)) {
+      insts.erase(insts.begin() + j);
+      return true;
+    }
+    RegSet defs, uses;
+    inst.DefUse(defs, uses);
+    if (defs & regs || inst.IsTerminator())
+      return false;
+  }
+  return false;
+}
+
+
+// 'mov %r, M' ... 'mov M, %s' to 'mov %r, %s' of the stack slot M
+static bool ForwardStore(InstList& insts, size_t i,
+    const std::vector<RegSet>& liveAfter)
+{
+  const auto& store = insts[i];
+  if ((store.op_ != "movq" && store.op_ != "movl")
+      || store.operands_.size() != 2
+      || store.operands_[0].kind_ != Operand::REG
+      || store.operands_[1].kind_ != Operand::MEM
+      || store.operands_[1].reg_ != "rbp")
+    return false;
+  const auto& reg = store.operands_[0];
+  const auto& mem = store.operands_[1];
+
+  for (auto j = i + 1; j < insts.size() && j <= i + WINDOW; ++j) {
+    auto& inst = insts[j];
+    if (inst.op_ == store.op_ && inst.operands_.size() == 2
+        && inst.operands_[0].kind_ == Operand::MEM
+        && inst.operands_[0].reg_ == mem.reg_
+        && inst.operands_[0].disp_ == mem.disp_
+        && inst.operands_[1].kind_ == Operand::REG) {
+      // 'movl' still clears the high part of the register
+      if (inst.operands_[1].reg_ == reg.reg_ && inst.op_ == "movq")
+        insts.erase(insts.begin() + j);
+      else
+        inst.operands_[0] = reg;
+      return true;
+    }
+    RegSet defs, uses;
+    inst.DefUse(defs, uses);
+    if (inst.HasSideEffect() || defs & Bit(reg.RegIndex()))
+      return false;
+  }
+  return false;
+}
+
+
+// 'movq %rax, %r11; mov S, %rax; op %r11, %rax' to 'op S, %rax'
+// of the commutative 'op', the spilled lhs is used in place
+static bool CommuteOperands(InstList& insts, size_t i,
+    const std::vector<RegSet>& liveAfter)
+{
+  static const std::unordered_set<std::string> ops {
+    "add", "and", "or", "xor", "imul",
+  };
+  if (i + 2 >= insts.size())
+    return false;
+  const auto& spill = insts[i];
+  const auto& load = insts[i + 1];
+  auto& inst = insts[i + 2];
+  if (spill.op_ != "movq" || !IsReg(spill.operands_[0], RAX, 8)
+      || !IsReg(spill.operands_[1], R11, 8))
+    return false;
+  if ((load.op_ != "movq" && load.op_ != "movl")
+      || load.operands_.size() != 2
+      || load.operands_[1].RegIndex() != RAX
+      || load.operands_[1].kind_ != Operand::REG)
+    return false;
+  if (!ops.count(inst.IntOp()) || inst.operands_.size() != 2)
+    return false;
+  auto width = inst.operands_[1].Width();
+  if (!IsReg(inst.operands_[0], R11, width)
+      || !IsReg(inst.operands_[1], RAX, width)
+      || (width != 4 && width != 8) || load.operands_[1].Width() < width
+      || liveAfter[i + 2] & Bit(R11))
+    return false;
+
+  auto src = load.operands_[0];
+  if (src.kind_ == Operand::REG) {
+    if (src.RegIndex() < 0 || src.RegIndex() >= 16
+        || src.RegIndex() == R11 || src.RegIndex() == RAX)
+      return false;
+    src.reg_ = SubReg(src.Reg(), width);
+  } else if (src.kind_ != Operand::MEM) {
+    return false;
+  }
+  inst.operands_[0] = src;
+  insts.erase(insts.begin() + i, insts.begin() + i + 2);
+  return true;
+}
+
+
+struct Pattern
+{
+  const char* name_;
+  bool (*rewrite_)(InstList& insts, size_t i,
+      const std::vector<RegSet>& liveAfter);
+};
+
+static const Pattern patterns[] = {
+  {"set-branch", FuseSetBranch},
+  {"copy-back", RemoveCopyBack},
+  {"store-forward", ForwardStore},
+  {"commute", CommuteOperands},
+};
+
+
+// The registers live after each instruction
+static void Liveness(const InstList& insts, std::vector<RegSet>& liveAfter,
+    RegSet liveOut)
+{
+  liveAfter.resize(insts.size());
+  auto live = liveOut;
+  for (auto k = insts.size(); k-- > 0; ) {
+    liveAfter[k] = live;
+    RegSet defs, uses;
+    insts[k].DefUse(defs, uses);
+    live = (live & ~defs) | uses;
+  }
+}
+
+
+/*
+ * The block streams through a window of instructions, and the patterns
+ * match from the start of it. A rewrite changes only the window, so
+ * the liveness is recomputed in it, and the last instructions before
+ * it are moved back to match again.
+ */
+static bool Peephole(IRFunc* func)
+{
+  // The longest pattern without forward scan
+  static const size_t span = 4;
+  auto liveOuts = LiveOuts(func);
+  bool changed = false;
+  for (auto& block: func->Blocks()) {
+    InstList insts(block.insts_.begin(), block.insts_.end());
+    // The registers live before each instruction
+    std::vector<RegSet> liveIns(insts.size());
+    auto liveOut = liveOuts[&block];
+    auto live = liveOut;
+    for (auto k = insts.size(); k-- > 0; ) {
+      RegSet defs, uses;
+      insts[k].DefUse(defs, uses);
+      live = liveIns[k] = (live & ~defs) | uses;
+    }
+
+    InstList done, window;
+    std::vector<RegSet> liveAfter;
+    size_t next = 0;
+    while (true) {
+      // The liveness after the window is unchanged
+      while (window.size() < WINDOW + span && next < insts.size()) {
+        window.push_back(std::move(insts[next++]));
+        liveAfter.push_back(next < insts.size() ? liveIns[next]: liveOut);
+      }
+      if (window.empty())
+        break;
+
+      bool rewritten = false;
+      for (const auto& pattern: patterns) {
+        if (pattern.rewrite_(window, 0, liveAfter)) {
+          rewritten = changed = true;
+          break;
+        }
+      }
+      if (!rewritten) {
+        done.push_back(std::move(window.front()));
+        window.erase(window.begin());
+        liveAfter.erase(liveAfter.begin());
+        continue;
+      }
+      for (size_t k = 1; k < span && !done.empty(); ++k) {
+        window.insert(window.begin(), std::move(done.back()));
+        done.pop_back();
+      }
+      Liveness(window, liveAfter, liveAfter.back());
+    }
+    block.insts_.assign(done.begin(), done.end());
+  }
+  return changed;
+}
+
+
+/*
+ * Dead code elimination by the liveness of the registers and the
+ * flags. The instructions have no side effect and write only the
+ * registers dead after them are removed.
+ */
+static bool EliminateDeadCode(IRFunc* func)
+{
+  auto liveOuts = LiveOuts(func);
+  bool changed = false;
+  for (auto& block: func->Blocks()) {
+    auto live = liveOuts[&block];
+    auto& insts = block.insts_;
+    for (auto iter = insts.end(); iter != insts.begin(); ) {
+      --iter;
+      RegSet defs, uses;
+      iter->DefUse(defs, uses);
+      if (defs && !(defs & live) && !iter->HasSideEffect()) {
+        iter = insts.erase(iter);
+        changed = true;
+        continue;
+      }
+      live = (live & ~defs) | uses;
+    }
+  }
+  return changed;
+}
+
+
+/*
+ * The frame of the function. A leaf function whose frame fits in
+ * the red zone, the 128 bytes below '%rsp' kept from the signal
+ * handlers, omits the frame pointer and addresses the frame by
+ * '%rsp'. Other functions set '%rsp' before each call, the settings
+ * to the offset '%rsp' already has are removed.
+ */
+static const int RSP = 4;
+static const int RBP = 5;
+static const int RED_ZONE = 128;
+
+static bool IsFrameBase(const Operand& operand, long& disp)
+{
+  if (operand.kind_ != Operand::MEM || operand.reg_ != "rbp")
+    return false;
+  char* end;
+  disp = strtol(operand.disp_.c_str(), &end, 0);
+  return *end == '\0';
+}
+
+
+static bool OmitFramePointer(IRFunc* func)
+{
+  auto& entry = func->Entry()->insts_;
+  if (entry.size() < 2 || entry.front().op_ != "pushq"
+      || !entry.front().operands_[0].IsReg("rbp")
+      || std::next(entry.begin())->op_ != "movq"
+      || !std::next(entry.begin())->operands_[0].IsReg("rsp")) {
+    return false;
+  }
+
+  // After 'pushq %rbp', 'X(%rbp)' is 'X-8(%rsp)'
+  for (auto& block: func->Blocks()) {
+    auto begin = block.insts_.begin();
+    if (&block == func->Entry())
+      std::advance(begin, 2);
+    for (auto iter = begin; iter != block.insts_.end(); ++iter) {
+      RegSet defs, uses;
+      iter->DefUse(defs, uses);
+      if (iter->IsCall() || defs == ALL_REGS)
+        return false;
+      if (iter->op_ == "leaveq" || iter->IsRet())
+        continue;
+      for (const auto& operand: iter->operands_) {
+        long disp;
+        if (IsFrameBase(operand, disp)) {
+          if (disp - 8 < -RED_ZONE)
+            return false;
+        } else if (operand.Reg() == "rsp" || operand.Reg() == "rbp") {
+          return false;
+        }
+      }
+    }
+  }
+
+  entry.erase(entry.begin(), std::next(entry.begin(), 2));
+  for (auto& block: func->Blocks()) {
+    auto& insts = block.insts_;
+    for (auto iter = insts.begin(); iter != insts.end(); ) {
+      if (iter->op_ == "leaveq") {
+        iter = insts.erase(iter);
+        continue;
+      }
+      for (auto& operand: iter->operands_) {
+        long disp;
+        if (IsFrameBase(operand, disp)) {
+          operand.reg_ = "rsp";
+          operand.disp_ = disp == 8 ? "": std::to_string(disp - 8);
+        }
+      }
+      ++iter;
+    }
+  }
+  return true;
+}
+
+
+// The offset of '%rsp' to '%rbp' after 'inst', 'unknown' if it is not
+static const long unknown = LONG_MIN;
+
+static long StackOffset(const Inst& inst, long offset)
+{
+  long disp;
+  if (inst.op_ == "movq" && inst.operands_[0].IsReg("rsp")
+      && inst.operands_[1].IsReg("rbp")) {
+    return 0;
+  }
+  if (inst.op_ == "leaq" && inst.operands_[1].IsReg("rsp")
+      && IsFrameBase(inst.operands_[0], disp)) {
+    return disp;
+  }
+  RegSet defs, uses;
+  inst.DefUse(defs, uses);
+  return defs & (Bit(RSP) | Bit(RBP)) ? unknown: offset;
+}
+
+
+static bool RemoveStackResets(IRFunc* func)
+{
+  func->BuildCFG();
+  std::unordered_map<BasicBlock*, long> ins {{func->Entry(), unknown}};
+  std::vector<BasicBlock*> worklist {func->Entry()};
+  while (worklist.size()) {
+    auto block = worklist.back();
+    worklist.pop_back();
+    auto offset = ins[block];
+    for (const auto& inst: block->insts_)
+      offset = StackOffset(inst, offset);
+    for (auto succ: block->succs_) {
+      auto iter = ins.find(succ);
+      if (iter == ins.end()) {
+        ins[succ] = offset;
+        worklist.push_back(succ);
+      } else if (iter->second != offset && iter->second != unknown) {
+        iter->second = unknown;
+        worklist.push_back(succ);
+      }
+    }
+  }
+
+  bool changed = false;
+  for (auto& block: func->Blocks()) {
+    auto offset = ins.count(&block) ? ins[&block]: unknown;
+    auto& insts = block.insts_;
+    for (auto iter = insts.begin(); iter != insts.end(); ) {
+      auto next = StackOffset(*iter, offset);
+      auto reset = iter->op_ == "leaq" && iter->operands_[1].IsReg("rsp");
+      if (reset && offset != unknown && next == offset) {
+        iter = insts.erase(iter);
+        changed = true;
+        continue;
+      }
+      offset = next;
+      ++iter;
+    }
+  }
+  return changed;
+}
+
+
+static bool OptimizeFrame(IRFunc* func)
+{
+  return OmitFramePointer(func) || RemoveStackResets(func);
+}
+
+
+struct IRPass
+{
+  const char* name_;
+  int level_;
+  bool (*run_)(IRFunc* func);
+};
+
+static const IRPass irPasses[] = {
+  {"cfg-simplify", 1, SimplifyCFG},
+  {"const-prop", 2, PropagateConstants},
+  {"cfg-simplify", 2, SimplifyCFG},
+  {"peephole", 2, Peephole},
+  {"dce", 2, EliminateDeadCode},
+  {"cfg-simplify", 2, SimplifyCFG},
+  {"frame", 1, OptimizeFrame},
+};
+
+
+void PassManager::Run(FuncDef* funcDef)
+{
+  if (level_ >= 1) {
+    PassTimer timer("constant-fold");
+    ConstantFolder().Fold(funcDef);
+  }
+}
+
+
+void PassManager::Run(IRFunc* func)
+{
+  for (const auto& pass: irPasses) {
+    if (level_ >= pass.level_) {
+      PassTimer timer(pass.name_);
+      pass.run_(func);
+    }
+  }
+}
+
+
+static std::mutex timesMtx;
+// In the order of the first time reported
+static std::vector<std::pair<std::string, double>> times;
+
+void PassManager::AddTime(const char* name, double seconds)
+{
+  std::lock_guard<std::mutex> lock(timesMtx);
+  for (auto& time: times) {
+    if (time.first == name) {
+      time.second += seconds;
+      return;
+    }
+  }
+  times.emplace_back(name, seconds);
+}
+
+
+void PassManager::ReportTime(FILE* fp)
+{
+  std::lock_guard<std::mutex> lock(timesMtx);
+  fprintf(fp, "Execution times (seconds, summed over threads)\n");
+  for (const auto& time: times)
+    fprintf(fp, "  %-16s: %9.6f\n", time.first.c_str(), time.second);
+}
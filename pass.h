@@ -0,0 +1,58 @@
+#ifndef _WGTCC_PASS_H_
+#define _WGTCC_PASS_H_
+
+#include <chrono>
+#include <cstdio>
+
+
+class FuncDef;
+class IRFunc;
+
+
+/*
+ * The optimizations run on each function, selected by '-O':
+ *   -O0: the plain code of the tree walk, objects live on the stack;
+ *   -O1: constant folding, register allocation, CFG simplification,
+ *        frame pointer omission of leaf functions;
+ *   -O2: also constant propagation, peephole optimization and
+ *        dead code elimination.
+ * The AST passes run before the function is generated, the IR
+ * passes after it. The time of passes and phases is accumulated
+ * over the threads for '-ftime-report'.
+ */
+class PassManager
+{
+public:
+  static void SetLevel(int level) { level_ = level; }
+  static int Level() { return level_; }
+
+  static void Run(FuncDef* funcDef);
+  static void Run(IRFunc* func);
+
+  static void AddTime(const char* name, double seconds);
+  static void ReportTime(FILE* fp);
+
+private:
+  static int level_;
+};
+
+
+// Accumulate the time of its scope to 'name'
+class PassTimer
+{
+public:
+  explicit PassTimer(const char* name)
+      : name_(name), begin_(std::chrono::steady_clock::now()) {}
+
+  ~PassTimer() {
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - begin_;
+    PassManager::AddTime(name_, elapsed.count());
+  }
+
+private:
+  const char* name_;
+  std::chrono::steady_clock::time_point begin_;
+};
+
+#endif
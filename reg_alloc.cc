@@ -0,0 +1,236 @@
+#include "reg_alloc.h"
+
+#include "parser.h"
+#include "scope.h"
+#include "token.h"
+
+#include <algorithm>
+
+
+const std::vector<const char*>& RegAllocator::Regs()
+{
+  static const std::vector<const char*> regs {
+    "rbx", "r12", "r13", "r14", "r15"
+  };
+  return regs;
+}
+
+
+const std::vector<const char*>& RegAllocator::LeafRegs()
+{
+  static const std::vector<const char*> regs {
+    "rsi", "rdi", "r8", "r9"
+  };
+  return regs;
+}
+
+
+static bool Promotable(Object* obj)
+{
+  auto type = obj->Type();
+  if (obj->IsStatic() || obj->Anonymous() || obj->BitFieldWidth())
+    return false;
+  if (type->Qual() & Q_VOLATILE)
+    return false;
+  return type->IsInteger() || type->ToPointer();
+}
+
+
+std::vector<const char*> RegAllocator::Alloc(FuncDef* funcDef,
+    const std::vector<std::string>& locs)
+{
+  const auto& params = funcDef->Type()->Params();
+  // Params of variadic function are addressed by the register save area
+  if (funcDef->Type()->Variadic()) {
+    for (auto param: params)
+      addrTaken_.insert(param);
+  }
+  VisitCompoundStmt(funcDef->Body());
+
+  std::vector<Interval*> intervals;
+  for (auto& interval: intervals_) {
+    interval.uses_ = uses_[interval.obj_];
+    if (!interval.uses_ || addrTaken_.count(interval.obj_))
+      continue;
+    auto param = std::find(params.begin(), params.end(), interval.obj_);
+    if (!hasCall_ && param != params.end()) {
+      const auto& loc = locs[param - params.begin()];
+      auto reg = std::find(LeafRegs().begin(), LeafRegs().end(), loc);
+      if (reg != LeafRegs().end()) {
+        interval.obj_->SetReg(*reg);
+        continue;
+      }
+    }
+    intervals.push_back(&interval);
+  }
+  std::stable_sort(intervals.begin(), intervals.end(),
+      [](const Interval* lhs, const Interval* rhs) {
+    return lhs->begin_ < rhs->begin_;
+  });
+
+  // The registers of params are not free until the params are moved
+  std::vector<const char*> free(Regs().rbegin(), Regs().rend());
+  if (!hasCall_) {
+    for (auto iter = LeafRegs().rbegin(); iter != LeafRegs().rend(); ++iter) {
+      // The registers of a struct/union param are joined by ','
+      auto reg = "," + std::string(*iter) + ",";
+      auto passed = std::any_of(locs.begin(), locs.end(),
+          [&reg](const std::string& loc) {
+        return ("," + loc + ",").find(reg) != std::string::npos;
+      });
+      if (!passed)
+        free.push_back(*iter);
+    }
+  }
+  std::vector<Interval*> active;
+  std::vector<const char*> used;
+  for (auto cur: intervals) {
+    for (auto iter = active.begin(); iter != active.end(); ) {
+      if ((*iter)->end_ < cur->begin_) {
+        free.push_back((*iter)->reg_);
+        iter = active.erase(iter);
+      } else {
+        ++iter;
+      }
+    }
+
+    if (free.size()) {
+      cur->reg_ = free.back();
+      free.pop_back();
+    } else {
+      // Spill the interval used the least
+      auto victim = std::min_element(active.begin(), active.end(),
+          [](const Interval* lhs, const Interval* rhs) {
+        return lhs->uses_ < rhs->uses_;
+      });
+      if ((*victim)->uses_ >= cur->uses_)
+        continue;
+      cur->reg_ = (*victim)->reg_;
+      (*victim)->reg_ = nullptr;
+      active.erase(victim);
+    }
+    active.push_back(cur);
+    auto callee = std::find(Regs().begin(), Regs().end(), cur->reg_);
+    if (callee != Regs().end()
+        && std::find(used.begin(), used.end(), cur->reg_) == used.end()) {
+      used.push_back(cur->reg_);
+    }
+  }
+
+  for (auto interval: intervals)
+    interval->obj_->SetReg(interval->reg_);
+
+  // The caller-saved registers left are for temporaries
+  for (auto reg: free) {
+    auto leaf = std::find(LeafRegs().begin(), LeafRegs().end(), reg);
+    auto busy = std::any_of(intervals.begin(), intervals.end(),
+        [reg](const Interval* interval) { return interval->reg_ == reg; });
+    if (leaf != LeafRegs().end() && !busy)
+      leafTemps_.push_back(reg);
+  }
+  return used;
+}
+
+
+bool RegAllocator::HasCall(Expr* expr)
+{
+  RegAllocator allocator;
+  expr->Accept(&allocator);
+  return allocator.hasCall_;
+}
+
+
+void RegAllocator::VisitBinaryOp(BinaryOp* binary)
+{
+  // The address of the member is in the object
+  if (binary->op_ == '.' && binary == addrOperand_)
+    addrOperand_ = binary->lhs_;
+  binary->lhs_->Accept(this);
+  // The rhs of '.' is the member
+  if (binary->op_ != '.')
+    binary->rhs_->Accept(this);
+}
+
+
+void RegAllocator::VisitUnaryOp(UnaryOp* unary)
+{
+  if (unary->op_ == Token::ADDR)
+    addrOperand_ = unary->operand_;
+  unary->operand_->Accept(this);
+}
+
+
+void RegAllocator::VisitConditionalOp(ConditionalOp* condOp)
+{
+  condOp->cond_->Accept(this);
+  condOp->exprTrue_->Accept(this);
+  condOp->exprFalse_->Accept(this);
+}
+
+
+void RegAllocator::VisitFuncCall(FuncCall* funcCall)
+{
+  if (!Parser::IsBuiltin(funcCall->FuncType()))
+    hasCall_ = true;
+  funcCall->Designator()->Accept(this);
+  for (auto arg: *funcCall->Args())
+    arg->Accept(this);
+}
+
+
+void RegAllocator::VisitObject(Object* obj)
+{
+  if (obj == addrOperand_)
+    addrTaken_.insert(obj);
+  ++uses_[obj];
+  // The compound literal is initialized where it is used
+  if (obj->Anonymous() && obj->Decl())
+    VisitDeclaration(obj->Decl());
+}
+
+
+void RegAllocator::VisitDeclaration(Declaration* decl)
+{
+  ++uses_[decl->Obj()];
+  for (const auto& init: decl->Inits())
+    init.expr_->Accept(this);
+}
+
+
+void RegAllocator::VisitIfStmt(IfStmt* ifStmt)
+{
+  ifStmt->cond_->Accept(this);
+  ifStmt->then_->Accept(this);
+  if (ifStmt->else_)
+    ifStmt->else_->Accept(this);
+}
+
+
+void RegAllocator::VisitReturnStmt(ReturnStmt* returnStmt)
+{
+  if (returnStmt->expr_)
+    returnStmt->expr_->Accept(this);
+}
+
+
+void RegAllocator::VisitCompoundStmt(CompoundStmt* compStmt)
+{
+  auto begin = pos_++;
+  auto first = intervals_.size();
+  auto scope = compStmt->Scope();
+  if (scope) {
+    for (auto iter = scope->begin(); iter != scope->end(); ++iter) {
+      auto obj = iter->second->ToObject();
+      if (obj && Promotable(obj))
+        intervals_.push_back({obj, begin, 0, 0, nullptr});
+    }
+  }
+  auto last = intervals_.size();
+
+  for (auto stmt: compStmt->Stmts())
+    stmt->Accept(this);
+
+  auto end = pos_++;
+  for (auto i = first; i < last; ++i)
+    intervals_[i].end_ = end;
+}
@@ -0,0 +1,88 @@
+#ifndef _WGTCC_REG_ALLOC_H_
+#define _WGTCC_REG_ALLOC_H_
+
+#include "ast.h"
+#include "visitor.h"
+
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+
+/*
+ * Linear scan register allocation for the objects of a function.
+ * The live interval of an object is the extent of its block,
+ * which covers the back edges of the loops inside the block.
+ * Objects are scalars of integer or pointer type that are neither
+ * address taken nor volatile. They are kept in the callee-saved
+ * registers, thus survive function calls. The registers not
+ * allocated to any object are left for expression temporaries.
+ * A leaf function allocates the caller-saved registers first,
+ * which need not be saved, and its params stay in them.
+ */
+class RegAllocator: public Visitor
+{
+public:
+  RegAllocator(): pos_(0), addrOperand_(nullptr), hasCall_(false) {}
+
+  // Callee-saved registers, in the order of allocation
+  static const std::vector<const char*>& Regs();
+  // Caller-saved registers not used by the generator out of calls
+  static const std::vector<const char*>& LeafRegs();
+
+  // Set the registers of the objects in 'funcDef', whose params
+  // are passed in 'locs', returns the callee-saved registers allocated.
+  std::vector<const char*> Alloc(FuncDef* funcDef,
+      const std::vector<std::string>& locs);
+  // The objects whose address is taken by '&', found by Alloc()
+  const std::unordered_set<Object*>& AddrTaken() const {
+    return addrTaken_;
+  }
+  // Whether evaluating 'expr' calls a function
+  static bool HasCall(Expr* expr);
+  // The caller-saved registers free for temporaries of leaf function
+  const std::vector<const char*>& LeafTemps() const {
+    return leafTemps_;
+  }
+
+  virtual void VisitBinaryOp(BinaryOp* binary);
+  virtual void VisitUnaryOp(UnaryOp* unary);
+  virtual void VisitConditionalOp(ConditionalOp* condOp);
+  virtual void VisitFuncCall(FuncCall* funcCall);
+  virtual void VisitObject(Object* obj);
+  virtual void VisitEnumerator(Enumerator* enumer) {}
+  virtual void VisitIdentifier(Identifier* ident) {}
+  virtual void VisitConstant(Constant* cons) {}
+  virtual void VisitTempVar(TempVar* tempVar) {}
+
+  virtual void VisitDeclaration(Declaration* decl);
+  virtual void VisitEmptyStmt(EmptyStmt* emptyStmt) {}
+  virtual void VisitIfStmt(IfStmt* ifStmt);
+  virtual void VisitJumpStmt(JumpStmt* jumpStmt) {}
+  virtual void VisitSwitchStmt(SwitchStmt* switchStmt) {}
+  virtual void VisitReturnStmt(ReturnStmt* returnStmt);
+  virtual void VisitLabelStmt(LabelStmt* labelStmt) {}
+  virtual void VisitCompoundStmt(CompoundStmt* compStmt);
+
+  virtual void VisitFuncDef(FuncDef* funcDef) { assert(false); }
+  virtual void VisitTranslationUnit(TranslationUnit* unit) { assert(false); }
+
+private:
+  struct Interval {
+    Object* obj_;
+    int begin_;
+    int end_;
+    int uses_;
+    const char* reg_;
+  };
+
+  std::vector<Interval> intervals_;
+  std::unordered_map<Object*, int> uses_;
+  std::unordered_set<Object*> addrTaken_;
+  std::vector<const char*> leafTemps_;
+  int pos_;
+  Expr* addrOperand_;
+  bool hasCall_;
+};
+
+#endif
@@ -4,6 +4,20 @@
 
 #include <cassert>
 #include <iostream>
+#include <unordered_map>
+
+
+// Scopes are created during static initialization
+static std::unordered_map<std::string, Symbol>& Symbols()
+{
+  static std::unordered_map<std::string, Symbol> symbols;
+  return symbols;
+}
+
+// Number of active scopes
+static int activeDepth = 0;
+
+static unsigned long serial = 0;
 
 
 Identifier* Scope::Find(const Token* tok)
@@ -41,24 +55,115 @@ void Scope::Insert(Identifier* ident)
 
 void Scope::InsertTag(Identifier* ident)
 {
-  Insert(TagName(ident->Name()), ident);
+  auto sym = Intern(ident->Name());
+  assert(tagMap_.find(sym) == tagMap_.end());
+  tagMap_[sym] = ident;
+  tagList_.push_back(ident);
+  if (depth_)
+    Bind(sym->tags_, ident);
+}
+
+
+void Scope::Enter()
+{
+  assert(depth_ == 0);
+  depth_ = ++activeDepth;
+  for (auto& kv: identMap_)
+    Bind(kv.first->idents_, kv.second);
+  for (auto& kv: tagMap_)
+    Bind(kv.first->tags_, kv.second);
+}
+
+
+void Scope::Leave()
+{
+  assert(depth_ == activeDepth);
+  for (auto& kv: identMap_) {
+    assert(kv.first->idents_.back().scope_ == this);
+    kv.first->idents_.pop_back();
+  }
+  for (auto& kv: tagMap_) {
+    assert(kv.first->tags_.back().scope_ == this);
+    kv.first->tags_.pop_back();
+  }
+  depth_ = 0;
+  --activeDepth;
+}
+
+
+// Keep the bindings ordered by depth,
+// even if a binding is added to an outer scope
+void Scope::Bind(Symbol::BindingList& bindings, Identifier* ident)
+{
+  auto iter = bindings.end();
+  while (iter != bindings.begin() && (iter - 1)->scope_->depth_ > depth_)
+    --iter;
+  bindings.insert(iter, {this, ident, ++serial});
+}
+
+
+// The innermost binding that is visible from this scope
+Identifier* Scope::Lookup(const Symbol::BindingList& bindings) const
+{
+  for (auto iter = bindings.rbegin(); iter != bindings.rend(); ++iter) {
+    if (iter->scope_->depth_ <= depth_ && iter->serial_ <= iter->scope_->visible_)
+      return iter->ident_;
+  }
+  return nullptr;
+}
+
+
+unsigned long Scope::Serial()
+{
+  return serial;
+}
+
+
+Symbol* Scope::Intern(const std::string& name)
+{
+  auto iter = Symbols().find(name);
+  if (iter == Symbols().end()) {
+    iter = Symbols().insert({name, Symbol()}).first;
+    iter->second.name_ = &iter->first;
+  }
+  return &iter->second;
+}
+
+
+// Names that are never interned are not declared in any scope
+Symbol* Scope::FindSymbol(const std::string& name)
+{
+  auto iter = Symbols().find(name);
+  if (iter == Symbols().end())
+    return nullptr;
+  return &iter->second;
 }
 
 
 Identifier* Scope::Find(const std::string& name)
 {
-  auto ident = identMap_.find(name);
-  if (ident != identMap_.end())
-    return ident->second;
-  if (type_ == S_FILE || parent_ == nullptr)
+  auto sym = FindSymbol(name);
+  if (sym == nullptr)
     return nullptr;
-  return parent_->Find(name);
+  if (depth_)
+    return Lookup(sym->idents_);
+  for (auto scope = this; scope; scope = scope->parent_) {
+    auto ident = scope->identMap_.find(sym);
+    if (ident != scope->identMap_.end())
+      return ident->second;
+    if (scope->type_ == S_FILE)
+      break;
+  }
+  return nullptr;
 }
 
 
 Identifier* Scope::FindInCurScope(const std::string& name)
 {
-  auto ident = identMap_.find(name);
+  auto sym = FindSymbol(name);
+  if (sym == nullptr)
+    return nullptr;
+  auto ident = identMap_.find(sym);
   if (ident == identMap_.end())
     return nullptr;
   return ident->second;
@@ -67,33 +172,52 @@ Identifier* Scope::FindInCurScope(const std::string& name)
 
 void Scope::Insert(const std::string& name, Identifier* ident)
 {
-  assert(FindInCurScope(name) == nullptr);
-  identMap_[name] = ident;
+  auto sym = Intern(name);
+  assert(identMap_.find(sym) == identMap_.end());
+  identMap_[sym] = ident;
+  identList_.push_back({sym->name_, ident});
+  if (depth_)
+    Bind(sym->idents_, ident);
 }
 
 
 Identifier* Scope::FindTag(const std::string& name) {
-  auto tag = Find(TagName(name));
-  if (tag) assert(tag->ToTypeName());
-  return tag;
+  auto sym = FindSymbol(name);
+  if (sym == nullptr)
+    return nullptr;
+  if (depth_) {
+    auto tag = Lookup(sym->tags_);
+    assert(tag == nullptr || tag->ToTypeName());
+    return tag;
+  }
+  for (auto scope = this; scope; scope = scope->parent_) {
+    auto tag = scope->tagMap_.find(sym);
+    if (tag != scope->tagMap_.end()) {
+      assert(tag->second->ToTypeName());
+      return tag->second;
+    }
+    if (scope->type_ == S_FILE)
+      break;
+  }
+  return nullptr;
 }
 
 
 Identifier* Scope::FindTagInCurScope(const std::string& name) {
-  auto tag = FindInCurScope(TagName(name));
-  assert(tag == nullptr || tag->ToTypeName());
-  return tag;
+  auto sym = FindSymbol(name);
+  if (sym == nullptr)
+    return nullptr;
+  auto tag = tagMap_.find(sym);
+  if (tag == tagMap_.end())
+    return nullptr;
+  assert(tag->second->ToTypeName());
+  return tag->second;
 }
 
 
 Scope::TagList Scope::AllTagsInCurScope() const
 {
-  TagList tags;
-  for (auto& kv: identMap_) {
-    if (IsTagName(kv.first))
-      tags.push_back(kv.second);
-  }
-  return tags;
+  return tagList_;
 }
 
 
@@ -101,9 +225,9 @@ void Scope::Print()
 {
   std::cout << "scope: " << this << std::endl;
 
-  auto iter = identMap_.begin();
-  for (; iter != identMap_.end(); iter++) {
-    auto name = iter->first;
+  auto iter = identList_.begin();
+  for (; iter != identList_.end(); iter++) {
+    auto name = *iter->first;
     auto ident = iter->second;
     if (ident->ToTypeName()) {
       std::cout << name << "\t[type:\t"
@@ -1,13 +1,16 @@
 #ifndef _WGTCC_SCOPE_H_
 #define _WGTCC_SCOPE_H_
 
+#include <climits>
 #include <iostream>
-#include <map>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 
 class Identifier;
+class Scope;
 class Token;
 
 
@@ -19,15 +22,47 @@ enum ScopeType {
 };
 
 
+/*
+ * Interned name.
+ * It keeps the bindings of the name in the active scopes,
+ * ordered by the depth of scope, thus the innermost visible
+ * binding is the last one (the shadow stack).
+ */
+struct Symbol
+{
+  // Bindings are numbered in the order they are made
+  struct Binding {
+    Scope* scope_;
+    Identifier* ident_;
+    unsigned long serial_;
+  };
+  typedef std::vector<Binding> BindingList;
+
+  const std::string* name_;
+  BindingList idents_;
+  BindingList tags_;
+};
+
+
+/*
+ * The hash tables of scopes are keyed by the interned symbol.
+ * Ordinary identifiers and tags are in separate name spaces.
+ * The scopes being parsed are active, they are entered and left
+ * in stack order. Lookups from active scopes go directly to
+ * the bindings of the symbol, no matter how deep the scope chain is.
+ */
 class Scope
 {
+  friend class Serializer;
   friend class StructType;
   typedef std::vector<Identifier*> TagList;
-  typedef std::map<std::string, Identifier*> IdentMap;
+  typedef std::unordered_map<Symbol*, Identifier*> IdentMap;
+  // Identifiers in the order of insertion
+  typedef std::vector<std::pair<const std::string*, Identifier*>> IdentList;
 
 public:
   explicit Scope(Scope* parent, enum ScopeType type)
-      : parent_(parent), type_(type) {}
+      : parent_(parent), type_(type), depth_(0), visible_(ULONG_MAX) {}
   
   ~Scope() {}
 
@@ -43,6 +78,22 @@ public:
     return type_;
   }
 
+  // Push/pop the bindings of this scope
+  void Enter();
+  void Leave();
+
+  // The number of bindings made so far
+  static unsigned long Serial();
+
+  // The bindings of this scope made after 'serial' are not visible
+  void HideAfter(unsigned long serial) {
+    visible_ = serial;
+  }
+
+  void ShowAll() {
+    visible_ = ULONG_MAX;
+  }
+
   Identifier* Find(const Token* tok);
   Identifier* FindInCurScope(const Token* tok);
   Identifier* FindTag(const Token* tok);
@@ -59,32 +110,30 @@ public:
     return type_ == other.type_;
   }
 
-  IdentMap::iterator begin() {
-    return identMap_.begin();
+  IdentList::iterator begin() {
+    return identList_.begin();
   }
 
-  IdentMap::iterator end() {
-    return identMap_.end();
+  IdentList::iterator end() {
+    return identList_.end();
   }
 
   size_t size() const {
-    return identMap_.size();
+    return identList_.size();
   }
 
   void Insert(const std::string& name, Identifier* ident);
 
 private:
+  static Symbol* Intern(const std::string& name);
+  static Symbol* FindSymbol(const std::string& name);
+  void Bind(Symbol::BindingList& bindings, Identifier* ident);
+  Identifier* Lookup(const Symbol::BindingList& bindings) const;
+
   Identifier* Find(const std::string& name);
   Identifier* FindInCurScope(const std::string& name);
   Identifier* FindTag(const std::string& name);
   Identifier* FindTagInCurScope(const std::string& name);
-  std::string TagName(const std::string& name) {
-    return name + "@:tag";
-  }
-  static bool IsTagName(const std::string& name) {
-    return name.size() > 5 && name[name.size() - 5] == '@';
-  }
-  //void Insert(const std::string& name, Identifier* ident);
 
   const Scope& operator=(const Scope& other);
   Scope(const Scope& scope);
@@ -92,8 +141,14 @@ private:
 
   Scope* parent_;
   enum ScopeType type_;
+  // Nesting depth while active; 0 if not active
+  int depth_;
+  unsigned long visible_;
 
   IdentMap identMap_;
+  IdentList identList_;
+  IdentMap tagMap_;
+  TagList tagList_;
 };
 
 #endif
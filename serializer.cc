@@ -0,0 +1,1151 @@
+#include "serializer.h"
+
+#include "ast.h"
+#include "mem_pool.h"
+#include "parser.h"
+#include "scope.h"
+#include "type.h"
+#include "visitor.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/*
+ * The image:
+ *   the header;
+ *   the offsets of the strings, then of the nodes, 4 bytes each;
+ *   the strings, each is its length followed by the bytes;
+ *   the records of the nodes.
+ * The nodes are numbered from 1 in the order they are reached from
+ * the root, node 1. A record is the kind of the node followed by its
+ * fields. Integers are variable length, a pointer is the number of
+ * the node and a string is the number of the string, 0 for nullptr.
+ */
+
+enum NodeKind {
+  N_TOKEN = 1,
+  N_SCOPE,
+
+  N_VOID,
+  N_ARITHM,
+  N_POINTER,
+  N_ARRAY,
+  N_FUNC,
+  N_VA_START,
+  N_VA_ARG,
+  N_STRUCT,
+
+  N_BINARY,
+  N_UNARY,
+  N_COND,
+  N_CALL,
+  N_CONSTANT,
+  N_TEMPVAR,
+  N_IDENT,
+  N_ENUMERATOR,
+  N_OBJECT,
+
+  N_DECL,
+  N_EMPTY,
+  N_IF,
+  N_JUMP,
+  N_SWITCH,
+  N_RETURN,
+  N_LABEL,
+  N_COMPOUND,
+  N_FUNCDEF,
+  N_UNIT,
+};
+
+
+struct Header {
+  char magic_[8];
+  uint32_t version_;
+  // The last tag of the global label numbering
+  uint32_t lastTag_;
+  uint32_t strings_;
+  uint32_t nodes_;
+};
+
+static const char magic[8] = {'w', 'g', 't', 'c', 'c', 'a', 's', 't'};
+static const uint32_t version = 1;
+
+
+// 7 bits a byte, the high bit is set if more bytes follow
+static void AppendUInt(std::string& buf, unsigned long val)
+{
+  while (val >= 0x80) {
+    buf.push_back((val & 0x7f) | 0x80);
+    val >>= 7;
+  }
+  buf.push_back(val);
+}
+
+
+class Serializer::Writer: public Visitor
+{
+public:
+  // The key of a function leaves out what does not affect its code
+  explicit Writer(bool key): key_(key) {}
+
+  std::string Write(ASTNode* root);
+
+  const std::vector<LabelStmt*>& Labels() const {
+    return labels_;
+  }
+
+  virtual void VisitBinaryOp(BinaryOp* binary);
+  virtual void VisitUnaryOp(UnaryOp* unary);
+  virtual void VisitConditionalOp(ConditionalOp* condOp);
+  virtual void VisitFuncCall(FuncCall* funcCall);
+  virtual void VisitEnumerator(Enumerator* enumer);
+  virtual void VisitIdentifier(Identifier* ident);
+  virtual void VisitObject(Object* obj);
+  virtual void VisitConstant(Constant* cons);
+  virtual void VisitTempVar(TempVar* tempVar);
+
+  virtual void VisitDeclaration(Declaration* decl);
+  virtual void VisitEmptyStmt(EmptyStmt* emptyStmt);
+  virtual void VisitIfStmt(IfStmt* ifStmt);
+  virtual void VisitJumpStmt(JumpStmt* jumpStmt);
+  virtual void VisitSwitchStmt(SwitchStmt* switchStmt);
+  virtual void VisitReturnStmt(ReturnStmt* returnStmt);
+  virtual void VisitLabelStmt(LabelStmt* labelStmt);
+  virtual void VisitCompoundStmt(CompoundStmt* compStmt);
+  virtual void VisitFuncDef(FuncDef* funcDef);
+  virtual void VisitTranslationUnit(TranslationUnit* unit);
+
+private:
+  enum Class { C_TOKEN, C_SCOPE, C_TYPE, C_NODE };
+  struct Pending {
+    Class class_;
+    const void* ptr_;
+  };
+
+  void PutByte(int byte) { data_.push_back(byte); }
+  void PutUInt(unsigned long val) { AppendUInt(data_, val); }
+  void PutInt(long val) {
+    PutUInt((static_cast<unsigned long>(val) << 1) ^ (val >> 63));
+  }
+  uint32_t StringNumber(const std::string& str);
+  void PutString(const std::string* str) {
+    PutUInt(str ? StringNumber(*str): 0);
+  }
+  uint32_t NodeNumber(Class cls, const void* ptr);
+  void Put(const Token* tok) { PutUInt(NodeNumber(C_TOKEN, tok)); }
+  void Put(Scope* scope) { PutUInt(NodeNumber(C_SCOPE, scope)); }
+  void Put(Type* type) { PutUInt(NodeNumber(C_TYPE, type)); }
+  void Put(ASTNode* node) { PutUInt(NodeNumber(C_NODE, node)); }
+  void PutExpr(int kind, Expr* expr);
+
+  void WriteToken(const Token* tok);
+  void WriteScope(Scope* scope);
+  void WriteType(Type* type);
+
+  bool key_;
+  std::string data_;
+  std::vector<uint32_t> offsets_;
+  std::vector<Pending> pending_;
+  std::unordered_map<const void*, uint32_t> nodes_;
+
+  std::string strData_;
+  std::vector<uint32_t> strOffsets_;
+  std::unordered_map<std::string, uint32_t> strings_;
+  std::unordered_map<const char*, uint32_t> lines_;
+
+  std::vector<LabelStmt*> labels_;
+};
+
+
+class Serializer::Reader
+{
+public:
+  struct Corrupt {};
+
+  Reader(const char* begin, size_t size)
+      : begin_(begin), end_(begin + size), cur_(begin) {}
+
+  TranslationUnit* Read();
+
+private:
+  struct Shell {
+    int kind_;
+    Token* tok_;
+    Scope* scope_;
+    Type* type_;
+    ASTNode* node_;
+  };
+
+  void Seek(size_t offset);
+  uint32_t Word(size_t offset);
+  int Byte();
+  unsigned long UInt();
+  long Int() {
+    auto val = UInt();
+    return static_cast<long>(val >> 1) ^ -static_cast<long>(val & 1);
+  }
+  const std::string* String();
+  size_t Ref();
+  Token* TokenRef();
+  Scope* ScopeRef();
+  Type* TypeRef();
+  template <class T> T* Node();
+  void ReadExpr(Expr* expr);
+
+  void NewShell(Shell& shell);
+  void Fill(Shell& shell);
+  void FillType(Shell& shell);
+  void FillNode(Shell& shell);
+
+  const char* begin_;
+  const char* end_;
+  const char* cur_;
+
+  std::vector<const std::string*> strings_;
+  std::vector<Shell> shells_;
+  // The qualifiers of the shared types are set
+  // only if the whole image is valid
+  std::vector<std::pair<Type*, int>> quals_;
+  std::vector<StructType*> structs_;
+  Expr* dummy_ {nullptr};
+};
+
+
+/*
+ * Writer
+ */
+
+std::string Serializer::Writer::Write(ASTNode* root)
+{
+  NodeNumber(C_NODE, root);
+  for (size_t i = 0; i < pending_.size(); ++i) {
+    offsets_.push_back(data_.size());
+    auto pending = pending_[i];
+    switch (pending.class_) {
+    case C_TOKEN:
+      WriteToken(static_cast<const Token*>(pending.ptr_));
+      break;
+    case C_SCOPE:
+      WriteScope(static_cast<Scope*>(const_cast<void*>(pending.ptr_)));
+      break;
+    case C_TYPE:
+      WriteType(static_cast<Type*>(const_cast<void*>(pending.ptr_)));
+      break;
+    case C_NODE:
+      static_cast<ASTNode*>(const_cast<void*>(pending.ptr_))->Accept(this);
+      break;
+    }
+  }
+
+  Header header;
+  memcpy(header.magic_, magic, sizeof(magic));
+  header.version_ = version;
+  header.lastTag_ = key_ ? 0: LabelStmt::lastTag_;
+  header.strings_ = strOffsets_.size();
+  header.nodes_ = offsets_.size();
+
+  size_t begin = sizeof(header)
+      + (strOffsets_.size() + offsets_.size()) * sizeof(uint32_t);
+  std::vector<uint32_t> table;
+  for (auto offset: strOffsets_)
+    table.push_back(begin + offset);
+  for (auto offset: offsets_)
+    table.push_back(begin + strData_.size() + offset);
+
+  std::string image(reinterpret_cast<const char*>(&header), sizeof(header));
+  image.append(reinterpret_cast<const char*>(table.data()),
+      table.size() * sizeof(uint32_t));
+  image += strData_;
+  image += data_;
+  return image;
+}
+
+
+
+
+uint32_t Serializer::Writer::StringNumber(const std::string& str)
+{
+  auto iter = strings_.find(str);
+  if (iter == strings_.end()) {
+    iter = strings_.insert({str, strOffsets_.size() + 1}).first;
+    strOffsets_.push_back(strData_.size());
+    AppendUInt(strData_, str.size());
+    strData_ += str;
+  }
+  return iter->second;
+}
+
+
+// The node is numbered when it is first referred,
+// its record is written after the records before it
+uint32_t Serializer::Writer::NodeNumber(Class cls, const void* ptr)
+{
+  if (ptr == nullptr)
+    return 0;
+  auto iter = nodes_.find(ptr);
+  if (iter == nodes_.end()) {
+    iter = nodes_.insert({ptr, pending_.size() + 1}).first;
+    pending_.push_back({cls, ptr});
+  }
+  return iter->second;
+}
+
+
+void Serializer::Writer::WriteToken(const Token* tok)
+{
+  PutByte(N_TOKEN);
+  PutString(&tok->str_);
+  if (key_)
+    return;
+  PutInt(tok->tag_);
+  PutByte(tok->ws_);
+  const auto& loc = tok->loc_;
+  PutString(loc.fileName_);
+  PutUInt(loc.line_);
+  PutUInt(loc.column_);
+  // The source line for the diagnostics
+  if (loc.lineBegin_ == nullptr)
+    return PutUInt(0);
+  auto iter = lines_.find(loc.lineBegin_);
+  if (iter == lines_.end()) {
+    std::string line(loc.lineBegin_, strcspn(loc.lineBegin_, "\n"));
+    iter = lines_.insert({loc.lineBegin_, StringNumber(line)}).first;
+  }
+  PutUInt(iter->second);
+}
+
+
+void Serializer::Writer::WriteScope(Scope* scope)
+{
+  PutByte(N_SCOPE);
+  PutInt(scope->type_);
+  PutUInt(scope->size());
+  for (auto& kv: *scope) {
+    PutString(kv.first);
+    Put(kv.second);
+  }
+}
+
+
+void Serializer::Writer::WriteType(Type* type)
+{
+  // The builtins are recognized by their types
+  if (type == Parser::vaStartType_)
+    return PutByte(N_VA_START);
+  if (type == Parser::vaArgType_)
+    return PutByte(N_VA_ARG);
+
+  if (type->ToVoid()) {
+    PutByte(N_VOID);
+  } else if (type->ToArithm()) {
+    PutByte(N_ARITHM);
+    PutInt(type->ToArithm()->Tag());
+  } else if (type->ToPointer()) {
+    PutByte(N_POINTER);
+    Put(type->ToPointer()->derived_);
+  } else if (type->ToArray()) {
+    auto arrayType = type->ToArray();
+    PutByte(N_ARRAY);
+    Put(arrayType->derived_);
+    PutInt(arrayType->len_);
+  } else if (type->ToFunc()) {
+    auto funcType = type->ToFunc();
+    PutByte(N_FUNC);
+    Put(funcType->derived_);
+    PutInt(funcType->inlineNoReturn_);
+    PutByte(funcType->variadic_);
+    PutUInt(funcType->params_.size());
+    for (auto param: funcType->params_)
+      Put(param);
+  } else {
+    auto structType = type->ToStruct();
+    assert(structType);
+    PutByte(N_STRUCT);
+    PutByte(structType->isStruct_);
+    PutByte(structType->hasTag_);
+    // The type being defined has no index
+    PutByte(structType->memberMap_ != nullptr);
+    PutUInt(structType->members_.size());
+    for (auto member: structType->members_)
+      Put(member);
+    // The index is sorted by the address of the symbols,
+    // it is written in the order of the names
+    auto index = structType->memberIndex_;
+    std::sort(index.begin(), index.end(),
+        [](const StructType::MemberIndex::value_type& lhs,
+           const StructType::MemberIndex::value_type& rhs) {
+      return *lhs.first->name_ < *rhs.first->name_;
+    });
+    PutUInt(index.size());
+    for (auto& kv: index) {
+      PutString(kv.first->name_);
+      Put(kv.second);
+    }
+    PutInt(structType->offset_);
+    PutInt(structType->width_);
+    PutInt(structType->align_);
+  }
+  // The qualifiers of the shared arithmetic types are changed by
+  // the parser, the code generator sees the last ones
+  PutInt(type->Qual());
+  PutByte(type->Complete());
+}
+
+
+void Serializer::Writer::PutExpr(int kind, Expr* expr)
+{
+  PutByte(kind);
+  Put(expr->tok_);
+  Put(expr->type_);
+}
+
+
+void Serializer::Writer::VisitBinaryOp(BinaryOp* binary)
+{
+  PutExpr(N_BINARY, binary);
+  PutInt(binary->op_);
+  Put(binary->lhs_);
+  Put(binary->rhs_);
+}
+
+
+void Serializer::Writer::VisitUnaryOp(UnaryOp* unary)
+{
+  PutExpr(N_UNARY, unary);
+  PutInt(unary->op_);
+  Put(unary->operand_);
+}
+
+
+void Serializer::Writer::VisitConditionalOp(ConditionalOp* condOp)
+{
+  PutExpr(N_COND, condOp);
+  Put(condOp->cond_);
+  Put(condOp->exprTrue_);
+  Put(condOp->exprFalse_);
+}
+
+
+void Serializer::Writer::VisitFuncCall(FuncCall* funcCall)
+{
+  PutExpr(N_CALL, funcCall);
+  Put(funcCall->designator_);
+  PutUInt(funcCall->args_.size());
+  for (auto arg: funcCall->args_)
+    Put(arg);
+}
+
+
+void Serializer::Writer::VisitEnumerator(Enumerator* enumer)
+{
+  PutExpr(N_ENUMERATOR, enumer);
+  PutInt(enumer->linkage_);
+  Put(enumer->_cons);
+}
+
+
+void Serializer::Writer::VisitIdentifier(Identifier* ident)
+{
+  PutExpr(N_IDENT, ident);
+  PutInt(ident->linkage_);
+}
+
+
+// The registers are allocated by the code generator,
+// after the AST is written
+void Serializer::Writer::VisitObject(Object* obj)
+{
+  PutExpr(N_OBJECT, obj);
+  PutInt(obj->linkage_);
+  PutInt(obj->storage_);
+  PutInt(obj->offset_);
+  PutInt(obj->align_);
+  // The declaration of a named object is in the body declaring it,
+  // that of a compound literal is generated where it is used
+  if (!key_ || obj->anonymous_)
+    Put(obj->decl_);
+  else
+    PutUInt(0);
+  PutByte(obj->bitFieldBegin_);
+  PutByte(obj->bitFieldWidth_);
+  PutByte(obj->anonymous_);
+  PutInt(obj->id_);
+}
+
+
+void Serializer::Writer::VisitConstant(Constant* cons)
+{
+  PutExpr(N_CONSTANT, cons);
+  if (cons->type_ && cons->type_->ToArray()) {
+    PutByte(1);
+    PutInt(key_ ? 0: cons->id_);
+    PutString(cons->sval_);
+  } else {
+    // Also the bits of the floating value
+    PutByte(0);
+    PutInt(cons->ival_);
+  }
+}
+
+
+void Serializer::Writer::VisitTempVar(TempVar* tempVar)
+{
+  PutExpr(N_TEMPVAR, tempVar);
+  PutInt(key_ ? 0: tempVar->tag_);
+}
+
+
+void Serializer::Writer::VisitDeclaration(Declaration* decl)
+{
+  PutByte(N_DECL);
+  Put(decl->obj_);
+  PutUInt(decl->inits_.size());
+  for (auto& init: decl->inits_) {
+    Put(init.type_);
+    PutInt(init.offset_);
+    PutByte(init.bitFieldBegin_);
+    PutByte(init.bitFieldWidth_);
+    Put(init.expr_);
+  }
+}
+
+
+void Serializer::Writer::VisitEmptyStmt(EmptyStmt* emptyStmt)
+{
+  PutByte(N_EMPTY);
+}
+
+
+void Serializer::Writer::VisitIfStmt(IfStmt* ifStmt)
+{
+  PutByte(N_IF);
+  Put(ifStmt->cond_);
+  Put(ifStmt->then_);
+  Put(ifStmt->else_);
+}
+
+
+void Serializer::Writer::VisitJumpStmt(JumpStmt* jumpStmt)
+{
+  PutByte(N_JUMP);
+  Put(jumpStmt->label_);
+}
+
+
+void Serializer::Writer::VisitSwitchStmt(SwitchStmt* switchStmt)
+{
+  PutByte(N_SWITCH);
+  Put(switchStmt->cond_);
+  PutUInt(switchStmt->cases_.size());
+  for (auto& c: switchStmt->cases_) {
+    PutInt(c.lo_);
+    PutInt(c.hi_);
+    Put(c.label_);
+  }
+  Put(switchStmt->default_);
+  Put(switchStmt->end_);
+}
+
+
+void Serializer::Writer::VisitReturnStmt(ReturnStmt* returnStmt)
+{
+  PutByte(N_RETURN);
+  Put(returnStmt->expr_);
+}
+
+
+void Serializer::Writer::VisitLabelStmt(LabelStmt* labelStmt)
+{
+  PutByte(N_LABEL);
+  if (key_) {
+    labels_.push_back(labelStmt);
+  } else {
+    PutInt(labelStmt->space_);
+    PutInt(labelStmt->tag_);
+  }
+}
+
+
+void Serializer::Writer::VisitCompoundStmt(CompoundStmt* compStmt)
+{
+  PutByte(N_COMPOUND);
+  PutUInt(compStmt->stmts_.size());
+  for (auto stmt: compStmt->stmts_)
+    Put(stmt);
+  Put(compStmt->scope_);
+}
+
+
+void Serializer::Writer::VisitFuncDef(FuncDef* funcDef)
+{
+  PutByte(N_FUNCDEF);
+  Put(funcDef->ident_);
+  Put(funcDef->retLabel_);
+  Put(funcDef->body_);
+}
+
+
+void Serializer::Writer::VisitTranslationUnit(TranslationUnit* unit)
+{
+  PutByte(N_UNIT);
+  PutUInt(unit->extDecls_.size());
+  for (auto extDecl: unit->extDecls_)
+    Put(extDecl);
+}
+
+
+/*
+ * Reader
+ */
+
+TranslationUnit* Serializer::Reader::Read()
+{
+  Header header;
+  if (static_cast<size_t>(end_ - begin_) < sizeof(header))
+    throw Corrupt();
+  memcpy(&header, begin_, sizeof(header));
+  if (memcmp(header.magic_, magic, sizeof(magic)) != 0
+      || header.version_ != version || header.nodes_ == 0)
+    throw Corrupt();
+  size_t tables = sizeof(header)
+      + (size_t(header.strings_) + header.nodes_) * sizeof(uint32_t);
+  if (tables > static_cast<size_t>(end_ - begin_))
+    throw Corrupt();
+
+  strings_.push_back(nullptr);
+  for (size_t i = 0; i < header.strings_; ++i) {
+    Seek(Word(sizeof(header) + i * sizeof(uint32_t)));
+    auto len = UInt();
+    if (len > static_cast<size_t>(end_ - cur_))
+      throw Corrupt();
+    strings_.push_back(new std::string(cur_, len));
+  }
+
+  // All the nodes are allocated before any pointer is restored
+  auto nodes = sizeof(header) + header.strings_ * sizeof(uint32_t);
+  shells_.resize(header.nodes_ + 1);
+  dummy_ = Constant::New(nullptr, T_INT, 0L);
+  for (size_t i = 1; i < shells_.size(); ++i) {
+    Seek(Word(nodes + (i - 1) * sizeof(uint32_t)));
+    NewShell(shells_[i]);
+  }
+  for (size_t i = 1; i < shells_.size(); ++i) {
+    Seek(Word(nodes + (i - 1) * sizeof(uint32_t)));
+    Fill(shells_[i]);
+  }
+  if (shells_[1].kind_ != N_UNIT)
+    throw Corrupt();
+
+  for (auto& qual: quals_)
+    qual.first->SetQual(qual.second);
+  for (auto structType: structs_) {
+    auto& index = structType->memberIndex_;
+    std::sort(index.begin(), index.end());
+  }
+  LabelStmt::lastTag_ = header.lastTag_;
+  return static_cast<TranslationUnit*>(shells_[1].node_);
+}
+
+
+void Serializer::Reader::Seek(size_t offset)
+{
+  if (offset >= static_cast<size_t>(end_ - begin_))
+    throw Corrupt();
+  cur_ = begin_ + offset;
+}
+
+
+uint32_t Serializer::Reader::Word(size_t offset)
+{
+  uint32_t word;
+  memcpy(&word, begin_ + offset, sizeof(word));
+  return word;
+}
+
+
+int Serializer::Reader::Byte()
+{
+  if (cur_ == end_)
+    throw Corrupt();
+  return static_cast<unsigned char>(*cur_++);
+}
+
+
+unsigned long Serializer::Reader::UInt()
+{
+  unsigned long val = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    auto byte = Byte();
+    val |= static_cast<unsigned long>(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      return val;
+  }
+  throw Corrupt();
+}
+
+
+const std::string* Serializer::Reader::String()
+{
+  auto idx = UInt();
+  if (idx >= strings_.size())
+    throw Corrupt();
+  return strings_[idx];
+}
+
+
+size_t Serializer::Reader::Ref()
+{
+  auto idx = UInt();
+  if (idx >= shells_.size())
+    throw Corrupt();
+  return idx;
+}
+
+
+Token* Serializer::Reader::TokenRef()
+{
+  auto idx = Ref();
+  if (idx && shells_[idx].tok_ == nullptr)
+    throw Corrupt();
+  return shells_[idx].tok_;
+}
+
+
+Scope* Serializer::Reader::ScopeRef()
+{
+  auto idx = Ref();
+  if (idx && shells_[idx].scope_ == nullptr)
+    throw Corrupt();
+  return shells_[idx].scope_;
+}
+
+
+Type* Serializer::Reader::TypeRef()
+{
+  auto idx = Ref();
+  if (idx && shells_[idx].type_ == nullptr)
+    throw Corrupt();
+  return shells_[idx].type_;
+}
+
+
+template <class T>
+T* Serializer::Reader::Node()
+{
+  auto idx = Ref();
+  if (idx == 0)
+    return nullptr;
+  auto node = dynamic_cast<T*>(shells_[idx].node_);
+  if (node == nullptr)
+    throw Corrupt();
+  return node;
+}
+
+
+static bool IsArithmTag(long tag)
+{
+  switch (tag) {
+  case T_BOOL: case T_CHAR: case T_UNSIGNED | T_CHAR:
+  case T_SHORT: case T_UNSIGNED | T_SHORT:
+  case T_INT: case T_UNSIGNED | T_INT:
+  case T_LONG: case T_UNSIGNED | T_LONG:
+  case T_LLONG: case T_UNSIGNED | T_LLONG:
+  case T_FLOAT: case T_DOUBLE: case T_LONG | T_DOUBLE:
+    return true;
+  default:
+    return false;
+  }
+}
+
+
+// The nodes are allocated as the factories do,
+// the arguments are replaced by the fields later
+void Serializer::Reader::NewShell(Shell& shell)
+{
+  shell = {Byte(), nullptr, nullptr, nullptr, nullptr};
+  ASTNode* node = nullptr;
+  switch (shell.kind_) {
+  case N_TOKEN:
+    shell.tok_ = Token::New(Token::NOTOK);
+    return;
+  case N_SCOPE: {
+    auto type = Int();
+    if (type < S_FILE || type > S_FUNC)
+      throw Corrupt();
+    shell.scope_ = new Scope(nullptr, static_cast<ScopeType>(type));
+  } return;
+
+  case N_VOID: shell.type_ = VoidType::New(); return;
+  case N_ARITHM: {
+    auto tag = Int();
+    if (!IsArithmTag(tag))
+      throw Corrupt();
+    shell.type_ = ArithmType::New(tag);
+  } return;
+  case N_POINTER:
+    shell.type_ = new (Arena::Alloc<PointerType>()) PointerType(nullptr);
+    return;
+  case N_ARRAY:
+    shell.type_ = new (Arena::Alloc<ArrayType>()) ArrayType(-1, nullptr);
+    return;
+  case N_FUNC:
+    shell.type_ = new (Arena::Alloc<FuncType>())
+        FuncType(nullptr, 0, false, FuncType::ParamList());
+    return;
+  case N_VA_START: shell.type_ = Parser::vaStartType_; return;
+  case N_VA_ARG: shell.type_ = Parser::vaArgType_; return;
+  case N_STRUCT:
+    shell.type_ = new (Arena::Alloc<StructType>())
+        StructType(true, false, nullptr);
+    return;
+
+  case N_BINARY:
+    node = new (Arena::Alloc<BinaryOp>())
+        BinaryOp(nullptr, '.', nullptr, nullptr);
+    break;
+  case N_UNARY:
+    node = new (Arena::Alloc<UnaryOp>()) UnaryOp(Token::CAST, dummy_);
+    break;
+  case N_COND:
+    node = new (Arena::Alloc<ConditionalOp>())
+        ConditionalOp(dummy_, dummy_, dummy_);
+    break;
+  case N_CALL:
+    node = new (Arena::Alloc<FuncCall>())
+        FuncCall(dummy_, FuncCall::ArgList());
+    break;
+  case N_CONSTANT:
+    node = new (Arena::Alloc<Constant>()) Constant(nullptr, nullptr, 0L);
+    break;
+  case N_TEMPVAR: node = TempVar::New(nullptr); break;
+  case N_IDENT: node = Identifier::New(nullptr, nullptr, L_NONE); break;
+  case N_ENUMERATOR: node = Enumerator::New(nullptr, 0); break;
+  case N_OBJECT:
+    node = new (Arena::Alloc<Object>())
+        Object(nullptr, ArithmType::New(T_INT));
+    break;
+
+  case N_DECL: node = Declaration::New(nullptr); break;
+  case N_EMPTY: node = EmptyStmt::New(); break;
+  case N_IF: node = IfStmt::New(nullptr, nullptr); break;
+  case N_JUMP: node = JumpStmt::New(nullptr); break;
+  case N_SWITCH:
+    node = SwitchStmt::New(nullptr, SwitchStmt::CaseList(), nullptr, nullptr);
+    break;
+  case N_RETURN: node = ReturnStmt::New(nullptr); break;
+  case N_LABEL: node = LabelStmt::New(); break;
+  case N_COMPOUND: {
+    StmtList stmts;
+    node = CompoundStmt::New(stmts);
+  } break;
+  case N_FUNCDEF: node = FuncDef::New(nullptr, nullptr); break;
+  case N_UNIT: node = TranslationUnit::New(); break;
+  default: throw Corrupt();
+  }
+  shell.node_ = node;
+}
+
+
+void Serializer::Reader::Fill(Shell& shell)
+{
+  if (Byte() != shell.kind_)
+    throw Corrupt();
+  if (shell.tok_) {
+    auto tok = shell.tok_;
+    auto str = String();
+    if (str == nullptr)
+      throw Corrupt();
+    tok->str_ = *str;
+    tok->tag_ = Int();
+    tok->ws_ = Byte();
+    tok->loc_.fileName_ = String();
+    tok->loc_.line_ = UInt();
+    tok->loc_.column_ = UInt();
+    auto line = String();
+    tok->loc_.lineBegin_ = line ? line->c_str(): nullptr;
+  } else if (shell.scope_) {
+    Int();
+    auto size = UInt();
+    for (size_t i = 0; i < size; ++i) {
+      auto name = String();
+      auto ident = Node<Identifier>();
+      if (name == nullptr || ident == nullptr
+          || shell.scope_->FindInCurScope(*name))
+        throw Corrupt();
+      shell.scope_->Insert(*name, ident);
+    }
+  } else if (shell.type_) {
+    FillType(shell);
+  } else {
+    FillNode(shell);
+  }
+}
+
+
+void Serializer::Reader::FillType(Shell& shell)
+{
+  auto type = shell.type_;
+  switch (shell.kind_) {
+  case N_VA_START:
+  case N_VA_ARG:
+    return;
+  case N_VOID:
+    break;
+  case N_ARITHM:
+    Int();
+    break;
+  case N_POINTER:
+  case N_ARRAY:
+  case N_FUNC: {
+    auto derivedType = static_cast<DerivedType*>(type);
+    derivedType->derived_ = TypeRef();
+    if (derivedType->derived_ == nullptr)
+      throw Corrupt();
+    if (shell.kind_ == N_ARRAY) {
+      static_cast<ArrayType*>(type)->len_ = Int();
+    } else if (shell.kind_ == N_FUNC) {
+      auto funcType = static_cast<FuncType*>(type);
+      funcType->inlineNoReturn_ = Int();
+      funcType->variadic_ = Byte();
+      auto size = UInt();
+      for (size_t i = 0; i < size; ++i)
+        funcType->params_.push_back(Node<Object>());
+    }
+  } break;
+  case N_STRUCT: {
+    auto structType = static_cast<StructType*>(type);
+    structType->isStruct_ = Byte();
+    structType->hasTag_ = Byte();
+    if (!Byte()) {
+      delete structType->memberMap_;
+      structType->memberMap_ = nullptr;
+    }
+    auto size = UInt();
+    for (size_t i = 0; i < size; ++i)
+      structType->members_.push_back(Node<Object>());
+    size = UInt();
+    for (size_t i = 0; i < size; ++i) {
+      auto name = String();
+      auto member = Node<Object>();
+      if (name == nullptr)
+        throw Corrupt();
+      structType->memberIndex_.push_back({Scope::Intern(*name), member});
+    }
+    structType->offset_ = Int();
+    structType->width_ = Int();
+    structType->align_ = Int();
+    structs_.push_back(structType);
+  } break;
+  }
+
+  auto qual = Int();
+  auto complete = Byte();
+  if (shell.kind_ == N_VOID || shell.kind_ == N_ARITHM) {
+    quals_.push_back({type, qual});
+  } else {
+    type->SetQual(qual);
+    type->SetComplete(complete);
+  }
+}
+
+
+void Serializer::Reader::ReadExpr(Expr* expr)
+{
+  expr->tok_ = TokenRef();
+  expr->type_ = TypeRef();
+}
+
+
+void Serializer::Reader::FillNode(Shell& shell)
+{
+  switch (shell.kind_) {
+  case N_BINARY: {
+    auto binary = static_cast<BinaryOp*>(shell.node_);
+    ReadExpr(binary);
+    binary->op_ = Int();
+    binary->lhs_ = Node<Expr>();
+    binary->rhs_ = Node<Expr>();
+  } break;
+  case N_UNARY: {
+    auto unary = static_cast<UnaryOp*>(shell.node_);
+    ReadExpr(unary);
+    unary->op_ = Int();
+    unary->operand_ = Node<Expr>();
+  } break;
+  case N_COND: {
+    auto condOp = static_cast<ConditionalOp*>(shell.node_);
+    ReadExpr(condOp);
+    condOp->cond_ = Node<Expr>();
+    condOp->exprTrue_ = Node<Expr>();
+    condOp->exprFalse_ = Node<Expr>();
+  } break;
+  case N_CALL: {
+    auto funcCall = static_cast<FuncCall*>(shell.node_);
+    ReadExpr(funcCall);
+    funcCall->designator_ = Node<Expr>();
+    auto size = UInt();
+    for (size_t i = 0; i < size; ++i)
+      funcCall->args_.push_back(Node<Expr>());
+  } break;
+  case N_CONSTANT: {
+    auto cons = static_cast<Constant*>(shell.node_);
+    ReadExpr(cons);
+    if (Byte()) {
+      cons->id_ = Int();
+      cons->sval_ = String();
+    } else {
+      cons->ival_ = Int();
+    }
+  } break;
+  case N_TEMPVAR: {
+    auto tempVar = static_cast<TempVar*>(shell.node_);
+    ReadExpr(tempVar);
+    tempVar->tag_ = Int();
+  } break;
+  case N_IDENT:
+  case N_ENUMERATOR:
+  case N_OBJECT: {
+    auto ident = static_cast<Identifier*>(shell.node_);
+    ReadExpr(ident);
+    auto linkage = Int();
+    if (linkage < L_NONE || linkage > L_INTERNAL)
+      throw Corrupt();
+    ident->linkage_ = static_cast<Linkage>(linkage);
+    if (shell.kind_ == N_ENUMERATOR) {
+      static_cast<Enumerator*>(ident)->_cons = Node<Constant>();
+    } else if (shell.kind_ == N_OBJECT) {
+      auto obj = static_cast<Object*>(ident);
+      obj->storage_ = Int();
+      obj->offset_ = Int();
+      obj->align_ = Int();
+      obj->decl_ = Node<Declaration>();
+      obj->bitFieldBegin_ = Byte();
+      obj->bitFieldWidth_ = Byte();
+      obj->anonymous_ = Byte();
+      obj->id_ = Int();
+    }
+  } break;
+
+  case N_DECL: {
+    auto decl = static_cast<Declaration*>(shell.node_);
+    decl->obj_ = Node<Object>();
+    auto size = UInt();
+    for (size_t i = 0; i < size; ++i) {
+      auto type = TypeRef();
+      auto offset = Int();
+      auto bitFieldBegin = Byte();
+      auto bitFieldWidth = Byte();
+      auto expr = Node<Expr>();
+      decl->inits_.insert(
+          Initializer(type, offset, expr, bitFieldBegin, bitFieldWidth));
+    }
+  } break;
+  case N_EMPTY:
+    break;
+  case N_IF: {
+    auto ifStmt = static_cast<IfStmt*>(shell.node_);
+    ifStmt->cond_ = Node<Expr>();
+    ifStmt->then_ = Node<Stmt>();
+    ifStmt->else_ = Node<Stmt>();
+  } break;
+  case N_JUMP:
+    static_cast<JumpStmt*>(shell.node_)->label_ = Node<LabelStmt>();
+    break;
+  case N_SWITCH: {
+    auto switchStmt = static_cast<SwitchStmt*>(shell.node_);
+    switchStmt->cond_ = Node<TempVar>();
+    auto size = UInt();
+    for (size_t i = 0; i < size; ++i) {
+      auto lo = Int();
+      auto hi = Int();
+      switchStmt->cases_.push_back({lo, hi, Node<LabelStmt>()});
+    }
+    switchStmt->default_ = Node<LabelStmt>();
+    switchStmt->end_ = Node<LabelStmt>();
+  } break;
+  case N_RETURN:
+    static_cast<ReturnStmt*>(shell.node_)->expr_ = Node<Expr>();
+    break;
+  case N_LABEL: {
+    auto labelStmt = static_cast<LabelStmt*>(shell.node_);
+    labelStmt->space_ = Int();
+    labelStmt->tag_ = Int();
+  } break;
+  case N_COMPOUND: {
+    auto compStmt = static_cast<CompoundStmt*>(shell.node_);
+    auto size = UInt();
+    for (size_t i = 0; i < size; ++i)
+      compStmt->stmts_.push_back(Node<Stmt>());
+    compStmt->scope_ = ScopeRef();
+  } break;
+  case N_FUNCDEF: {
+    auto funcDef = static_cast<FuncDef*>(shell.node_);
+    funcDef->ident_ = Node<Identifier>();
+    funcDef->retLabel_ = Node<LabelStmt>();
+    funcDef->body_ = Node<CompoundStmt>();
+  } break;
+  case N_UNIT: {
+    auto unit = static_cast<TranslationUnit*>(shell.node_);
+    auto size = UInt();
+    for (size_t i = 0; i < size; ++i)
+      unit->extDecls_.push_back(Node<ASTNode>());
+  } break;
+  }
+}
+
+
+bool Serializer::Save(TranslationUnit* unit, const std::string& fileName)
+{
+  auto image = Writer(false).Write(unit);
+  auto fp = fopen(fileName.c_str(), "wb");
+  if (fp == nullptr)
+    return false;
+  auto ok = fwrite(image.data(), 1, image.size(), fp) == image.size();
+  return fclose(fp) == 0 && ok;
+}
+
+
+TranslationUnit* Serializer::Load(const std::string& fileName)
+{
+  auto fd = open(fileName.c_str(), O_RDONLY);
+  if (fd < 0)
+    return nullptr;
+  struct stat st;
+  void* addr = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0)
+    addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED)
+    return nullptr;
+
+  // The builtins are referred by the image
+  Parser::DefineBuiltins();
+  auto lastTag = LabelStmt::lastTag_;
+  TranslationUnit* unit = nullptr;
+  try {
+    unit = Reader(static_cast<const char*>(addr), st.st_size).Read();
+  } catch (const Reader::Corrupt&) {
+    LabelStmt::lastTag_ = lastTag;
+  }
+  munmap(addr, st.st_size);
+  return unit;
+}
+
+
+std::string Serializer::Key(FuncDef* funcDef, std::vector<LabelStmt*>& labels)
+{
+  Writer writer(true);
+  auto key = writer.Write(funcDef);
+  labels = writer.Labels();
+  return key;
+}
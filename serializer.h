@@ -0,0 +1,38 @@
+#ifndef _WGTCC_SERIALIZER_H_
+#define _WGTCC_SERIALIZER_H_
+
+#include <string>
+#include <vector>
+
+
+class FuncDef;
+class LabelStmt;
+class TranslationUnit;
+
+
+/*
+ * The binary image of the AST, for reusing the result of parsing
+ * an unchanged translation unit. The image holds the tokens, scopes
+ * and types the AST refers to, the pointers between them are
+ * numbers of the nodes. The image is mapped and the pointers are
+ * restored when it is loaded.
+ */
+class Serializer
+{
+public:
+  static bool Save(TranslationUnit* unit, const std::string& fileName);
+  // nullptr if the file does not exist or is not a valid image
+  static TranslationUnit* Load(const std::string& fileName);
+
+  // The image of the function and what it refers to, without the
+  // locations and the numbering of labels. Functions of the same key
+  // are generated the same, if their labels are numbered the same.
+  // The labels are returned in the order of the image.
+  static std::string Key(FuncDef* funcDef, std::vector<LabelStmt*>& labels);
+
+private:
+  class Writer;
+  class Reader;
+};
+
+#endif
@@ -0,0 +1,83 @@
+#include "test.h"
+
+typedef struct { char c[15]; } B15;
+typedef struct { char c[17]; } B17;
+typedef struct { int i[9]; } B36;
+typedef struct { char c[255]; } B255;
+typedef struct { char c[257]; } B257;
+typedef struct { long l[512]; } B4K;
+
+static B4K big;
+
+#define CHECK_COPY(T, n)                        \
+    do {                                        \
+        T a, b;                                 \
+        for (int i = 0; i < (n); i++)           \
+            ((char*)&a)[i] = i * 7 + 1;         \
+        b = a;                                  \
+        for (int i = 0; i < (n); i++)           \
+            expect((char)(i * 7 + 1), ((char*)&b)[i]); \
+    } while (0)
+
+// The params stay in %rdi and %rsi across the copy
+static long copy_leaf(long x, long y, B257* des, B257* src) {
+    *des = *src;
+    return x - y;
+}
+
+static int zero_leaf(int x, int y) {
+    int arr[100] = {x, y};
+    return arr[0] + arr[1] + arr[2] + arr[99] + x * y;
+}
+
+static void zero_sizes() {
+    char c17[17] = {1};
+    expect(1, c17[0]);
+    expect(0, c17[16]);
+    short s[40] = {[39] = 5};
+    expect(0, s[0]);
+    expect(0, s[38]);
+    expect(5, s[39]);
+    long l[300] = {1, 2};
+    expect(2, l[1]);
+    expect(0, l[2]);
+    expect(0, l[299]);
+    char c[1001] = {[1000] = 9};
+    expect(0, c[0]);
+    expect(0, c[999]);
+    expect(9, c[1000]);
+}
+
+int main() {
+    CHECK_COPY(B15, 15);
+    CHECK_COPY(B17, 17);
+    CHECK_COPY(B36, 36);
+    CHECK_COPY(B255, 255);
+    CHECK_COPY(B257, 257);
+
+    for (int i = 0; i < 512; i++)
+        big.l[i] = i * 3;
+    B4K local = big;
+    expectl(0, local.l[0]);
+    expectl(1533, local.l[511]);
+    local.l[100] = -1;
+    big = local;
+    expectl(-1, big.l[100]);
+
+    B257 x, y;
+    for (int i = 0; i < 257; i++)
+        y.c[i] = i;
+    expectl(7, copy_leaf(10, 3, &x, &y));
+    expect((char)256, x.c[256]);
+    expect(100, x.c[100]);
+
+    expect(3 + 4 + 12, zero_leaf(3, 4));
+    zero_sizes();
+
+    // The value of the assignment is the copied struct
+    B257 z;
+    B257 w = (z = y);
+    expect(50, z.c[50]);
+    expect(50, w.c[50]);
+    return 0;
+}
@@ -0,0 +1,76 @@
+#include "test.h"
+
+static int trace;
+
+static int step(int id, int val) {
+    trace = trace * 10 + id;
+    return val;
+}
+
+static void relational() {
+    int a = -1;
+    unsigned b = 1;
+    long c = 5;
+    int n = 0;
+    if (a < 0) n += 1;
+    if (a < b) n += 10;
+    if (c >= 5) n += 100;
+    if (c > 5) n += 1000;
+    if (!(a != -1)) n += 10000;
+    expect(10101, n);
+}
+
+static void short_circuit() {
+    trace = 0;
+    if (step(1, 1) && step(2, 0) || step(3, 1))
+        trace = trace * 10 + 9;
+    expect(1239, trace);
+
+    trace = 0;
+    if (!(step(1, 0) || step(2, 0)) && step(3, 1))
+        trace = trace * 10 + 9;
+    expect(1239, trace);
+
+    trace = 0;
+    if (step(1, 1) || step(2, 1))
+        trace = trace * 10 + 9;
+    expect(19, trace);
+}
+
+static void floats() {
+    double x = 1.5, y = 2.5;
+    int n = 0;
+    if (x < y) n += 1;
+    if (x >= y) n += 10;
+    if (x != y && y > 2.0) n += 100;
+    if (!(x == 1.5)) n += 1000;
+    expect(101, n);
+}
+
+static int count(int lo, int hi) {
+    int n = 0;
+    for (int i = lo; i < hi && n < 100; i++) {
+        if (i % 3 == 0 || i % 5 == 0)
+            n++;
+    }
+    return n;
+}
+
+static void loops() {
+    expect(47, count(0, 100));
+    expect(0, count(5, 5));
+    int i = 0;
+    while (!(i >= 10)) i += 3;
+    expect(12, i);
+    expect(7, i > 10 ? 7: 8);
+    int v = (i > 10) && (i < 20);
+    expect(1, v);
+}
+
+int main() {
+    relational();
+    short_circuit();
+    floats();
+    loops();
+    return 0;
+}
@@ -38,6 +38,23 @@ static void t6() {
     expect(20, *a);
 }
 
+typedef int t;
+
+static void t10() {
+    t a = 1;
+    {
+        int t = 2;
+        struct t { int t; } s = { 3 };
+        {
+            char a = t + s.t;
+            expect(5, a);
+        }
+        expect(3, sizeof(struct t) - 1);
+    }
+    expect(1, a);
+    expect(4, sizeof(t));
+}
+
 static int ((t7))();
 static int ((*t8))();
 static int ((*(**t9))(int*(), int(*), int()));
@@ -49,5 +66,6 @@ int main() {
     t4();
     t5();
     t6();
+    t10();
     return 0;
 }
@@ -0,0 +1,76 @@
+#include "test.h"
+
+static int calls;
+
+static int touch(int val) {
+    ++calls;
+    return val;
+}
+
+static void arith() {
+    expect(7, 1 + 2 * 3);
+    expect(-3, -7 / 2);
+    expect(-1, -7 % 2);
+    expect(2147483647, 2147483647u / 1);
+    expect(1, 0xffffffffu / 0x80000000u);
+    expect(0, 0xffffffffu + 1);
+    expect(-2147483648, 2147483647 + 1);
+    expectl(4294967296, 1l << 32);
+}
+
+static void shift() {
+    expect(-4, -16 >> 2);
+    expect(0x3fffffff, 0xffffffffu >> 2);
+    expect(16, 1 << 4);
+}
+
+static void cast() {
+    expect(-56, (char)200);
+    expect(200, (unsigned char)200);
+    expect(1, (_Bool)256);
+    expect(255, (unsigned char)-1);
+}
+
+static void compare() {
+    expect(1, -1 < 0);
+    expect(0, -1 < 0u);
+    expect(1, 3 >= 3 && 2 != 3);
+    expect(0, !5);
+    expect(-6, ~5);
+}
+
+static void short_circuit() {
+    calls = 0;
+    expect(0, 0 && touch(1));
+    expect(1, 1 || touch(1));
+    expect(0, calls);
+    expect(1, 1 && touch(2));
+    expect(1, calls);
+    expect(3, 1 ? 3: touch(4));
+    expect(1, calls);
+}
+
+static void branch() {
+    int s = 0;
+    if (2 * 3 == 6)
+        s += 1;
+    else
+        s += 100;
+    if (sizeof(int) == 8)
+        s += 1000;
+    while (1) {
+        if (++s > 5)
+            break;
+    }
+    expect(6, s);
+}
+
+int main() {
+    arith();
+    shift();
+    cast();
+    compare();
+    short_circuit();
+    branch();
+    return 0;
+}
@@ -0,0 +1,97 @@
+#include "test.h"
+
+typedef struct {
+    long x, y, z;
+} Vec;
+
+static int mix(int a, int b, int c, int d, int e, int f) {
+    return a - b + c * d - e / f;
+}
+
+static long stack_args(long a, long b, long c, long d,
+                       long e, long f, long g, long h) {
+    return a + b + c + d + e + f + g * 10 + h * 100;
+}
+
+static int narrow(char c, short s, unsigned char u) {
+    return c + s + u;
+}
+
+static int div_shift(int a, int b, int c) {
+    return a / b + (a % b << c);
+}
+
+static Vec make(long x, long y) {
+    Vec v = {x, y, x * y};
+    return v;
+}
+
+static int small_frame(int n) {
+    int arr[8];
+    for (int i = 0; i < 8; i++)
+        arr[i] = n + i;
+    return arr[0] + arr[7];
+}
+
+static int large_frame(int n) {
+    int arr[64];
+    for (int i = 0; i < 64; i++)
+        arr[i] = n * i;
+    return arr[1] + arr[63];
+}
+
+static int fib(int n) {
+    return n < 2 ? n: fib(n - 1) + fib(n - 2);
+}
+
+// Leaf, its temporaries take the argument registers
+static int sq(int x) {
+    int y = x * x;
+    int z = y + 1;
+    int w = z * 2;
+    return w - z;
+}
+
+static int add(int a, int b) {
+    return a * 10 + b;
+}
+
+static int add3(int a, int b, int c) {
+    return a * 100 + b * 10 + c;
+}
+
+static double dsub(double a, double b) {
+    return a - b;
+}
+
+static double twice(double a) {
+    return a * 2;
+}
+
+static int calls(int x) {
+    int a = mix(x, 1, 2, 3, 4, 2);
+    int b = mix(a, 2, 3, 4, 5, 1);
+    return narrow(x, a, b) + div_shift(a, 3, 2);
+}
+
+int main() {
+    expect(9, mix(1, 2, 3, 4, 5, 2));
+    expectl(87654321, stack_args(1, 20, 300, 4000, 50000, 600000,
+                                 700000, 800000));
+    expect(-1 + 1000 + 255, narrow(-1, 1000, 255));
+    expect(3 + (2 << 3), div_shift(17, 5, 3));
+    Vec v = make(3, 4);
+    expectl(12, v.z);
+    expectl(4, v.y);
+    expect(27, small_frame(10));
+    expect(256, large_frame(4));
+    expect(55, fib(10));
+    expect(349, calls(100));
+    // Calls in the args before the last one
+    expect(104, add(sq(3), 4));
+    expect(255, add3(sq(1), sq(2), 5));
+    expect(134, add(add(1, 3), 4));
+    expect(8, mix(sq(2), 1, add(0, 2), 3, 4, 2));
+    expectf(2.0, dsub(twice(1.5), 1));
+    return 0;
+}
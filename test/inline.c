@@ -0,0 +1,30 @@
+#include "test.h"
+#include "inline.h"
+
+struct inline_tag { long a, b; };
+
+static int (*twice)(int) = inline_twice;
+
+static void call() {
+    expect(9, inline_square(3));
+    expect(42, inline_indirect());
+    expect_string("inline_name", inline_name());
+    expect(1, inline_tag());
+}
+
+static void address() {
+    expect(8, twice(4));
+}
+
+static void late() {
+    expect(7, inline_late(6));
+}
+
+#include "inline_late.h"
+
+int main() {
+    call();
+    address();
+    late();
+    return 0;
+}
@@ -0,0 +1,41 @@
+#ifndef _WGTCC_TEST_INLINE_H_
+#define _WGTCC_TEST_INLINE_H_
+
+// Used before it is defined in 'inline_late.h'
+static inline int inline_late(int x);
+
+static inline int inline_square(int x) {
+    return x * x;
+}
+
+static inline int inline_twice(int x) {
+    return 2 * x;
+}
+
+// Referenced only by another static inline function
+static inline int inline_base(void) {
+    return 40;
+}
+
+static inline int inline_indirect(void) {
+    return inline_base() + 2;
+}
+
+static inline const char* inline_name(void) {
+    return __func__;
+}
+
+// 'struct inline_tag' is declared at file scope only after this body,
+// so both the pointer and the definition refer to the local tag
+static inline int inline_tag(void) {
+    struct inline_tag *p;
+    struct inline_tag { char c; };
+    return sizeof(*p);
+}
+
+static inline int inline_unused(int x) {
+    if (x) { return inline_base(); }
+    return 0;
+}
+
+#endif
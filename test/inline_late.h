@@ -0,0 +1,8 @@
+#ifndef _WGTCC_TEST_INLINE_LATE_H_
+#define _WGTCC_TEST_INLINE_LATE_H_
+
+static inline int inline_late(int x) {
+    return x + 1;
+}
+
+#endif
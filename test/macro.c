@@ -188,6 +188,18 @@ static void const_expr() {
     a = 13;
 #endif
     expect(12, a);
+
+#if -1 < 0u || 0 && 1 / 0 || (1 ? 2 : 1 / 0) != 2
+    a = 16;
+#else
+    a = 17;
+#endif
+    expect(17, a);
+
+#if 'a' == 97 && (1 << 2 >> 1) == 2 && -(-3) % 2 == 1 && 0x10UL == 16
+    a = 18;
+#endif
+    expect(18, a);
 }
 
 static void defined() {
@@ -206,6 +218,10 @@ static void defined() {
     a = 4;
 #endif
     expect(4, a);
+#if defined ONE && !defined(NO_SUCH_MACRO) && ONE + TWO == 3
+    a = 5;
+#endif
+    expect(5, a);
 }
 
 static void ifdef() {
@@ -357,6 +373,15 @@ static void funclike() {
 
 #define m17(x) stringify(.x . x)
     expect_string(".3 . 3", m17(3));
+
+    // C11 6.10.3.5 [5]
+    int g = 3;
+#define f(a) a*g
+#define g(a) f(a)
+    expect(54, f(2)(9));
+    expect_string("2*9*g", identity(f(2)(9)));
+#undef f
+#undef g
 }
 
 static void empty() {
@@ -0,0 +1,61 @@
+#include "test.h"
+
+// The patterns of the peephole pass at '-O2'
+
+static int cast_cond(int a, int b) {
+    if ((long)(a < b))
+        return 1;
+    return 0;
+}
+
+static int comma_cond(int a, int b) {
+    int n = 0;
+    for (; a++, a < b; )
+        ++n;
+    return n;
+}
+
+static long commute(long a, long b, int c, int d) {
+    long x = (a + 1) * (b - 2);
+    int y = (c ^ 5) & (d | 3);
+    return (x + b) + (y | c) + (x & a) + (y ^ d);
+}
+
+static long spill(long a) {
+    long* p = &a;
+    long b = *p + 1;
+    a = b * 2;
+    return a + b;
+}
+
+static int swap(int a, int b) {
+    int t = a;
+    a = b;
+    b = t;
+    return a * 10 + b;
+}
+
+// The rewrites go on through a long block
+static long straight(long a, long b) {
+    long c = 3, d = 4;
+    a = a + b * c;  b = (a < b) + d;  c = c ^ (a & d);  d = d + (a | b);
+    a = a + b * c;  b = (a < b) + d;  c = c ^ (a & d);  d = d + (a | b);
+    a = a + b * c;  b = (a < b) + d;  c = c ^ (a & d);  d = d + (a | b);
+    a = a + b * c;  b = (a < b) + d;  c = c ^ (a & d);  d = d + (a | b);
+    a = a + b * c;  b = (a < b) + d;  c = c ^ (a & d);  d = d + (a | b);
+    a = a + b * c;  b = (a < b) + d;  c = c ^ (a & d);  d = d + (a | b);
+    return a + b + c + d;
+}
+
+int main() {
+    expect(1, cast_cond(1, 2));
+    expect(0, cast_cond(2, 1));
+    expect(0, cast_cond(-1, -1));
+    expect(3, comma_cond(1, 5));
+    expect(0, comma_cond(5, 1));
+    expectl(32 + 7 + 0 + 10, commute(4, 7, 6, 9));
+    expectl(9, spill(2));
+    expect(21, swap(1, 2));
+    expectl(535761, straight(1, 2));
+    return 0;
+}
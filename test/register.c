@@ -0,0 +1,93 @@
+#include "test.h"
+
+static long pressure(long a, long b) {
+    long c = a + b, d = a - b, e = a * b, f = c + d;
+    long g = e - f, h = g * 2, i = h + a, j = i - b;
+    long k = c * d + e * f - g * h + i * j;
+    {
+        long m = k + 1, n = m * 2;
+        k += m + n;
+    }
+    {
+        long o = k - 1, q = o * 3;
+        k -= q + o;
+    }
+    return a + b + c + d + e + f + g + h + i + j + k;
+}
+
+static void spill() {
+    expect(-1826, pressure(3, 4));
+    expect(-112347, pressure(-10, 7));
+}
+
+static void address() {
+    int a = 5, b = 10;
+    int* p = &a;
+    *p += b;
+    expect(15, a);
+    expect(25, a + b);
+}
+
+static int loop(int n) {
+    int total = 0, i = 0;
+again:
+    {
+        int t = i * 3;
+        total += t;
+    }
+    if (++i < n)
+        goto again;
+    return total;
+}
+
+static void back_edge() {
+    expect(135, loop(10));
+}
+
+static void narrow() {
+    unsigned char c = 200;
+    c += 100;
+    expect(44, c);
+    short s = -2;
+    expect(-6, s * 3);
+    int i = -1;
+    long l = i;
+    expect(-1, l);
+}
+
+static int less(const void* lhs, const void* rhs) {
+    int a = *(const int*)lhs, b = *(const int*)rhs;
+    return a < b ? -1: a > b;
+}
+
+static void callee_saved() {
+    int arr[8] = {5, -3, 9, 0, 7, -8, 2, 1};
+    int sum = 0, last = -100;
+    qsort(arr, 8, sizeof(int), less);
+    for (int i = 0; i < 8; i++) {
+        expect(1, last <= arr[i]);
+        last = arr[i];
+        sum += arr[i];
+    }
+    expect(13, sum);
+}
+
+static int args(int a, int b, int c, int d, int e, int f, int g, int h) {
+    int s = a + h;
+    s = s * g - f;
+    return s + b + c + d + e;
+}
+
+static void params() {
+    expect(71, args(1, 2, 3, 4, 5, 6, 7, 8));
+}
+
+int main() {
+    spill();
+    address();
+    back_edge();
+    narrow();
+    callee_saved();
+    params();
+    return 0;
+}
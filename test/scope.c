@@ -0,0 +1,74 @@
+#include "test.h"
+
+typedef struct {
+    long a, b, c;
+} Triple;
+
+static long sum(Triple t) {
+    return t.a + t.b + t.c;
+}
+
+static void fill(int* arr, int n, int val) {
+    for (int i = 0; i < n; i++)
+        arr[i] = val + i;
+}
+
+static void siblings() {
+    long total = 0;
+    {
+        Triple t = {1, 2, 3};
+        total += sum(t);
+        expect(6, (int)sum(t));
+    }
+    {
+        Triple u = {10, 20, 30};
+        int arr[4];
+        fill(arr, 4, 100);
+        total += sum(u) + arr[3];
+        expect(60, (int)sum(u));
+    }
+    {
+        Triple v;
+        v.a = 7;
+        v.b = total;
+        v.c = v.a * 2;
+        expect(190, (int)sum(v));
+    }
+}
+
+static void loops() {
+    int n = 0;
+    for (int i = 0; i < 3; i++) {
+        Triple t = {i, i, i};
+        n += sum(t);
+    }
+    for (int j = 0; j < 3; j++) {
+        int arr[8];
+        fill(arr, 8, j);
+        Triple s = {arr[7], 0, 0};
+        n += sum(s);
+    }
+    expect(33, n);
+}
+
+static void address_taken() {
+    int* p;
+    {
+        int x = 42;
+        p = &x;
+        expect(42, *p);
+    }
+    {
+        Triple t = {1, 1, 1};
+        long* q = &t.b;
+        *q = 5;
+        expect(7, (int)sum(t));
+    }
+}
+
+int main() {
+    siblings();
+    loops();
+    address_taken();
+    return 0;
+}
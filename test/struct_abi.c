@@ -0,0 +1,146 @@
+#include "test.h"
+
+#include <stdarg.h>
+#include <stdlib.h>
+
+typedef struct { long a, b; } LL;
+typedef struct { double x, y; } DD;
+typedef struct { long a; double x; } LD;
+typedef struct { float f, g, h; } FFF;
+typedef struct { char c[3]; } C3;
+typedef struct { short s[3]; char c; } S7;
+typedef struct { int i; float f; char c; } IFC;
+typedef struct { struct { int x, y; }; double d; } Anony;
+typedef struct { long a, b, c; } Big;
+typedef struct { long double ld; } LDbl;
+
+static LL make_ll(long a, long b) {
+    LL r = {a, b};
+    return r;
+}
+
+static DD swap_dd(DD d) {
+    DD r = {d.y, d.x};
+    return r;
+}
+
+static LD add_ld(LD p, LD q) {
+    LD r = {p.a + q.a, p.x + q.x};
+    return r;
+}
+
+static FFF scale(FFF v, float k) {
+    FFF r = {v.f * k, v.g * k, v.h * k};
+    return r;
+}
+
+static C3 rot(C3 c) {
+    C3 r = {{c.c[1], c.c[2], c.c[0]}};
+    return r;
+}
+
+static S7 inc(S7 s) {
+    s.s[0]++; s.s[1]++; s.s[2]++; s.c++;
+    return s;
+}
+
+static IFC mix(int i, IFC p, double d) {
+    IFC r = {p.i + i, p.f + (float)d, p.c + 1};
+    return r;
+}
+
+static double anony(Anony a) {
+    return a.x + a.y + a.d;
+}
+
+static Big big(Big b) {
+    b.c = b.a + b.b;
+    return b;
+}
+
+static long double ldbl(LDbl l) {
+    return l.ld * 2;
+}
+
+// The last ones do not fit in the registers left
+static long spill(LL a, LL b, LL c, LL d, DD e, DD f, DD g, DD h, DD i) {
+    return a.a + b.b + c.a + d.b + (long)(e.x + f.y + g.x + h.y + i.x);
+}
+
+static double sum(int n, ...) {
+    va_list ap;
+    va_start(ap, n);
+    double total = 0;
+    for (int k = 0; k < n; k++) {
+        LD v = va_arg(ap, LD);
+        total += v.a + v.x;
+    }
+    va_end(ap);
+    return total;
+}
+
+int main() {
+    LL l = make_ll(3, -4);
+    expectl(3, l.a);
+    expectl(-4, l.b);
+
+    DD d = {1.5, 2.5};
+    d = swap_dd(d);
+    expectf(2.5, d.x);
+    expectf(1.5, d.y);
+
+    LD p = {1, 0.25}, q = {2, 0.5};
+    LD r = add_ld(p, q);
+    expectl(3, r.a);
+    expectf(0.75, r.x);
+
+    FFF v = {1, 2, 3};
+    v = scale(v, 2);
+    expectf(2, v.f);
+    expectf(4, v.g);
+    expectf(6, v.h);
+
+    C3 c = {{'a', 'b', 'c'}};
+    c = rot(c);
+    expect('b', c.c[0]);
+    expect('c', c.c[1]);
+    expect('a', c.c[2]);
+
+    S7 s = {{1, 2, 3}, 4};
+    s = inc(s);
+    expect(2, s.s[0]);
+    expect(4, s.s[2]);
+    expect(5, s.c);
+
+    IFC ifc = {10, 1.5, 'x'};
+    ifc = mix(5, ifc, 0.5);
+    expect(15, ifc.i);
+    expectf(2.0, ifc.f);
+    expect('y', ifc.c);
+
+    Anony a = {{1, 2}, 0.5};
+    expectf(3.5, anony(a));
+
+    Big b = {1, 2, 0};
+    b = big(b);
+    expectl(3, b.c);
+
+    LDbl ld = {1.5};
+    expectf(3.0, (double)ldbl(ld));
+
+    LL x = {1, 2};
+    DD y = {3, 4};
+    expectl(1 + 2 + 1 + 2 + 3 + 4 + 3 + 4 + 3, spill(x, x, x, x, y, y, y, y, y));
+
+    expectf(1 + 0.5 + 2 + 0.25 + 3 + 0.125 + 4 + 1,
+            sum(4, (LD){1, 0.5}, (LD){2, 0.25}, (LD){3, 0.125}, (LD){4, 1}));
+
+    // Returned by registers from the C library
+    div_t dv = div(17, 5);
+    expect(3, dv.quot);
+    expect(2, dv.rem);
+    ldiv_t ldv = ldiv(-17, 5);
+    expectl(-3, ldv.quot);
+    expectl(-2, ldv.rem);
+    return 0;
+}
@@ -0,0 +1,120 @@
+#include "test.h"
+
+static int dense(int x) {
+    switch (x) {
+    case 0: return 10;
+    case 1: return 11;
+    case 2: case 3: return 12;
+    case 5: return 15;
+    case 6: return 16;
+    case 7: return 17;
+    default: return -1;
+    }
+}
+
+static int sparse(long x) {
+    switch (x) {
+    case -1000000: return 1;
+    case -7: return 2;
+    case 0: return 3;
+    case 100: return 4;
+    case 4096: return 5;
+    case 123456789: return 6;
+    case 2000000000: return 7;
+    }
+    return 0;
+}
+
+static int ranges(int x) {
+    int n = 0;
+    switch (x) {
+    case -20 ... -10: n = 1; break;
+    case 0 ... 9: n = 2; break;
+    case 10: n = 3;
+    case 11: n += 4; break;
+    case 50 ... 1000: n = 5; break;
+    default: n = 6; break;
+    }
+    return n;
+}
+
+static int unsigned_cases(unsigned x) {
+    switch (x) {
+    case -1: return 1;
+    case 0: return 2;
+    case 1: return 3;
+    case 2: return 4;
+    case 3: return 5;
+    }
+    return 0;
+}
+
+static int char_cases(char c) {
+    switch (c) {
+    case 'a': case 'e': case 'i': case 'o': case 'u':
+        return 1;
+    case -1:
+        return 2;
+    case '0' ... '9':
+        return 3;
+    }
+    return 0;
+}
+
+static int ulong_cases(unsigned long x) {
+    switch (x) {
+    case -1: return 1;
+    case 0: return 2;
+    case 1: return 3;
+    case 5: return 4;
+    case 9: return 5;
+    }
+    return 0;
+}
+
+int main() {
+    int expected[] = {-1, 10, 11, 12, 12, -1, 15, 16, 17, -1};
+    for (int i = -1; i < 9; i++)
+        expect(expected[i + 1], dense(i));
+    expect(-1, dense(INT_MIN));
+
+    expect(1, sparse(-1000000));
+    expect(2, sparse(-7));
+    expect(3, sparse(0));
+    expect(4, sparse(100));
+    expect(5, sparse(4096));
+    expect(6, sparse(123456789));
+    expect(7, sparse(2000000000));
+    expect(0, sparse(1));
+    expect(0, sparse(-1));
+    expect(0, sparse(2000000000L + (1L << 32)));
+
+    expect(1, ranges(-20));
+    expect(1, ranges(-10));
+    expect(6, ranges(-9));
+    expect(2, ranges(5));
+    expect(7, ranges(10));
+    expect(4, ranges(11));
+    expect(6, ranges(49));
+    expect(5, ranges(50));
+    expect(5, ranges(1000));
+    expect(6, ranges(1001));
+
+    expect(1, unsigned_cases(0xffffffffu));
+    expect(2, unsigned_cases(0));
+    expect(5, unsigned_cases(3));
+    expect(0, unsigned_cases(4));
+
+    expect(1, char_cases('o'));
+    expect(2, char_cases(-1));
+    expect(3, char_cases('7'));
+    expect(0, char_cases('b'));
+
+    expect(1, ulong_cases(-1));
+    expect(2, ulong_cases(0));
+    expect(4, ulong_cases(5));
+    expect(5, ulong_cases(9));
+    expect(0, ulong_cases(2));
+    expect(0, ulong_cases(1UL << 63));
+    return 0;
+}
@@ -3,8 +3,12 @@
 #include "mem_pool.h"
 #include "parser.h"
 
+#include <algorithm>
+#include <cctype>
+#include <functional>
+#include <utility>
+
 
-static MemPoolImp<Token> TokenPool;
 
 
 const std::unordered_map<std::string, int> Token::kwTypeMap_ {
@@ -156,7 +160,7 @@ const std::unordered_map<int, const char*> Token::TagLexemeMap_ {
 
 
 Token* Token::New(int tag) {
-  return new (TokenPool.Alloc()) Token(tag);
+  return new (Arena::Alloc<Token>()) Token(tag);
 }
 
 Token* Token::New(const Token& other) {
@@ -165,7 +169,125 @@ Token* Token::New(const Token& other) {
 
 Token* Token::New(int tag, const SourceLocation& loc,
                   const std::string& str, bool ws) {
-  return new (TokenPool.Alloc()) Token(tag, loc, str, ws);
+  return new (Arena::Alloc<Token>()) Token(tag, loc, str, ws);
+}
+
+
+/*
+ * HideSet
+ */
+
+struct SymbolListHash {
+  size_t operator()(const HideSet::SymbolList& syms) const {
+    size_t h = syms.size();
+    for (auto sym: syms)
+      h = h * 31 + sym;
+    return h;
+  }
+};
+
+typedef std::pair<const HideSet*, const HideSet*> HideSetPair;
+
+struct HideSetPairHash {
+  size_t operator()(const HideSetPair& p) const {
+    std::hash<const HideSet*> h;
+    return h(p.first) * 31 + h(p.second);
+  }
+};
+
+typedef std::unordered_map<std::string, int> SymbolMap;
+typedef std::unordered_map<HideSet::SymbolList,
+    const HideSet*, SymbolListHash> HideSetTable;
+typedef std::unordered_map<HideSetPair,
+    const HideSet*, HideSetPairHash> HideSetCache;
+
+static SymbolMap symbols;
+// Singleton hide sets, indexed by symbol id
+static std::vector<const HideSet*> singletons;
+static HideSetTable hideSets;
+static HideSetCache unionCache;
+static HideSetCache intersectCache;
+
+
+const HideSet* HideSet::Intern(const SymbolList& syms)
+{
+  if (syms.empty())
+    return nullptr;
+  auto res = hideSets.find(syms);
+  if (res != hideSets.end())
+    return res->second;
+  auto hs = new HideSet(syms);
+  hideSets.insert(std::make_pair(syms, hs));
+  return hs;
+}
+
+
+const HideSet* HideSet::Add(const HideSet* hs, const std::string& name)
+{
+  auto res = symbols.insert(std::make_pair(name, (int)symbols.size()));
+  auto sym = res.first->second;
+  if (res.second)
+    singletons.push_back(Intern({sym}));
+  return Union(hs, singletons[sym]);
+}
+
+
+const HideSet* HideSet::Union(const HideSet* lhs, const HideSet* rhs)
+{
+  if (lhs == rhs || rhs == nullptr)
+    return lhs;
+  if (lhs == nullptr)
+    return rhs;
+  // Union is commutative
+  if (lhs > rhs)
+    std::swap(lhs, rhs);
+
+  auto key = std::make_pair(lhs, rhs);
+  auto res = unionCache.find(key);
+  if (res != unionCache.end())
+    return res->second;
+
+  SymbolList syms;
+  syms.reserve(lhs->syms_.size() + rhs->syms_.size());
+  std::set_union(lhs->syms_.begin(), lhs->syms_.end(),
+                 rhs->syms_.begin(), rhs->syms_.end(),
+                 std::back_inserter(syms));
+  auto ret = Intern(syms);
+  unionCache.insert(std::make_pair(key, ret));
+  return ret;
+}
+
+
+const HideSet* HideSet::Intersect(const HideSet* lhs, const HideSet* rhs)
+{
+  if (lhs == rhs)
+    return lhs;
+  if (lhs == nullptr || rhs == nullptr)
+    return nullptr;
+  if (lhs > rhs)
+    std::swap(lhs, rhs);
+
+  auto key = std::make_pair(lhs, rhs);
+  auto res = intersectCache.find(key);
+  if (res != intersectCache.end())
+    return res->second;
+
+  SymbolList syms;
+  std::set_intersection(lhs->syms_.begin(), lhs->syms_.end(),
+                        rhs->syms_.begin(), rhs->syms_.end(),
+                        std::back_inserter(syms));
+  auto ret = Intern(syms);
+  intersectCache.insert(std::make_pair(key, ret));
+  return ret;
+}
+
+
+bool HideSet::Contains(const std::string& name) const
+{
+  auto res = symbols.find(name);
+  if (res == symbols.end())
+    return false;
+  return std::binary_search(syms_.begin(), syms_.end(), res->second);
 }
 
 
@@ -268,3 +390,133 @@ void TokenSequence::Print() const
   }
   std::cout << std::endl;
 }
+
+
+/*
+ * Would the two tokens be scanned as one token (or as a comment)
+ * if they were written without white space in between?
+ */
+static bool MayPaste(const Token* lhs, const Token* rhs)
+{
+  if (lhs->str_.empty() || rhs->str_.empty())
+    return false;
+  auto l = lhs->str_.back();
+  auto r = rhs->str_.front();
+  auto isIdent = [](char c) { return isalnum(c) || c == '_' || c == '.'; };
+  if (isIdent(l) && isIdent(r))
+    return true;
+  if (r == '=' && strchr("+-*/%&|^<>=!", l))
+    return true;
+  // pp-number like '1e+5'
+  auto f = lhs->str_.front();
+  if ((isdigit(f) || f == '.') && strchr("eEpP", l) && (r == '+' || r == '-'))
+    return true;
+  switch (l) {
+  case '+': return r == '+';
+  case '-': return r == '-' || r == '>';
+  case '<': return r == '<' || r == ':' || r == '%';
+  case '>': return r == '>';
+  case '&': return r == '&';
+  case '|': return r == '|';
+  case '#': return r == '#';
+  case '/': return r == '/' || r == '*';
+  case '%': return r == '>' || r == ':';
+  case ':': return r == '>';
+  default: return false;
+  }
+}
+
+
+/*
+ * Write the preprocessed tokens as C source.
+ * If 'lineMarkers' is set, line markers '# line "file"' are written
+ * when the source file changes or lines are skipped, so that the
+ * output can be compiled with the original locations;
+ * Otherwise, the output is compact, without blank lines.
+ */
+void TokenSequence::Write(FILE* fp, bool lineMarkers) const
+{
+  static const unsigned maxBlankLines = 8;
+  std::string buf;
+  buf.reserve(1 << 16);
+
+  const std::string* fileName = nullptr;
+  unsigned line = 0;
+  const Token* prev = nullptr;
+  auto ts = *this;
+  while (!ts.Empty()) {
+    auto tok = ts.Next();
+    const auto& loc = tok->loc_;
+    bool newLine = true;
+    if (lineMarkers && (loc.fileName_ != fileName ||
+        loc.line_ < line || loc.line_ > line + maxBlankLines)) {
+      if (prev)
+        buf.push_back('\n');
+      buf += "# " + std::to_string(loc.line_) + " \"";
+      if (loc.fileName_)
+        buf += *loc.fileName_;
+      buf += "\"\n";
+    } else if (lineMarkers && loc.line_ > line) {
+      buf.append(loc.line_ - line, '\n');
+    } else if (loc.line_ != line || loc.fileName_ != fileName) {
+      if (prev)
+        buf.push_back('\n');
+    } else {
+      newLine = false;
+    }
+
+    if (newLine) {
+      if (loc.column_ > 1)
+        buf.append(loc.column_ - 1, ' ');
+    } else if (tok->ws_ || MayPaste(prev, tok)) {
+      buf.push_back(' ');
+    }
+    buf += tok->str_;
+
+    fileName = loc.fileName_;
+    line = loc.line_;
+    prev = tok;
+    if (buf.size() >= (1 << 16)) {
+      fwrite(buf.data(), 1, buf.size(), fp);
+      buf.clear();
+    }
+  }
+  buf.push_back('\n');
+  fwrite(buf.data(), 1, buf.size(), fp);
+}
+
+
+static uint64_t HashBytes(uint64_t hash, const void* data, size_t len)
+{
+  // FNV-1a
+  auto bytes = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < len; i++) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3UL;
+  }
+  return hash;
+}
+
+
+/*
+ * Hash of the tokens, for recognizing an unchanged translation unit.
+ * The file names are included, they decide which 'static inline'
+ * functions are parsed lazily. The locations are not included.
+ */
+uint64_t TokenSequence::Hash(uint64_t seed) const
+{
+  auto hash = HashBytes(0xcbf29ce484222325UL, &seed, sizeof(seed));
+  const std::string* fileName = nullptr;
+  auto ts = *this;
+  while (!ts.Empty()) {
+    auto tok = ts.Next();
+    if (tok->loc_.fileName_ != fileName) {
+      fileName = tok->loc_.fileName_;
+      if (fileName)
+        hash = HashBytes(hash, fileName->data(), fileName->size() + 1);
+    }
+    hash = HashBytes(hash, &tok->tag_, sizeof(tok->tag_));
+    hash = HashBytes(hash, tok->str_.c_str(), tok->str_.size() + 1);
+  }
+  return hash;
+}
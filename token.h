@@ -2,8 +2,11 @@
 #define _WGTCC_TOKEN_H_
 
 #include "error.h"
+#include "mem_pool.h"
 
 #include <cassert>
+#include <cstdint>
+#include <cstdio>
 #include <cstring>
 
 #include <iostream>
@@ -11,6 +14,7 @@
 #include <set>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 
 class Generator;
@@ -20,8 +24,39 @@ class Token;
 class TokenSequence;
 
 
-typedef std::set<std::string> HideSet;
-typedef std::list<const Token*> TokenList;
+typedef std::list<const Token*, ArenaAllocator<const Token*>> TokenList;
+
+
+/*
+ * Hide set of macro expansion.
+ * Hide sets are hash-consed: every distinct set of macro names
+ * is created only once and tokens share it by pointer.
+ * A hide set never changes after creation, thus the results of
+ * union and intersection are memoized on the operands' pointers.
+ * The null pointer stands for the empty hide set.
+ */
+class HideSet
+{
+public:
+  typedef std::vector<int> SymbolList;
+
+  // hs U {name}
+  static const HideSet* Add(const HideSet* hs, const std::string& name);
+  static const HideSet* Union(const HideSet* lhs, const HideSet* rhs);
+  static const HideSet* Intersect(const HideSet* lhs, const HideSet* rhs);
+
+  bool Contains(const std::string& name) const;
+
+private:
+  explicit HideSet(const SymbolList& syms): syms_(syms) {}
+  HideSet(const HideSet& other) = delete;
+  HideSet& operator=(const HideSet& other) = delete;
+
+  static const HideSet* Intern(const SymbolList& syms);
+
+  // Sorted ids of the macro names
+  SymbolList syms_;
+};
 
 
 struct SourceLocation {
@@ -187,6 +222,7 @@ public:
     PP_UNDEF,
     PP_LINE,
     PP_ERROR,
+    PP_WARNING,
     PP_PRAGMA,
     PP_NONE,
     PP_EMPTY,
@@ -301,7 +337,7 @@ public:
   //char* end_ { nullptr };
   std::string str_;
 
-  HideSet* hs_ { nullptr };
+  const HideSet* hs_ { nullptr };
 
 private:
   explicit Token(int tag): tag_(tag) {}
@@ -376,14 +412,11 @@ public:
     //tok->loc_.line_ = curLine + tok->loc_.line_ - lineLine - 1;
   }
 
-  void FinalizeSubst(bool leadingWS, const HideSet& hs) {
+  void FinalizeSubst(bool leadingWS, const HideSet* hs) {
     auto ts = *this;
     while (!ts.Empty()) {
       auto tok = const_cast<Token*>(ts.Next());
-      if (!tok->hs_)
-        tok->hs_ = new HideSet(hs);
-      else
-        tok->hs_->insert(hs.begin(), hs.end());
+      tok->hs_ = HideSet::Union(tok->hs_, hs);
     }
     // Even the token sequence is empty
     const_cast<Token*>(Peek())->ws_ = leadingWS;
@@ -430,6 +463,15 @@ public:
     return ret;
   }
 
+  // The token before the current one, nullptr if there is none
+  const Token* Prev() {
+    for (auto iter = begin_; iter != tokList_->begin(); ) {
+      if ((*--iter)->tag_ != Token::NEW_LINE)
+        return *iter;
+    }
+    return nullptr;
+  }
+
   const Token* Back() {
     auto back = end_;
     return *--back;
@@ -438,8 +480,13 @@ public:
   void PopBack() {
     assert(!Empty());
     assert(end_ == tokList_->end());
+    auto back = end_;
+    bool popBegin = --back == begin_;
     tokList_->pop_back();
     end_ = tokList_->end();
+    // Not to leave 'begin_' at the erased node
+    if (popBegin)
+      begin_ = end_;
   }
 
   TokenList::iterator Mark() {
@@ -485,6 +532,8 @@ public:
   }
 
   void Print() const;
+  void Write(FILE* fp, bool lineMarkers) const;
+  uint64_t Hash(uint64_t seed) const;
 
 private:
   TokenList* tokList_;
@@ -7,17 +7,34 @@
 #include <cassert>
 
 #include <algorithm>
+#include <functional>
 #include <iostream>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
 
 
 /***************** Type *********************/
 
-static MemPoolImp<VoidType>         voidTypePool;
-static MemPoolImp<ArrayType>        arrayTypePool;
-static MemPoolImp<FuncType>         funcTypePool;
-static MemPoolImp<PointerType>      pointerTypePool;
-static MemPoolImp<StructType>  structUnionTypePool;
-static MemPoolImp<ArithmType>       arithmTypePool;
+
+// Derived type and qualifier/length
+typedef std::pair<const Type*, long> DerivedTypeKey;
+
+struct DerivedTypeKeyHash {
+  size_t operator()(const DerivedTypeKey& key) const {
+    return std::hash<const Type*>()(key.first) * 31 + key.second;
+  }
+};
+
+typedef std::unordered_map<DerivedTypeKey,
+    PointerType*, DerivedTypeKeyHash> PointerTypeTable;
+typedef std::unordered_map<DerivedTypeKey,
+    ArrayType*, DerivedTypeKeyHash> ArrayTypeTable;
+
+static PointerTypeTable pointerTypes;
+static ArrayTypeTable arrayTypes;
+// Guards the tables, the code generation threads may derive types
+static std::mutex derivedTypesMutex;
 
 
 Type* Type::MayCast(Type* type)
@@ -27,22 +44,20 @@ Type* Type::MayCast(Type* type)
   if (funcType) {
     return PointerType::New(funcType);
   } else if (arrayType) {
-    auto ret = PointerType::New(arrayType->Derived());
-    ret->SetQual(Q_CONST);
-    return ret;
+    return PointerType::New(arrayType->Derived(), Q_CONST);
   }
   return type;
 }
 
 VoidType* VoidType::New()
 {
-  static auto voidType = new (voidTypePool.Alloc()) VoidType(&voidTypePool);
+  static auto voidType = new (Arena::Alloc<VoidType>()) VoidType();
   return voidType;
 }
 
 ArithmType* ArithmType::New(int typeSpec) {
 #define NEW_TYPE(tag) \
-  new (arithmTypePool.Alloc()) ArithmType(&arithmTypePool, tag);
+  new (Arena::Alloc<ArithmType>()) ArithmType(tag);
   static auto boolType    = NEW_TYPE(T_BOOL);
   static auto charType    = NEW_TYPE(T_CHAR);
   static auto ucharType   = NEW_TYPE(T_UNSIGNED | T_CHAR);
@@ -82,28 +97,45 @@ ArithmType* ArithmType::New(int typeSpec) {
 #undef NEW_TYPE
 }
 
+/*
+ * Arrays of the same element type and length share one node.
+ * An incomplete array may be completed by its initializer,
+ * thus it is always created a new one.
+ */
 ArrayType* ArrayType::New(int len, Type* eleType)
 {
-  return new (arrayTypePool.Alloc())
-      ArrayType(&arrayTypePool, len, eleType);
+  if (len < 0) {
+    return new (Arena::Alloc<ArrayType>()) ArrayType(len, eleType);
+  }
+  std::lock_guard<std::mutex> lock(derivedTypesMutex);
+  auto& ret = arrayTypes[{eleType, len}];
+  if (ret == nullptr) {
+    ret = new (Arena::Alloc<ArrayType>()) ArrayType(len, eleType);
+  }
+  return ret;
 }
 
 //static IntType* NewIntType();
 FuncType* FuncType::New(Type* derived, int funcSpec,
     bool variadic, const ParamList& params) {
-  return new (funcTypePool.Alloc())
-      FuncType(&funcTypePool, derived, funcSpec, variadic, params);
+  return new (Arena::Alloc<FuncType>())
+      FuncType(derived, funcSpec, variadic, params);
 }
 
-PointerType* PointerType::New(Type* derived) {
-  return new (pointerTypePool.Alloc())
-      PointerType(&pointerTypePool, derived);
+// Pointers to the same type with the same qualifiers share one node
+PointerType* PointerType::New(Type* derived, int qual) {
+  std::lock_guard<std::mutex> lock(derivedTypesMutex);
+  auto& ret = pointerTypes[{derived, qual}];
+  if (ret == nullptr) {
+    ret = new (Arena::Alloc<PointerType>()) PointerType(derived);
+    ret->SetQual(qual);
+  }
+  return ret;
 }
 
 StructType* StructType::New(
     bool isStruct, bool hasTag, Scope* parent) {
-  return new (structUnionTypePool.Alloc())
-      StructType(&structUnionTypePool, isStruct, hasTag, parent);
+  return new (Arena::Alloc<StructType>()) StructType(isStruct, hasTag, parent);
 }
 
 /*
@@ -251,6 +283,8 @@ std::string ArithmType::Str() const
 bool PointerType::Compatible(const Type& other) const
 {
   // C11 6.7.6.1 [2]: pointer compatibility
+  if (this == &other)
+    return true;
   auto otherPointer = other.ToPointer();
   return otherPointer && derived_->Compatible(*otherPointer->derived_);
 }
@@ -260,6 +294,8 @@ bool ArrayType::Compatible(const Type& other) const
   // C11 6.7.6.2 [6]: For two array type to be compatible,
   // the element types must be compatible, and have same length
   // if both specified.
+  if (this == &other)
+    return true;
   auto otherArray = other.ToArray();
   if (!otherArray) return false;
   if (!derived_->Compatible(*otherArray->derived_)) return false;
@@ -271,6 +307,8 @@ bool ArrayType::Compatible(const Type& other) const
 
 bool FuncType::Compatible(const Type& other) const
 {
+  if (this == &other)
+    return true;
   auto otherFunc = other.ToFunc();
   //the other type is not an function type
   if (!otherFunc) return false;
@@ -309,15 +347,27 @@ std::string FuncType::Str() const
   return str + ")";
 }
 
-StructType::StructType(MemPool* pool, bool isStruct,
+StructType::StructType(bool isStruct,
                        bool hasTag, Scope* parent)
-    : Type(pool, false), isStruct_(isStruct), hasTag_(hasTag),
+    : Type(false), isStruct_(isStruct), hasTag_(hasTag),
       memberMap_(new Scope(parent, S_BLOCK)), offset_(0), width_(0),
       // If a struct type has no member, it gets alignment of 1
       align_(1) {}
 
 Object* StructType::GetMember(const std::string& member)
 {
+  if (complete_) {
+    auto sym = Scope::FindSymbol(member);
+    auto iter = std::lower_bound(memberIndex_.begin(), memberIndex_.end(),
+        sym, [](const MemberIndex::value_type& entry, Symbol* sym) {
+      return entry.first < sym;
+    });
+    if (iter == memberIndex_.end() || iter->first != sym)
+      return nullptr;
+    return iter->second;
+  }
+
+  // The type is being defined
   auto ident = memberMap_->FindInCurScope(member);
   if (ident == nullptr)
     return nullptr;
@@ -327,8 +377,8 @@ Object* StructType::GetMember(const std::string& member)
 void StructType::CalcWidth()
 {
   width_ = 0;
-  auto iter = memberMap_->identMap_.begin();
-  for (; iter != memberMap_->identMap_.end(); iter++) {
+  auto iter = memberMap_->begin();
+  for (; iter != memberMap_->end(); iter++) {
     width_ += iter->second->Type()->Width();
   }
 }
@@ -357,6 +407,15 @@ void StructType::Finalize()
       ++iter;
     }
   }
+
+  for (auto& kv: memberMap_->identMap_) {
+    auto member = kv.second->ToObject();
+    if (member)
+      memberIndex_.push_back({kv.first, member});
+  }
+  std::sort(memberIndex_.begin(), memberIndex_.end());
+  delete memberMap_;
+  memberMap_ = nullptr;
 }
 
 
@@ -408,9 +467,9 @@ void StructType::MergeAnony(Object* anony)
   auto anonyType = anony->Type()->ToStruct();
   auto offset = MakeAlign(offset_, anony->Align());
 
-  // Members in map are never anonymous
-  for (auto& kv: *anonyType->memberMap_) {
-    auto& name = kv.first;
+  // Members in index are never anonymous
+  for (auto& kv: anonyType->memberIndex_) {
+    auto& name = *kv.first->name_;
     auto member = kv.second->ToObject();
     // Every member of anonymous struct/union
     //     are offseted by external struct/union
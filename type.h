@@ -8,6 +8,7 @@
 
 #include <algorithm>
 #include <list>
+#include <vector>
 
 
 /********* Type System ***********/
@@ -143,8 +144,7 @@ public:
   virtual const StructType* ToStruct() const { return nullptr; }
 
 protected:
-  Type(MemPool* pool, bool complete)
-      : qual_(0), complete_(complete), pool_(pool) {}
+  explicit Type(bool complete): qual_(0), complete_(complete) {}
 
   // C11 6.7.3 [4]: The properties associated with qualified types
   // are meaningful only for expressions that are lvalues.
@@ -152,7 +152,6 @@ protected:
   // But it's not used to decide the compatibility of two types.
   mutable int qual_;
   bool complete_;
-  MemPool* pool_;
 };
 
 
@@ -179,7 +178,7 @@ public:
   virtual std::string Str() const { return "void:1"; }
 
 protected:
-  explicit VoidType(MemPool* pool): Type(pool, false) {}
+  VoidType(): Type(false) {}
 };
 
 
@@ -219,8 +218,7 @@ public:
   static ArithmType* MaxType(ArithmType* lhsType, ArithmType* rhsType);
 
 protected:
-  explicit ArithmType(MemPool* pool, int spec)
-    : Type(pool, true), tag_(Spec2Tag(spec)) {}
+  explicit ArithmType(int spec): Type(true), tag_(Spec2Tag(spec)) {}
 
 private:
   static int Spec2Tag(int spec);
@@ -232,15 +230,14 @@ private:
 class DerivedType : public Type
 {
   //friend class Type;
+  friend class Serializer;
 public:
+  // Derived types may be shared (see PointerType::New),
+  // thus the derived type never changes after creation.
   Type* Derived() {
     return derived_;
   }
   
-  void SetDerived(Type* derived) {
-    derived_ = derived;
-  }
-  
   virtual DerivedType* ToDerived() {
     return this;
   }
@@ -250,8 +247,7 @@ public:
   }
 
 protected:
-  DerivedType(MemPool* pool, Type* derived)
-      : Type(pool, true), derived_(derived) {}
+  explicit DerivedType(Type* derived): Type(true), derived_(derived) {}
 
   Type* derived_;
 };
@@ -260,9 +256,10 @@ protected:
 class PointerType : public DerivedType
 {
   friend class Type;
+  friend class Serializer;
 
 public:
-  static PointerType* New(Type* derived);
+  static PointerType* New(Type* derived, int qual=0);
 
   ~PointerType() {}
   virtual PointerType* ToPointer() { return this; }
@@ -276,13 +273,14 @@ public:
   }
 
 protected:
-  PointerType(MemPool* pool, Type* derived): DerivedType(pool, derived) {}
+  explicit PointerType(Type* derived): DerivedType(derived) {}
 };
 
 
 class ArrayType : public DerivedType
 {
   friend class Type;
+  friend class Serializer;
 
 public:
   static ArrayType* New(int len, Type* eleType);
@@ -302,8 +300,7 @@ public:
   void SetLen(int len) { len_ = len; }
 
 protected:
-  ArrayType(MemPool* pool, int len, Type* derived)
-      : DerivedType(pool, derived), len_(len) {
+  ArrayType(int len, Type* derived): DerivedType(derived), len_(len) {
     SetComplete(len_ >= 0);
     SetQual(Q_CONST);
   }
@@ -314,6 +311,7 @@ protected:
 
 class FuncType : public DerivedType
 {
+  friend class Serializer;
 public:
   typedef std::vector<Object*> ParamList;
 
@@ -335,9 +333,9 @@ public:
   bool Variadic() const { return variadic_; }
 
 protected:
-  FuncType(MemPool* pool, Type* derived, int inlineReturn,
+  FuncType(Type* derived, int inlineReturn,
            bool variadic, const ParamList& params)
-      : DerivedType(pool, derived), inlineNoReturn_(inlineReturn),
+      : DerivedType(derived), inlineNoReturn_(inlineReturn),
         variadic_(variadic), params_(params) {
     SetComplete(false);
   }
@@ -352,10 +350,14 @@ private:
 class StructType : public Type
 {
   friend class Type;
+  friend class Serializer;
   
 public:
   typedef std::list<Object*> MemberList;
   typedef std::list<Object*>::iterator Iterator;
+  // Members sorted by the interned name, including those of
+  // anonymous struct/union
+  typedef std::vector<std::pair<Symbol*, Object*>> MemberIndex;
   
 public:
   static StructType* New(bool isStruct, bool hasTag, Scope* parent);
@@ -382,7 +384,7 @@ public:
   
 protected:
   // default is incomplete
-  StructType(MemPool* pool, bool isStruct, bool hasTag, Scope* parent);
+  StructType(bool isStruct, bool hasTag, Scope* parent);
   
   StructType(const StructType& other);
 
@@ -396,7 +398,10 @@ private:
 
   bool isStruct_;
   bool hasTag_;
+  // Deleted by Finalize(), the members of the complete type are
+  // looked up in the index
   Scope* memberMap_;
+  MemberIndex memberIndex_;
 
   MemberList members_;
   int offset_;